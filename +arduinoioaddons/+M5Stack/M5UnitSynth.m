@@ -39,12 +39,111 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
         CMD_SET_MOD_WHEEL        = 0x13
         CMD_SET_ALL_DRUMS        = 0x14
         CMD_RESET                = 0x15
+        CMD_SET_TEMPO            = 0x16
+        CMD_START_CLOCK          = 0x17
+        CMD_STOP_CLOCK           = 0x18
+        CMD_PRESET_STORE         = 0x19
+        CMD_PRESET_RECALL        = 0x1A
+        CMD_CHORD_ON             = 0x1B
+        CMD_CHORD_OFF            = 0x1C
+        CMD_SET_CHORD_TABLE      = 0x1D
+        CMD_QUEUE_EVENTS         = 0x1E
+        CMD_QUEUE_START          = 0x1F
+        CMD_QUEUE_STOP           = 0x20
+        CMD_GET_QUEUE_STATS      = 0x21
+        CMD_SET_ROUTE            = 0x22
+        CMD_SET_BALANCE          = 0x23
+        CMD_GET_PROFILE          = 0x24
+        CMD_GET_STATS            = 0x25
+        CMD_GET_TRACE            = 0x26
+        CMD_GET_MEMORY           = 0x27
+        CMD_SET_POWER            = 0x28
+        CMD_GET_POWER_STATS      = 0x29
+        CMD_SET_NOTE_TIMEOUT     = 0x2A
+        CMD_SET_LINK_TIMEOUT     = 0x2B
+        CMD_GET_REAPER_STATS     = 0x2C
+        CMD_SET_JOURNAL          = 0x2D
+        CMD_GET_JOURNAL          = 0x2E
+        CMD_REPLAY_JOURNAL       = 0x2F
+        CMD_SET_MIDI_INPUT       = 0x30
+        CMD_GET_MIDI_INPUT       = 0x31
+        CMD_SET_NOTIFY           = 0x32
+        CMD_GET_NOTIFY           = 0x33
+        CMD_SET_TUNING_TABLE     = 0x34
+        CMD_SET_CHANNEL_TUNING   = 0x35
+        CMD_SET_MPE_ZONE         = 0x36
+        CMD_SET_NOTE_EXPRESSION  = 0x37
+        CMD_SET_GROOVE           = 0x38
+        CMD_SET_QUIET            = 0x39
+        
+        PRESET_SLOTS             = 8     % M5UNITML_PRESET_SLOTS in M5UnitML.h
+        USER_CHORDS              = 4     % M5UNITML_USER_CHORDS in M5UnitML.h
+        MAX_CHORD_NOTES          = 6     % M5UNITML_MAX_CHORD_NOTES in M5UnitML.h
+        CHORD_USER_FIRST         = 16    % CHORD_USER_FIRST in M5UnitML.h
+        CHORD_NAMES = {'major', 'minor', '7', 'maj7', 'min7', 'sus2', 'sus4', 'dim', 'aug'}
+        EVENT_QUEUE_SIZE         = 128   % M5UNITML_EVENT_QUEUE_SIZE in M5UnitML.h
+        EVENT_BATCH              = 8     % Events per CMD_QUEUE_EVENTS message
+        EVENT_BYTES              = 8     % M5UNITML_EVENT_BYTES in M5UnitML.h
+        STREAM_POLL_INTERVAL     = 0.02  % Seconds between credit polls while the queue is full
+        LATENESS_BUCKETS         = 16    % M5UNITML_LATENESS_BUCKETS in M5UnitML.h
+        MAX_UNITS                = 2     % M5UNITML_MAX_UNITS in M5UnitML.h
+        PROFILE_ENTRY_BYTES      = 33    % M5UNITML_PROFILE_ENTRY_BYTES in M5UnitML.h
+        PROFILE_DONE             = 255   % M5UNITML_PROFILE_DONE in M5UnitML.h
+        STATS_ENTRY_BYTES        = 21    % M5UNITML_STATS_ENTRY_BYTES in M5UnitML.h
+        STATS_DONE               = 255   % M5UNITML_STATS_DONE in M5UnitML.h
+        TRACE_SIZE               = 256   % M5UNITML_TRACE_SIZE in M5UnitML.h
+        TRACE_ENTRY_BYTES        = 8     % Wire size of one trace entry
+        JOURNAL_SIZE             = 64    % M5UNITML_JOURNAL_SIZE in M5UnitML.h
+        JOURNAL_PAYLOAD          = 72    % M5UNITML_JOURNAL_PAYLOAD in M5UnitML.h
+        MIDI_IN_KEEP_CHANNEL     = 0xFF  % MIDI_IN_KEEP_CHANNEL in M5UnitML.h
+        NOTIFY_BYTES             = 4     % M5UNITML_NOTIFY_BYTES in M5UnitML.h
+        MARKER_STATUS            = 0xF9  % M5UNITML_MARKER_STATUS in M5UnitML.h
+        TUNING_TABLES            = 4     % M5UNITML_TUNING_TABLES in M5UnitML.h
+        TUNING_CHUNK             = 16    % M5UNITML_TUNING_CHUNK in M5UnitML.h
+        NO_TUNING                = 0xFF  % M5UNITML_NO_TUNING in M5UnitML.h
+        TUNING_UNMAPPED          = 0xFF  % TUNING_UNMAPPED in M5UnitML.h
+        NOTE_EXPRESSION_NAMES = {'Bend', 'Pressure'}   % NOTE_EXPRESSION_* in M5UnitML.h, from 0
+        PPQN                     = 24    % M5UNITML_PPQN in M5UnitML.h
+        GROOVE_MAX_GRID          = 96    % M5UNITML_GROOVE_MAX_GRID in M5UnitML.h
+        GROOVE_MAX_SWING         = 75    % M5UNITML_GROOVE_MAX_SWING in M5UnitML.h
+        GROOVE_MAX_HUMANIZE      = 50    % M5UNITML_GROOVE_MAX_HUMANIZE in M5UnitML.h (ms)
+        GROOVE_MAX_VELOCITY      = 64    % M5UNITML_GROOVE_MAX_VELOCITY in M5UnitML.h
+        NOTIFY_NAMES = {'QueueDrained', 'Marker', 'QueueOverflow', 'VoiceStolen', 'NoteReaped', ...
+            'LinkRelease', 'ReplayDone', 'MidiInput'}   % NOTIFY_* in M5UnitML.h, from 1
+        TRACE_NAMES = {'Command', 'CommandDone', 'EventQueued', 'EventEmitted', ...
+            'MidiWrite', 'QueueOverflow', 'QueueDrained', 'MidiInput'}   % TRACE_* in M5UnitML.h, from 1
+        MIDI_BYTE_TIME           = 320e-6 % Seconds per MIDI byte at 31250 baud
+        POWER_MODES = {'off', 'scale', 'sleep'}   % POWER_MODE_* in M5UnitML.h, from 0
+        MAX_QUIET_TIME           = 600   % M5UNITML_MAX_QUIET_MS in M5UnitML.h (s)
     end
     
     properties(Access = public)
         RXPin = 16;       % UART RX pin (default: 16)
         TXPin = 17;       % UART TX pin (default: 17)
         BaudRate = 31250; % UART baud rate (MIDI standard: 31250)
+        Validate = true;  % Range-check message arguments (false skips the checks)
+        NotificationFcn = []; % Called as fcn(synth, notifications) when notifications arrive
+    end
+    
+    properties(SetAccess = private)
+        FreeEventSlots = 128; % Free device event queue slots, updated from every ack
+        Units = [16 17];      % [RX TX] pins of each Unit-Synth module, one row per unit
+        NumChannels = 16;     % Logical MIDI channels (16 per unit)
+        Profiling = false;    % true between startProfiling and stopProfiling
+        PowerMode = 'off';    % Device idle power mode set with setPowerMode
+        NotifyOnAck = false;  % Notifications ride on every ack (setNotifications)
+    end
+    
+    properties(Access = private)
+        ProfileLog = zeros(0, 5); % [time, command, validation, packing, send] per call
+        ProfileCount = 0;         % Rows of ProfileLog in use
+        ProfileEpoch              % tic at startProfiling
+        ProfileDuration = 0;      % Seconds profiled, fixed by stopProfiling
+        ProfileCallStart = [];    % tic at the start of the current method's checks
+        ProfileValidated = NaN;   % Seconds spent validating in the current method
+        PendingNotifications = zeros(0, 4); % [time, type, arg, count] from acks, no NotificationFcn
+        QuietStart = [];          % tic at the last waitQuiet
+        QuietTime = 0;            % Seconds the device was promised no commands
     end
     
     properties(Constant, Access = protected)
@@ -62,12 +161,20 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             % Syntax:
             %   synth = M5UnitSynth(arduinoObj)
             %   synth = M5UnitSynth(arduinoObj, 'RXPin', rxPin, 'TXPin', txPin, 'BaudRate', baud)
+            %   synth = M5UnitSynth(arduinoObj, 'Units', [rx1 tx1; rx2 tx2], 'Routing', routes)
             %
             % Inputs:
             %   arduinoObj - Arduino object
             %   RXPin - (Optional) UART RX pin (default: 16)
             %   TXPin - (Optional) UART TX pin (default: 17)
             %   BaudRate - (Optional) UART baud rate (default: 31250 for MIDI)
+            %   Units - (Optional) One [RX TX] row per Unit-Synth module, up to 2.
+            %           Overrides RXPin/TXPin. Unit 1 uses UART2, unit 2 UART1.
+            %   Routing - (Optional) One [unit channel] row per logical channel
+            %             (unit 0-based). Default: logical channel n plays on
+            %             unit floor(n/16), channel mod(n,16).
+            %   Validate - (Optional) true/'on' (default) or false/'off'. With
+            %              'off' the per-message methods skip their argument checks.
             %
             % Common M5Stack port configurations:
             %   Port A: RX=33, TX=32
@@ -81,28 +188,52 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             addParameter(p, 'RXPin', 16, @(x) isnumeric(x) && x >= 0);
             addParameter(p, 'TXPin', 17, @(x) isnumeric(x) && x >= 0);
             addParameter(p, 'BaudRate', 31250, @(x) isnumeric(x) && x > 0);
+            addParameter(p, 'Units', [], @(x) isnumeric(x) && size(x, 2) == 2 && size(x, 1) <= obj.MAX_UNITS);
+            addParameter(p, 'Routing', [], @(x) isnumeric(x) && size(x, 2) == 2);
+            addParameter(p, 'Validate', true, @(x) islogical(x) || isnumeric(x) || any(strcmpi(x, {'on', 'off'})));
             parse(p, varargin{:});
             
             obj.RXPin = p.Results.RXPin;
             obj.TXPin = p.Results.TXPin;
             obj.BaudRate = p.Results.BaudRate;
+            if ischar(p.Results.Validate) || isstring(p.Results.Validate)
+                obj.Validate = strcmpi(p.Results.Validate, 'on');
+            else
+                obj.Validate = logical(p.Results.Validate);
+            end
+            if isempty(p.Results.Units)
+                obj.Units = [obj.RXPin, obj.TXPin];
+            else
+                obj.Units = p.Results.Units;
+                obj.RXPin = obj.Units(1, 1);
+                obj.TXPin = obj.Units(1, 2);
+            end
+            obj.NumChannels = 16 * size(obj.Units, 1);
             
-            % Initialize the device
-            obj.begin(obj.RXPin, obj.TXPin, obj.BaudRate);
+            % Initialize the device, one module per UART
+            for unit = 0:size(obj.Units, 1) - 1
+                obj.begin(obj.Units(unit + 1, 1), obj.Units(unit + 1, 2), obj.BaudRate, unit);
+            end
+            if ~isempty(p.Results.Routing)
+                routes = p.Results.Routing;
+                obj.setRoute(0:size(routes, 1) - 1, routes(:, 1), routes(:, 2));
+            end
         end
         
-        function success = begin(obj, rxPin, txPin, baudRate)
+        function success = begin(obj, rxPin, txPin, baudRate, unit)
             % BEGIN Initialize the M5UnitSynth module with UART
             %
             % Syntax:
             %   success = begin(synth)
             %   success = begin(synth, rxPin, txPin)
             %   success = begin(synth, rxPin, txPin, baudRate)
+            %   success = begin(synth, rxPin, txPin, baudRate, unit)
             %
             % Inputs:
             %   rxPin - (Optional) UART RX pin (default: uses obj.RXPin)
             %   txPin - (Optional) UART TX pin (default: uses obj.TXPin)
             %   baudRate - (Optional) UART baud rate (default: uses obj.BaudRate)
+            %   unit - (Optional) Module index (0-1, default: 0)
             %
             % Outputs:
             %   success - true if initialization successful, false otherwise
@@ -120,12 +251,15 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             if nargin < 4
                 baudRate = obj.BaudRate;
             end
+            if nargin < 5
+                unit = 0;
+            end
             
             % Send begin command
-            % dataIn[0] = RX pin, dataIn[1] = TX pin, dataIn[2-3] = Baud rate
+            % dataIn[0] = RX pin, dataIn[1] = TX pin, dataIn[2-3] = Baud rate, dataIn[4] = unit
             lsb = uint8(mod(baudRate, 256));
             msb = uint8(floor(baudRate / 256));
-            data = uint8([rxPin, txPin, lsb, msb]);
+            data = uint8([rxPin, txPin, lsb, msb, unit]);
             
             response = sendCommand(obj, obj.LibraryName, obj.CMD_BEGIN, data);
             
@@ -144,7 +278,7 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %
             % Inputs:
             %   bank       - MIDI bank (0-127), usually 0 for GM sounds
-            %   channel    - MIDI channel (0-15)
+            %   channel    - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   instrument - MIDI instrument number (0-127)
             %                0 = Acoustic Grand Piano, 40 = Violin, etc.
             %
@@ -152,9 +286,7 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   synth.setInstrument(0, 0, 0);   % Bank 0, Channel 0, Piano
             %   synth.setInstrument(0, 1, 40);  % Bank 0, Channel 1, Violin
             
-            validateattributes(bank, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setInstrument', 'bank');
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setInstrument', 'channel');
-            validateattributes(instrument, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setInstrument', 'instrument');
+            obj.checkArgs('setInstrument', {'bank', 'channel', 'instrument'}, [127, obj.NumChannels - 1, 127], bank, channel, instrument);
             
             data = uint8([bank, channel, instrument]);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_INSTRUMENT, data);
@@ -167,16 +299,14 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   setNoteOn(synth, channel, pitch, velocity)
             %
             % Inputs:
-            %   channel  - MIDI channel (0-15)
+            %   channel  - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   pitch    - MIDI note number (0-127), 60 = Middle C
             %   velocity - Note velocity (0-127), affects volume/intensity
             %
             % Example:
             %   synth.setNoteOn(0, 60, 100);  % Play middle C on channel 0
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setNoteOn', 'channel');
-            validateattributes(pitch, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setNoteOn', 'pitch');
-            validateattributes(velocity, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setNoteOn', 'velocity');
+            obj.checkArgs('setNoteOn', {'channel', 'pitch', 'velocity'}, [obj.NumChannels - 1, 127, 127], channel, pitch, velocity);
             
             data = uint8([channel, pitch, velocity]);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_NOTE_ON, data);
@@ -189,16 +319,14 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   setNoteOff(synth, channel, pitch, velocity)
             %
             % Inputs:
-            %   channel  - MIDI channel (0-15)
+            %   channel  - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   pitch    - MIDI note number (0-127)
             %   velocity - Release velocity (0-127), usually 0
             %
             % Example:
             %   synth.setNoteOff(0, 60, 0);  % Stop middle C on channel 0
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setNoteOff', 'channel');
-            validateattributes(pitch, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setNoteOff', 'pitch');
-            validateattributes(velocity, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setNoteOff', 'velocity');
+            obj.checkArgs('setNoteOff', {'channel', 'pitch', 'velocity'}, [obj.NumChannels - 1, 127, 127], channel, pitch, velocity);
             
             data = uint8([channel, pitch, velocity]);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_NOTE_OFF, data);
@@ -211,12 +339,12 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   setAllNotesOff(synth, channel)
             %
             % Inputs:
-            %   channel - MIDI channel (0-15)
+            %   channel - MIDI channel (0-15, up to NumChannels-1 with several units)
             %
             % Example:
             %   synth.setAllNotesOff(0);  % Stop all notes on channel 0
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setAllNotesOff', 'channel');
+            obj.checkArgs('setAllNotesOff', {'channel'}, obj.NumChannels - 1, channel);
             
             data = uint8(channel);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_ALL_NOTE_OFF, data);
@@ -229,7 +357,7 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   setPitchBend(synth, channel, value)
             %
             % Inputs:
-            %   channel - MIDI channel (0-15)
+            %   channel - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   value   - Pitch bend value (-8192 to +8191), 0 = center (no bend)
             %             Positive = bend up, Negative = bend down
             %
@@ -238,8 +366,10 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   synth.setPitchBend(0, 4096);  % Bend pitch up
             %   synth.setPitchBend(0, -4096); % Bend pitch down
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setPitchBend', 'channel');
-            validateattributes(value, {'numeric'}, {'scalar', '>=', -8192, '<=', 8191}, 'setPitchBend', 'value');
+            obj.checkArgs('setPitchBend', {'channel'}, obj.NumChannels - 1, channel);
+            if obj.Validate
+                validateattributes(value, {'numeric'}, {'scalar', '>=', -8192, '<=', 8191}, 'setPitchBend', 'value');
+            end
             
             % Convert to int16 and split into bytes (LSB first)
             int16Val = int16(value);
@@ -257,15 +387,14 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   setPitchBendRange(synth, channel, value)
             %
             % Inputs:
-            %   channel - MIDI channel (0-15)
+            %   channel - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   value   - Pitch bend range in semitones (0-127), default is usually 2
             %
             % Example:
             %   synth.setPitchBendRange(0, 2);   % ±2 semitones
             %   synth.setPitchBendRange(0, 12);  % ±1 octave
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setPitchBendRange', 'channel');
-            validateattributes(value, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setPitchBendRange', 'value');
+            obj.checkArgs('setPitchBendRange', {'channel', 'value'}, [obj.NumChannels - 1, 127], channel, value);
             
             data = uint8([channel, value]);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_PITCH_BEND_RANGE, data);
@@ -283,7 +412,7 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             % Example:
             %   synth.setMasterVolume(100);  % Set volume to 100
             
-            validateattributes(level, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setMasterVolume', 'level');
+            obj.checkArgs('setMasterVolume', {'level'}, 127, level);
             
             data = uint8(level);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_MASTER_VOLUME, data);
@@ -296,14 +425,13 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   setVolume(synth, channel, level)
             %
             % Inputs:
-            %   channel - MIDI channel (0-15)
+            %   channel - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   level   - Channel volume (0-127)
             %
             % Example:
             %   synth.setVolume(0, 80);  % Set channel 0 volume to 80
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setVolume', 'channel');
-            validateattributes(level, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setVolume', 'level');
+            obj.checkArgs('setVolume', {'channel', 'level'}, [obj.NumChannels - 1, 127], channel, level);
             
             data = uint8([channel, level]);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_CHANNEL_VOLUME, data);
@@ -316,14 +444,13 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   setExpression(synth, channel, expression)
             %
             % Inputs:
-            %   channel    - MIDI channel (0-15)
+            %   channel    - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   expression - Expression level (0-127), controls dynamics
             %
             % Example:
             %   synth.setExpression(0, 100);  % High expression
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setExpression', 'channel');
-            validateattributes(expression, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setExpression', 'expression');
+            obj.checkArgs('setExpression', {'channel', 'expression'}, [obj.NumChannels - 1, 127], channel, expression);
             
             data = uint8([channel, expression]);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_EXPRESSION, data);
@@ -336,7 +463,7 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   setReverb(synth, channel, program, level, delayfeedback)
             %
             % Inputs:
-            %   channel       - MIDI channel (0-15)
+            %   channel       - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   program       - Reverb type (0-127)
             %   level         - Reverb level (0-127), 0 = no reverb, 127 = maximum
             %   delayfeedback - Delay feedback (0-127)
@@ -344,10 +471,8 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             % Example:
             %   synth.setReverb(0, 0, 64, 50);  % Moderate reverb on channel 0
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setReverb', 'channel');
-            validateattributes(program, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setReverb', 'program');
-            validateattributes(level, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setReverb', 'level');
-            validateattributes(delayfeedback, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setReverb', 'delayfeedback');
+            obj.checkArgs('setReverb', {'channel', 'program', 'level', 'delayfeedback'}, ...
+                [obj.NumChannels - 1, 127, 127, 127], channel, program, level, delayfeedback);
             
             data = uint8([channel, program, level, delayfeedback]);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_REVERB, data);
@@ -360,7 +485,7 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   setChorus(synth, channel, program, level, feedback, chorusdelay)
             %
             % Inputs:
-            %   channel     - MIDI channel (0-15)
+            %   channel     - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   program     - Chorus type (0-127)
             %   level       - Chorus level (0-127)
             %   feedback    - Feedback (0-127)
@@ -369,11 +494,8 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             % Example:
             %   synth.setChorus(0, 0, 64, 50, 30);  % Moderate chorus
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setChorus', 'channel');
-            validateattributes(program, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setChorus', 'program');
-            validateattributes(level, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setChorus', 'level');
-            validateattributes(feedback, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setChorus', 'feedback');
-            validateattributes(chorusdelay, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setChorus', 'chorusdelay');
+            obj.checkArgs('setChorus', {'channel', 'program', 'level', 'feedback', 'chorusdelay'}, ...
+                [obj.NumChannels - 1, repmat(127, 1, 4)], channel, program, level, feedback, chorusdelay);
             
             data = uint8([channel, program, level, feedback, chorusdelay]);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_CHORUS, data);
@@ -386,7 +508,7 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   setPan(synth, channel, value)
             %
             % Inputs:
-            %   channel - MIDI channel (0-15)
+            %   channel - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   value   - Pan value (0-127), 0 = left, 64 = center, 127 = right
             %
             % Example:
@@ -394,8 +516,7 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   synth.setPan(0, 0);    % Full left
             %   synth.setPan(0, 127);  % Full right
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setPan', 'channel');
-            validateattributes(value, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setPan', 'value');
+            obj.checkArgs('setPan', {'channel', 'value'}, [obj.NumChannels - 1, 127], channel, value);
             
             data = uint8([channel, value]);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_PAN, data);
@@ -409,7 +530,7 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %                lowfreq, medlowfreq, medhighfreq, highfreq)
             %
             % Inputs:
-            %   channel      - MIDI channel (0-15)
+            %   channel      - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   lowband      - Low band gain (0-127)
             %   medlowband   - Mid-low band gain (0-127)
             %   medhighband  - Mid-high band gain (0-127)
@@ -422,15 +543,8 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             % Example:
             %   synth.setEqualizer(0, 64, 64, 64, 64, 32, 48, 80, 96);
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setEqualizer', 'channel');
-            validateattributes(lowband, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setEqualizer', 'lowband');
-            validateattributes(medlowband, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setEqualizer', 'medlowband');
-            validateattributes(medhighband, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setEqualizer', 'medhighband');
-            validateattributes(highband, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setEqualizer', 'highband');
-            validateattributes(lowfreq, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setEqualizer', 'lowfreq');
-            validateattributes(medlowfreq, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setEqualizer', 'medlowfreq');
-            validateattributes(medhighfreq, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setEqualizer', 'medhighfreq');
-            validateattributes(highfreq, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setEqualizer', 'highfreq');
+            obj.checkArgs('setEqualizer', {'channel', 'lowband', 'medlowband', 'medhighband', 'highband', 'lowfreq', 'medlowfreq', 'medhighfreq', 'highfreq'}, ...
+                [obj.NumChannels - 1, repmat(127, 1, 8)], channel, lowband, medlowband, medhighband, highband, lowfreq, medlowfreq, medhighfreq, highfreq);
             
             data = uint8([channel, lowband, medlowband, medhighband, highband, lowfreq, medlowfreq, medhighfreq, highfreq]);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_EQUALIZER, data);
@@ -443,7 +557,7 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   setTuning(synth, channel, fine, coarse)
             %
             % Inputs:
-            %   channel - MIDI channel (0-15)
+            %   channel - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   fine    - Fine tuning (0-127), 64 = default/center
             %   coarse  - Coarse tuning (0-127), 64 = default/center
             %
@@ -451,9 +565,7 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   synth.setTuning(0, 64, 64);  % Default tuning
             %   synth.setTuning(0, 70, 64);  % Slightly sharp
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setTuning', 'channel');
-            validateattributes(fine, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setTuning', 'fine');
-            validateattributes(coarse, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setTuning', 'coarse');
+            obj.checkArgs('setTuning', {'channel', 'fine', 'coarse'}, [obj.NumChannels - 1, 127, 127], channel, fine, coarse);
             
             data = uint8([channel, fine, coarse]);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_TUNING, data);
@@ -466,7 +578,7 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   setVibrate(synth, channel, rate, depth, delay)
             %
             % Inputs:
-            %   channel - MIDI channel (0-15)
+            %   channel - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   rate    - Vibrato rate (0-127)
             %   depth   - Vibrato depth (0-127)
             %   delay   - Vibrato delay (0-127)
@@ -474,10 +586,8 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             % Example:
             %   synth.setVibrate(0, 50, 40, 20);  % Moderate vibrato
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setVibrate', 'channel');
-            validateattributes(rate, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setVibrate', 'rate');
-            validateattributes(depth, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setVibrate', 'depth');
-            validateattributes(delay, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setVibrate', 'delay');
+            obj.checkArgs('setVibrate', {'channel', 'rate', 'depth', 'delay'}, ...
+                [obj.NumChannels - 1, 127, 127, 127], channel, rate, depth, delay);
             
             data = uint8([channel, rate, depth, delay]);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_VIBRATE, data);
@@ -490,16 +600,14 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   setTvf(synth, channel, cutoff, resonance)
             %
             % Inputs:
-            %   channel   - MIDI channel (0-15)
+            %   channel   - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   cutoff    - Filter cutoff frequency (0-127)
             %   resonance - Filter resonance (0-127)
             %
             % Example:
             %   synth.setTvf(0, 64, 40);  % Moderate filter
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setTvf', 'channel');
-            validateattributes(cutoff, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setTvf', 'cutoff');
-            validateattributes(resonance, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setTvf', 'resonance');
+            obj.checkArgs('setTvf', {'channel', 'cutoff', 'resonance'}, [obj.NumChannels - 1, 127, 127], channel, cutoff, resonance);
             
             data = uint8([channel, cutoff, resonance]);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_TVF, data);
@@ -512,7 +620,7 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %   setEnvelope(synth, channel, attack, decay, release)
             %
             % Inputs:
-            %   channel - MIDI channel (0-15)
+            %   channel - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   attack  - Attack time (0-127)
             %   decay   - Decay time (0-127)
             %   release - Release time (0-127)
@@ -520,10 +628,8 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             % Example:
             %   synth.setEnvelope(0, 20, 40, 30);  % Fast attack, moderate decay/release
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setEnvelope', 'channel');
-            validateattributes(attack, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setEnvelope', 'attack');
-            validateattributes(decay, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setEnvelope', 'decay');
-            validateattributes(release, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setEnvelope', 'release');
+            obj.checkArgs('setEnvelope', {'channel', 'attack', 'decay', 'release'}, ...
+                [obj.NumChannels - 1, 127, 127, 127], channel, attack, decay, release);
             
             data = uint8([channel, attack, decay, release]);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_ENVELOPE, data);
@@ -537,7 +643,7 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             %               pitchdepth, tvfdepth, tvadepth)
             %
             % Inputs:
-            %   channel    - MIDI channel (0-15)
+            %   channel    - MIDI channel (0-15, up to NumChannels-1 with several units)
             %   pitch      - Pitch modulation (0-127)
             %   tvtcutoff  - TVT cutoff modulation (0-127)
             %   amplitude  - Amplitude modulation (0-127)
@@ -549,14 +655,8 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             % Example:
             %   synth.setModWheel(0, 64, 50, 60, 40, 50, 50, 50);
             
-            validateattributes(channel, {'numeric'}, {'scalar', '>=', 0, '<=', 15}, 'setModWheel', 'channel');
-            validateattributes(pitch, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setModWheel', 'pitch');
-            validateattributes(tvtcutoff, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setModWheel', 'tvtcutoff');
-            validateattributes(amplitude, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setModWheel', 'amplitude');
-            validateattributes(rate, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setModWheel', 'rate');
-            validateattributes(pitchdepth, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setModWheel', 'pitchdepth');
-            validateattributes(tvfdepth, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setModWheel', 'tvfdepth');
-            validateattributes(tvadepth, {'numeric'}, {'scalar', '>=', 0, '<=', 127}, 'setModWheel', 'tvadepth');
+            obj.checkArgs('setModWheel', {'channel', 'pitch', 'tvtcutoff', 'amplitude', 'rate', 'pitchdepth', 'tvfdepth', 'tvadepth'}, ...
+                [obj.NumChannels - 1, repmat(127, 1, 7)], channel, pitch, tvtcutoff, amplitude, rate, pitchdepth, tvfdepth, tvadepth);
             
             data = uint8([channel, pitch, tvtcutoff, amplitude, rate, pitchdepth, tvfdepth, tvadepth]);
             sendCommand(obj, obj.LibraryName, obj.CMD_SET_MOD_WHEEL, data);
@@ -592,43 +692,2021 @@ classdef M5UnitSynth <  matlabshared.addon.LibraryBase & matlab.mixin.CustomDisp
             sendCommand(obj, obj.LibraryName, obj.CMD_RESET, data);
         end
         
-        function playNote(obj, channel, pitch, duration, velocity)
-            % PLAYNOTE Play a note for a specified duration
+        function setTempo(obj, bpm, rampTime)
+            % SETTEMPO Set the tempo of the device clock
             %
             % Syntax:
-            %   playNote(synth, channel, pitch, duration)
-            %   playNote(synth, channel, pitch, duration, velocity)
+            %   setTempo(synth, bpm)
+            %   setTempo(synth, bpm, rampTime)
             %
             % Inputs:
-            %   channel  - MIDI channel (0-15)
-            %   pitch    - MIDI note number (0-127)
-            %   duration - Duration in seconds
-            %   velocity - (Optional) Note velocity (0-127), default = 100
+            %   bpm      - Tempo in beats per minute (20-300), fractional values allowed
+            %   rampTime - (Optional) Time in seconds to glide linearly from the
+            %              current tempo to bpm (default = 0, immediate change)
             %
-            % This is a convenience function that turns on a note, waits,
-            % then turns it off.
+            % The tempo is kept on the device with 1/1000 BPM resolution and drives
+            % the 24 PPQN clock used by all device-side timed features.
             %
             % Example:
-            %   synth.playNote(0, 60, 0.5);      % Play middle C for 0.5 seconds
-            %   synth.playNote(0, 64, 1.0, 80);  % Play E for 1 second at velocity 80
+            %   synth.setTempo(120);        % 120 BPM
+            %   synth.setTempo(97.5);       % Fractional tempo
+            %   synth.setTempo(140, 8);     % Accelerate to 140 BPM over 8 seconds
+            
+            if nargin < 3
+                rampTime = 0;
+            end
+            
+            validateattributes(bpm, {'numeric'}, {'scalar', '>=', 20, '<=', 300}, 'setTempo', 'bpm');
+            validateattributes(rampTime, {'numeric'}, {'scalar', '>=', 0, '<=', 3600}, 'setTempo', 'rampTime');
+            
+            % dataIn[0-3] = tempo in 1/1000 BPM, dataIn[4-7] = ramp in ms (both uint32, LSB first)
+            data = [typecast(uint32(round(bpm * 1000)), 'uint8'), typecast(uint32(round(rampTime * 1000)), 'uint8')];
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_SET_TEMPO, data);
+            
+            if response(1) ~= 1
+                warning('M5UnitSynth:SetTempoFailed', 'Device rejected tempo %.3f BPM.', bpm);
+            end
+        end
+        
+        function startClock(obj, sendMidiClock)
+            % STARTCLOCK Start the device tempo clock
+            %
+            % Syntax:
+            %   startClock(synth)
+            %   startClock(synth, sendMidiClock)
+            %
+            % Inputs:
+            %   sendMidiClock - (Optional) true to also send MIDI Start, Clock
+            %                   (24 per quarter note) and Stop bytes on the synth
+            %                   UART (default = false)
+            %
+            % Example:
+            %   synth.setTempo(120);
+            %   synth.startClock(true);
+            
+            if nargin < 2
+                sendMidiClock = false;
+            end
+            
+            validateattributes(sendMidiClock, {'logical', 'numeric'}, {'scalar'}, 'startClock', 'sendMidiClock');
+            
+            data = uint8(logical(sendMidiClock));
+            sendCommand(obj, obj.LibraryName, obj.CMD_START_CLOCK, data);
+        end
+        
+        function stopClock(obj)
+            % STOPCLOCK Stop the device tempo clock
+            %
+            % Syntax:
+            %   stopClock(synth)
+            %
+            % Sends MIDI Stop if the clock was started with sendMidiClock = true.
+            %
+            % Example:
+            %   synth.stopClock();
+            
+            data = uint8([]);
+            sendCommand(obj, obj.LibraryName, obj.CMD_STOP_CLOCK, data);
+        end
+        
+        function storePreset(obj, slot)
+            % STOREPRESET Save the current configuration of all channels in a preset slot
+            %
+            % Syntax:
+            %   storePreset(synth, slot)
+            %
+            % Inputs:
+            %   slot - Preset slot (0-7)
+            %
+            % The device keeps track of the last instrument, volume, expression,
+            % pan, pitch bend range, reverb, chorus, equalizer, tuning, vibrato,
+            % TVF, envelope and modulation settings sent to each of the 16
+            % channels, plus the master volume. storePreset writes that state to
+            % flash so it survives power cycles.
+            %
+            % Example:
+            %   synth.setInstrument(0, 0, 40);
+            %   synth.setReverb(0, 4, 80, 60);
+            %   synth.storePreset(0);
+            
+            validateattributes(slot, {'numeric'}, {'scalar', 'integer', '>=', 0, '<', obj.PRESET_SLOTS}, 'storePreset', 'slot');
+            
+            data = uint8(slot);
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_PRESET_STORE, data);
+            
+            if response(1) ~= 1
+                warning('M5UnitSynth:PresetStoreFailed', 'Failed to store preset %d.', slot);
+            end
+        end
+        
+        function groupsSent = recallPreset(obj, slot)
+            % RECALLPRESET Restore the channel configuration saved in a preset slot
+            %
+            % Syntax:
+            %   recallPreset(synth, slot)
+            %   groupsSent = recallPreset(synth, slot)
+            %
+            % Inputs:
+            %   slot - Preset slot (0-7)
+            %
+            % Outputs:
+            %   groupsSent - Number of parameter groups (e.g. one setReverb) the
+            %                device had to send. Settings that already match the
+            %                preset are skipped.
+            %
+            % Example:
+            %   synth.recallPreset(0);
+            
+            validateattributes(slot, {'numeric'}, {'scalar', 'integer', '>=', 0, '<', obj.PRESET_SLOTS}, 'recallPreset', 'slot');
+            
+            data = uint8(slot);
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_PRESET_RECALL, data);
+            
+            if response(1) ~= 1
+                warning('M5UnitSynth:PresetRecallFailed', 'Preset %d is empty or could not be read.', slot);
+            end
+            groupsSent = double(response(2)) + 256 * double(response(3));
+        end
+        
+        function chordOn(obj, channel, root, quality, velocity, inversion, spread)
+            % CHORDON Play a chord expanded on the device
+            %
+            % Syntax:
+            %   chordOn(synth, channel, root, quality)
+            %   chordOn(synth, channel, root, quality, velocity, inversion, spread)
+            %
+            % Inputs:
+            %   channel   - MIDI channel (0-15, up to NumChannels-1 with several units)
+            %   root      - Root note (0-127), 60 = Middle C
+            %   quality   - 'major', 'minor', '7', 'maj7', 'min7', 'sus2', 'sus4',
+            %               'dim', 'aug', or a user table number (0-3) defined
+            %               with setChordTable
+            %   velocity  - (Optional) Note velocity (0-127), default = 100;
+            %               0 only releases the held chord
+            %   inversion - (Optional) Inversion (0 = root position), default = 0
+            %   spread    - (Optional) Octaves added to every second note of the
+            %               voicing (0 = close voicing), default = 0
+            %
+            % All notes are sent to the synth in one UART burst. A chord still
+            % held on the channel is released first.
+            %
+            % Example:
+            %   synth.chordOn(0, 60, 'major');          % C major
+            %   synth.chordOn(0, 57, 'min7', 90, 1);    % A minor 7, first inversion
             
             if nargin < 5
                 velocity = 100;
             end
+            if nargin < 6
+                inversion = 0;
+            end
+            if nargin < 7
+                spread = 0;
+            end
             
-            obj.setNoteOn(channel, pitch, velocity);
+            obj.checkArgs('chordOn', {'channel', 'root', 'velocity', 'inversion', 'spread'}, ...
+                [obj.NumChannels - 1, 127, 127, 5, 4], channel, root, velocity, inversion, spread);
+            
+            data = uint8([channel, root, obj.chordQualityId(quality), inversion, spread, velocity]);
+            sendCommand(obj, obj.LibraryName, obj.CMD_CHORD_ON, data);
+        end
+        
+        function chordOff(obj, channel)
+            % CHORDOFF Release the chord started with chordOn on a channel
+            %
+            % Syntax:
+            %   chordOff(synth, channel)
+            %
+            % Inputs:
+            %   channel - MIDI channel (0-15, up to NumChannels-1 with several units)
+            %
+            % Example:
+            %   synth.chordOff(0);
+            
+            obj.checkArgs('chordOff', {'channel'}, obj.NumChannels - 1, channel);
+            
+            data = uint8(channel);
+            sendCommand(obj, obj.LibraryName, obj.CMD_CHORD_OFF, data);
+        end
+        
+        function playChord(obj, channel, root, quality, duration, velocity, inversion, spread)
+            % PLAYCHORD Play a chord for a specified duration
+            %
+            % Syntax:
+            %   playChord(synth, channel, root, quality, duration)
+            %   playChord(synth, channel, root, quality, duration, velocity, inversion, spread)
+            %
+            % Inputs:
+            %   channel   - MIDI channel (0-15, up to NumChannels-1 with several units)
+            %   root      - Root note (0-127)
+            %   quality   - Chord quality, see chordOn
+            %   duration  - Duration in seconds
+            %   velocity  - (Optional) Note velocity (0-127), default = 100
+            %   inversion - (Optional) Inversion, default = 0
+            %   spread    - (Optional) Octave spread, default = 0
+            %
+            % This is the chord equivalent of playNote: two commands instead of
+            % one setNoteOn and one setNoteOff per chord tone.
+            %
+            % Example:
+            %   synth.playChord(0, 60, 'major', 1.5);
+            %   synth.playChord(0, 65, 'sus4', 1.0, 90, 2);
+            
+            if nargin < 6
+                velocity = 100;
+            end
+            if nargin < 7
+                inversion = 0;
+            end
+            if nargin < 8
+                spread = 0;
+            end
+            
+            obj.chordOn(channel, root, quality, velocity, inversion, spread);
             pause(duration);
-            obj.setNoteOff(channel, pitch, 0);
+            obj.chordOff(channel);
         end
-    end
-    
-    methods(Access = protected)
-        function output = sendCommand(obj, libName, commandID, inputs)
-            % SENDCOMMAND Send command to Arduino
-            try
-                output = sendCommand@matlabshared.addon.LibraryBase(obj, libName, commandID, inputs);
-            catch e
-                error('M5UnitSynth:CommandFailed', 'Failed to send command to M5UnitSynth: %s', e.message);
+        
+        function setChordTable(obj, slot, intervals)
+            % SETCHORDTABLE Define a user chord quality on the device
+            %
+            % Syntax:
+            %   setChordTable(synth, slot, intervals)
+            %
+            % Inputs:
+            %   slot      - User table number (0-3), used as the quality in chordOn
+            %   intervals - Semitone offsets above the root (1 to 6 values, 0-127)
+            %
+            % Example:
+            %   synth.setChordTable(0, [0, 7, 14, 16]);   % Add9 open voicing
+            %   synth.chordOn(0, 48, 0);
+            
+            validateattributes(slot, {'numeric'}, {'scalar', 'integer', '>=', 0, '<', obj.USER_CHORDS}, 'setChordTable', 'slot');
+            validateattributes(intervals, {'numeric'}, {'vector', 'integer', '>=', 0, '<=', 127}, 'setChordTable', 'intervals');
+            if numel(intervals) > obj.MAX_CHORD_NOTES
+                error('M5UnitSynth:TooManyIntervals', 'A chord table holds at most %d intervals.', obj.MAX_CHORD_NOTES);
+            end
+            
+            data = uint8([slot, numel(intervals), intervals(:)']);
+            sendCommand(obj, obj.LibraryName, obj.CMD_SET_CHORD_TABLE, data);
+        end
+        
+        function setRoute(obj, logicalChannels, units, channels)
+            % SETROUTE Map logical channels to a module and a channel on it
+            %
+            % Syntax:
+            %   setRoute(synth, logicalChannels, units, channels)
+            %
+            % Inputs:
+            %   logicalChannels - Consecutive logical channels (0 to NumChannels-1)
+            %   units           - Module index for each (0-based), scalar or vector
+            %   channels        - MIDI channel on that module (0-15), scalar or vector
+            %
+            % All channel arguments of the other methods are logical channels.
+            %
+            % Example:
+            %   synth = addon(esp32, 'M5Stack/M5UnitSynth', 'Units', [13 14; 33 32]);
+            %   synth.setRoute(0:3, [0 1 0 1], [0 0 1 1]);  % alternate modules
+            
+            validateattributes(logicalChannels, {'numeric'}, {'vector', 'integer', '>=', 0, '<=', obj.NumChannels - 1}, 'setRoute', 'logicalChannels');
+            validateattributes(units, {'numeric'}, {'vector', 'integer', '>=', 0, '<', size(obj.Units, 1)}, 'setRoute', 'units');
+            validateattributes(channels, {'numeric'}, {'vector', 'integer', '>=', 0, '<=', 15}, 'setRoute', 'channels');
+            if any(diff(logicalChannels) ~= 1)
+                error('M5UnitSynth:RouteNotContiguous', 'logicalChannels must be consecutive.');
+            end
+            
+            n = numel(logicalChannels);
+            routes = uint8(16 * (units(:)' .* ones(1, n)) + channels(:)' .* ones(1, n));
+            data = [uint8([logicalChannels(1), n]), routes];
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_SET_ROUTE, data);
+            
+            if response(1) ~= 1
+                warning('M5UnitSynth:SetRouteFailed', 'Device rejected the channel routing.');
+            end
+        end
+        
+        function setBalance(obj, channel, enable)
+            % SETBALANCE Spread a channel's notes over all modules by voice load
+            %
+            % Syntax:
+            %   setBalance(synth, channel, enable)
+            %
+            % Inputs:
+            %   channel - Logical MIDI channel (0 to NumChannels-1)
+            %   enable  - true to balance, false to play on the routed module only
+            %
+            % A balanced channel uses its routed MIDI channel number on every
+            % module. Its instrument, volume and effect settings are copied to
+            % all modules (immediately, and on every later change), and each
+            % new note plays on the module with the fewest sounding notes, so
+            % the channel's polyphony grows with the number of modules. Keep
+            % that MIDI channel number free on the other modules.
+            %
+            % Example:
+            %   synth = addon(esp32, 'M5Stack/M5UnitSynth', 'Units', [13 14; 33 32]);
+            %   synth.setInstrument(0, 0, 48);    % Strings
+            %   synth.setBalance(0, true);
+            
+            validateattributes(channel, {'numeric'}, {'scalar', 'integer', '>=', 0, '<=', obj.NumChannels - 1}, 'setBalance', 'channel');
+            validateattributes(enable, {'logical', 'numeric'}, {'scalar'}, 'setBalance', 'enable');
+            
+            data = uint8([channel, logical(enable)]);
+            sendCommand(obj, obj.LibraryName, obj.CMD_SET_BALANCE, data);
+        end
+        
+        function accepted = queueEvents(obj, events)
+            % QUEUEEVENTS Upload scheduled events to the device queue
+            %
+            % Syntax:
+            %   accepted = queueEvents(synth, events)
+            %
+            % Inputs:
+            %   events - N-by-4 or N-by-5 matrix, one event per row:
+            %            [time (s from startQueue), status, data1, data2, bank]
+            %            status is a MIDI channel message status byte, e.g.
+            %            0x90 + channel for note on. The optional bank column
+            %            selects logical channels 16 and up (logical channel =
+            %            16 * bank + status channel). Rows must be sorted by time.
+            %            A row with status MARKER_STATUS plays nothing and
+            %            posts a Marker notification with data1 (0-127) as its
+            %            id, e.g. to learn that a phrase has finished.
+            %
+            % Outputs:
+            %   accepted - Number of events sent. Only as many events as the
+            %              device has free slots (FreeEventSlots) are sent, so
+            %              this never overflows the queue; use streamEvents to
+            %              send a whole piece.
+            %
+            % Example:
+            %   synth.queueEvents([0 0x90 60 100; 0.5 0x80 60 0]);
+            %   synth.startQueue();
+            
+            validateattributes(events, {'numeric'}, {'2d'}, 'queueEvents', 'events');
+            if size(events, 2) == 4
+                events(:, 5) = 0;
+            elseif size(events, 2) ~= 5
+                error('M5UnitSynth:BadEvents', 'events must have 4 or 5 columns.');
+            end
+            
+            accepted = 0;
+            total = size(events, 1);
+            while accepted < total && obj.FreeEventSlots > 0
+                count = min([obj.EVENT_BATCH, obj.FreeEventSlots, total - accepted]);
+                response = sendCommand(obj, obj.LibraryName, obj.CMD_QUEUE_EVENTS, ...
+                    obj.packEvents(events(accepted + 1:accepted + count, :)));
+                accepted = accepted + double(response(2));
+                if response(1) ~= 1
+                    break;
+                end
+            end
+        end
+        
+        function streamEvents(obj, events, startDelay)
+            % STREAMEVENTS Play a list of events of any length through the device queue
+            %
+            % Syntax:
+            %   streamEvents(synth, events)
+            %   streamEvents(synth, events, startDelay)
+            %
+            % Inputs:
+            %   events     - N-by-4 or N-by-5 event matrix, see queueEvents.
+            %                Rows are sorted by time before sending.
+            %   startDelay - (Optional) Seconds between the queue being filled and
+            %                the first event (default = 0.1)
+            %
+            % The queue is filled, playback is started, and the queue is then
+            % kept topped up using the free-slot count returned with every ack.
+            % The device never holds more than its queue size, so memory stays
+            % bounded. Returns once every event has been uploaded, or errors with
+            % M5UnitSynth:QueueRejected when the device refuses an event; the
+            % events before it keep playing.
+            %
+            % Example:
+            %   ev = M5UnitSynth.noteEvents(0, [60 64 67 72], 0:0.25:0.75, 0.2, 100);
+            %   synth.streamEvents(ev);
+            
+            if nargin < 3
+                startDelay = 0.1;
+            end
+            
+            validateattributes(events, {'numeric'}, {'2d'}, 'streamEvents', 'events');
+            validateattributes(startDelay, {'numeric'}, {'scalar', '>=', 0}, 'streamEvents', 'startDelay');
+            
+            events = sortrows(events, 1);
+            sent = obj.queueEvents(events);
+            obj.startQueue(startDelay);
+            while sent < size(events, 1)
+                if obj.FreeEventSlots == 0
+                    pause(obj.STREAM_POLL_INTERVAL);
+                    obj.pollEventQueue();
+                    continue;
+                end
+                accepted = obj.queueEvents(events(sent + 1:end, :));
+                if accepted == 0
+                    % Free slots but nothing taken: the device rejected the event
+                    error('M5UnitSynth:QueueRejected', 'The device rejected event %d (status 0x%02X).', ...
+                        sent + 1, events(sent + 1, 2));
+                end
+                sent = sent + accepted;
+            end
+        end
+        
+        function startQueue(obj, startDelay)
+            % STARTQUEUE Start playing the device event queue
+            %
+            % Syntax:
+            %   startQueue(synth)
+            %   startQueue(synth, startDelay)
+            %
+            % Inputs:
+            %   startDelay - (Optional) Seconds until event time 0 (default = 0)
+            %
+            % Example:
+            %   synth.startQueue(0.05);
+            
+            if nargin < 2
+                startDelay = 0;
+            end
+            
+            validateattributes(startDelay, {'numeric'}, {'scalar', '>=', 0}, 'startQueue', 'startDelay');
+            
+            data = typecast(uint32(round(startDelay * 1000)), 'uint8');
+            sendCommand(obj, obj.LibraryName, obj.CMD_QUEUE_START, data);
+        end
+        
+        function stopQueue(obj)
+            % STOPQUEUE Stop queue playback and discard events not yet played
+            %
+            % Syntax:
+            %   stopQueue(synth)
+            %
+            % Notes the queue started are released, so stopping mid-phrase (for
+            % example after Ctrl-C in streamEvents) leaves no voice hanging.
+            %
+            % Example:
+            %   synth.stopQueue();
+            
+            data = uint8([]);
+            sendCommand(obj, obj.LibraryName, obj.CMD_QUEUE_STOP, data);
+        end
+        
+        function freeSlots = pollEventQueue(obj)
+            % POLLEVENTQUEUE Ask the device how many event queue slots are free
+            %
+            % Syntax:
+            %   freeSlots = pollEventQueue(synth)
+            %
+            % Every command already refreshes FreeEventSlots; this only needs
+            % to be called when no other command is being sent.
+            
+            sendCommand(obj, obj.LibraryName, obj.CMD_QUEUE_EVENTS, uint8(0));
+            freeSlots = obj.FreeEventSlots;
+        end
+        
+        function stats = getQueueStats(obj, resetAfterRead)
+            % GETQUEUESTATS Read event queue telemetry from the device
+            %
+            % Syntax:
+            %   stats = getQueueStats(synth)
+            %   stats = getQueueStats(synth, resetAfterRead)
+            %
+            % Inputs:
+            %   resetAfterRead - (Optional) true to clear the device counters
+            %                    after reading (default = false)
+            %
+            % Outputs:
+            %   stats - struct with fields:
+            %     HighWater       - Deepest queue depth seen (events)
+            %     Depth           - Current queue depth (events)
+            %     Emitted         - Events written to the synth
+            %     Underruns       - Events that arrived after their due time
+            %                       (host fed too slowly)
+            %     Overflows       - Events rejected because the queue was full
+            %     Drains          - Times the queue ran empty during playback
+            %     MaxLateness     - Worst emit lateness (s)
+            %     LatenessEdges   - Histogram bucket lower edges (s)
+            %     LatenessCounts  - Events per lateness bucket
+            %
+            % Example:
+            %   stats = synth.getQueueStats();
+            %   synth.plotQueueStats(stats);
+            
+            if nargin < 2
+                resetAfterRead = false;
+            end
+            
+            data = uint8(logical(resetAfterRead));
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_GET_QUEUE_STATS, data);
+            
+            counters = double(typecast(uint8(response(6:5 + 4 * (5 + obj.LATENESS_BUCKETS))), 'uint32'));
+            stats.HighWater = double(typecast(uint8(response(2:3)), 'uint16'));
+            stats.Depth = double(typecast(uint8(response(4:5)), 'uint16'));
+            stats.Emitted = counters(1);
+            stats.Underruns = counters(2);
+            stats.Overflows = counters(3);
+            stats.Drains = counters(4);
+            stats.MaxLateness = counters(5) * 1e-6;
+            stats.LatenessEdges = [0, 2.^(6:6 + obj.LATENESS_BUCKETS - 2)] * 1e-6;
+            stats.LatenessCounts = counters(6:end);
+        end
+        
+        function plotQueueStats(obj, stats)
+            % PLOTQUEUESTATS Plot the event lateness histogram and queue counters
+            %
+            % Syntax:
+            %   plotQueueStats(synth)
+            %   plotQueueStats(synth, stats)
+            %
+            % Inputs:
+            %   stats - (Optional) struct from getQueueStats; read from the
+            %           device when omitted
+            %
+            % Example:
+            %   synth.streamEvents(events);
+            %   synth.plotQueueStats();
+            
+            if nargin < 2
+                stats = obj.getQueueStats();
+            end
+            
+            labels = arrayfun(@(e) sprintf('%g', e * 1e3), stats.LatenessEdges, 'UniformOutput', false);
+            labels{end} = ['>=' labels{end}];
+            
+            figure('Name', 'M5UnitSynth event queue');
+            bar(stats.LatenessCounts);
+            set(gca, 'XTick', 1:numel(labels), 'XTickLabel', labels, 'YScale', 'log');
+            xlabel('Emit lateness bucket lower edge (ms)');
+            ylabel('Events');
+            title(sprintf(['Emitted %d, max late %.2f ms, high water %d/%d, ' ...
+                'underruns %d, overflows %d, drains %d'], stats.Emitted, stats.MaxLateness * 1e3, ...
+                stats.HighWater, obj.EVENT_QUEUE_SIZE, stats.Underruns, stats.Overflows, stats.Drains));
+            grid on;
+        end
+        
+        function startProfiling(obj)
+            % STARTPROFILING Start recording per-call timings
+            %
+            % Syntax:
+            %   startProfiling(synth)
+            %
+            % Every command sent from now on is logged with the time spent
+            % validating its arguments, packing the payload and in sendCommand
+            % (serial transfer plus waiting for the device's ack). Methods
+            % without byte-argument checks log only the send time. Any previous
+            % log is cleared. Profiling off costs one property test per call.
+            %
+            % Example:
+            %   synth.startProfiling();
+            %   for k = 1:200, synth.playNote(0, 60, 0.01); end
+            %   synth.stopProfiling();
+            %   synth.profileReport();
+            
+            obj.ProfileLog = zeros(1024, 5);
+            obj.ProfileCount = 0;
+            obj.ProfileCallStart = [];
+            obj.ProfileEpoch = tic;
+            obj.Profiling = true;
+        end
+        
+        function stopProfiling(obj)
+            % STOPPROFILING Stop recording per-call timings, keeping the log
+            %
+            % Syntax:
+            %   stopProfiling(synth)
+            
+            if obj.Profiling
+                obj.ProfileDuration = toc(obj.ProfileEpoch);
+            end
+            obj.Profiling = false;
+        end
+        
+        function log = getProfile(obj)
+            % GETPROFILE Return the profiling log as a timetable
+            %
+            % Syntax:
+            %   log = getProfile(synth)
+            %
+            % Outputs:
+            %   log - timetable with one row per command, Time since
+            %         startProfiling and variables Command (categorical),
+            %         Validation, Packing, Send and Total (seconds). Validation
+            %         and Packing are NaN for methods without argument checks.
+            %
+            % Example:
+            %   log = synth.getProfile();
+            %   plot(log.Time, log.Send * 1e3);
+            
+            rows = obj.ProfileLog(1:obj.ProfileCount, :);
+            total = sum(rows(:, 3:5), 2, 'omitnan');
+            log = timetable(seconds(rows(:, 1)), categorical(obj.commandNames(rows(:, 2))), ...
+                rows(:, 3), rows(:, 4), rows(:, 5), total, ...
+                'VariableNames', {'Command', 'Validation', 'Packing', 'Send', 'Total'});
+        end
+        
+        function summary = profileReport(obj)
+            % PROFILEREPORT Summarize the profiling log per command
+            %
+            % Syntax:
+            %   profileReport(synth)
+            %   summary = profileReport(synth)
+            %
+            % Outputs:
+            %   summary - table with one row per command: Calls, CallsPerSec,
+            %             and p50/p99 of the Total and Send times in ms, plus
+            %             the mean Validation and Packing times in us. Printed
+            %             when no output is requested.
+            
+            log = obj.getProfile();
+            duration = obj.ProfileDuration;
+            if obj.Profiling
+                duration = toc(obj.ProfileEpoch);
+            end
+            
+            commands = categories(log.Command);
+            n = numel(commands);
+            [calls, rate, totalP50, totalP99, sendP50, sendP99, validation, packing] = deal(zeros(n, 1));
+            for k = 1:n
+                rows = log(log.Command == commands{k}, :);
+                calls(k) = height(rows);
+                rate(k) = calls(k) / max(duration, eps);
+                totalP50(k) = obj.percentile(rows.Total, 50) * 1e3;
+                totalP99(k) = obj.percentile(rows.Total, 99) * 1e3;
+                sendP50(k) = obj.percentile(rows.Send, 50) * 1e3;
+                sendP99(k) = obj.percentile(rows.Send, 99) * 1e3;
+                validation(k) = mean(rows.Validation, 'omitnan') * 1e6;
+                packing(k) = mean(rows.Packing, 'omitnan') * 1e6;
+            end
+            result = table(calls, rate, totalP50, totalP99, sendP50, sendP99, validation, packing, ...
+                'RowNames', commands, 'VariableNames', {'Calls', 'CallsPerSec', 'TotalP50ms', ...
+                'TotalP99ms', 'SendP50ms', 'SendP99ms', 'ValidationUs', 'PackingUs'});
+            result = sortrows(result, 'Calls', 'descend');
+            
+            if nargout > 0
+                summary = result;
+            else
+                fprintf('M5UnitSynth profile: %d calls in %.2f s\n', height(log), duration);
+                disp(result);
+            end
+        end
+        
+        function stats = getStats(obj, resetAfterRead)
+            % GETSTATS Read the device's command statistics
+            %
+            % Syntax:
+            %   stats = getStats(synth)
+            %   stats = getStats(synth, resetAfterRead)
+            %
+            % Inputs:
+            %   resetAfterRead - (Optional) Clear the statistics after reading
+            %                    (default: false)
+            %
+            % Outputs:
+            %   stats - struct with fields:
+            %     MidiBytes      - MIDI bytes written to each unit [unit0 unit1]
+            %     TotalMidiBytes - Sum of MidiBytes
+            %     UnknownHigh    - Commands with opcodes beyond the device table
+            %     Commands       - table with one row per opcode seen: Opcode,
+            %                      Command, Accepted and the rejections by
+            %                      reason: ShortPayload, NotInitialized (no
+            %                      unit started for the target), Invalid
+            %                      (argument out of range or operation failed)
+            %                      and Unknown (opcode not in the firmware)
+            %
+            % Example:
+            %   stats = synth.getStats();
+            %   disp(stats.Commands(stats.Commands.Accepted < sum(stats.Commands{:, 3:end}, 2), :));
+            
+            if nargin < 2
+                resetAfterRead = false;
+            end
+            validateattributes(resetAfterRead, {'logical', 'numeric'}, {'scalar'}, 'getStats', 'resetAfterRead');
+            
+            rows = zeros(0, 6);
+            next = 0;
+            while next ~= obj.STATS_DONE
+                response = sendCommand(obj, obj.LibraryName, obj.CMD_GET_STATS, uint8([next, logical(resetAfterRead)]));
+                next = double(response(2));
+                header = double(typecast(uint8(response(3:14)), 'uint32'));
+                for k = 1:double(response(15))
+                    entry = uint8(response(16 + (k - 1) * obj.STATS_ENTRY_BYTES:15 + k * obj.STATS_ENTRY_BYTES));
+                    rows(end + 1, :) = [double(entry(1)), double(typecast(entry(2:end), 'uint32'))]; %#ok<AGROW>
+                end
+            end
+            
+            stats.MidiBytes = header(1:2);
+            stats.TotalMidiBytes = sum(header(1:2));
+            stats.UnknownHigh = header(3);
+            stats.Commands = array2table(rows, 'VariableNames', ...
+                {'Opcode', 'Accepted', 'ShortPayload', 'NotInitialized', 'Invalid', 'Unknown'});
+            stats.Commands = addvars(stats.Commands, categorical(obj.commandNames(rows(:, 1))), ...
+                'After', 'Opcode', 'NewVariableNames', 'Command');
+        end
+        
+        function profile = getDeviceProfile(obj, resetAfterRead)
+            % GETDEVICEPROFILE Read the device's per-opcode cycle counters
+            %
+            % Syntax:
+            %   profile = getDeviceProfile(synth)
+            %   profile = getDeviceProfile(synth, resetAfterRead)
+            %
+            % Requires firmware built with M5UNITML_PROFILE set to 1 in
+            % M5UnitML.h (rebuild with 'ForceBuildOn', true after changing it).
+            %
+            % Inputs:
+            %   resetAfterRead - (Optional) Clear the counters after reading
+            %                    (default: false)
+            %
+            % Outputs:
+            %   profile - table with one row per opcode seen: Opcode, Command
+            %             ('LOOP' for loop() passes that wrote MIDI), Calls,
+            %             min/mean/max dispatch time, and the count and
+            %             min/mean/max of the UART writes within it, in us
+            %
+            % Example:
+            %   profile = synth.getDeviceProfile(true);
+            %   disp(sortrows(profile, 'DispatchMeanUs', 'descend'));
+            
+            if nargin < 2
+                resetAfterRead = false;
+            end
+            validateattributes(resetAfterRead, {'logical', 'numeric'}, {'scalar'}, 'getDeviceProfile', 'resetAfterRead');
+            
+            rows = zeros(0, 9);
+            next = 0;
+            while next ~= obj.PROFILE_DONE
+                response = sendCommand(obj, obj.LibraryName, obj.CMD_GET_PROFILE, uint8([next, logical(resetAfterRead)]));
+                if numel(response) < 5
+                    error('M5UnitSynth:ProfileDisabled', ...
+                        'The device was built without cycle profiling; set M5UNITML_PROFILE to 1 in M5UnitML.h.');
+                end
+                next = double(response(1));
+                cyclesPerUs = double(typecast(uint8(response(2:3)), 'uint16'));
+                for k = 1:double(response(4))
+                    entry = uint8(response(5 + (k - 1) * obj.PROFILE_ENTRY_BYTES:4 + k * obj.PROFILE_ENTRY_BYTES));
+                    counters = double(typecast(entry(2:end), 'uint32'));
+                    rows(end + 1, :) = [double(entry(1)), counters(1), counters(2:4) / cyclesPerUs, ...
+                        counters(5), counters(6:8) / cyclesPerUs]; %#ok<AGROW>
+                end
+            end
+            
+            names = obj.commandNames(rows(:, 1));
+            names(rows(:, 1) == 0) = {'LOOP'};
+            profile = array2table(rows, 'VariableNames', {'Opcode', 'Calls', 'DispatchMinUs', ...
+                'DispatchMeanUs', 'DispatchMaxUs', 'UartCalls', 'UartMinUs', 'UartMeanUs', 'UartMaxUs'});
+            profile = addvars(profile, categorical(names(:)), 'After', 'Opcode', 'NewVariableNames', 'Command');
+        end
+        
+        function trace = getTrace(obj, clearAfterRead)
+            % GETTRACE Read the device's timeline trace ring
+            %
+            % Syntax:
+            %   trace = getTrace(synth)
+            %   trace = getTrace(synth, clearAfterRead)
+            %
+            % The device keeps the last TRACE_SIZE timeline entries: commands
+            % received and completed, events queued and emitted, MIDI bytes
+            % written to each unit, queue overflows and drains. Reading the
+            % trace is itself not traced.
+            %
+            % Inputs:
+            %   clearAfterRead - (Optional) Empty the ring after reading; entries
+            %                    recorded during the read are dropped too
+            %                    (default: false)
+            %
+            % Outputs:
+            %   trace - table with one row per entry: Sequence, TimeUs (device
+            %           micros(), unwrapped), Type, Command (for Command and
+            %           CommandDone rows), Arg0 and Arg1. Arg0/Arg1 hold
+            %           opcode/payload size (Command), opcode/status
+            %           (CommandDone), status/queue depth (EventQueued),
+            %           status/lateness in us (EventEmitted), unit/bytes
+            %           (MidiWrite), -/queue depth (QueueOverflow) and
+            %           status/(data1 * 256 + data2) (MidiInput)
+            %
+            % Example:
+            %   trace = synth.getTrace(true);
+            %   writeChromeTrace(trace, 'synth.json');   % open in ui.perfetto.dev
+            
+            if nargin < 2
+                clearAfterRead = false;
+            end
+            validateattributes(clearAfterRead, {'logical', 'numeric'}, {'scalar'}, 'getTrace', 'clearAfterRead');
+            
+            rows = zeros(0, 5);
+            next = 0;
+            recorded = Inf;
+            while next < recorded
+                response = sendCommand(obj, obj.LibraryName, obj.CMD_GET_TRACE, [typecast(uint32(next), 'uint8'), uint8(0)]);
+                header = double(typecast(uint8(response(2:9)), 'uint32'));
+                % Stop at the length seen on the first read so a busy device cannot keep us chasing
+                recorded = min(recorded, header(1));
+                count = double(response(10));
+                if header(2) > next
+                    warning('M5UnitSynth:TraceOverrun', '%d trace entries were overwritten before they were read.', ...
+                        header(2) - next);
+                end
+                for k = 1:count
+                    entry = uint8(response(11 + (k - 1) * obj.TRACE_ENTRY_BYTES:10 + k * obj.TRACE_ENTRY_BYTES));
+                    rows(end + 1, :) = [header(2) + k - 1, double(typecast(entry(1:4), 'uint32')), ...
+                        double(entry(5)), double(entry(6)), double(typecast(entry(7:8), 'uint16'))]; %#ok<AGROW>
+                end
+                next = header(2) + count;
+                if count == 0
+                    break;
+                end
+            end
+            if clearAfterRead
+                sendCommand(obj, obj.LibraryName, obj.CMD_GET_TRACE, [typecast(uint32(next), 'uint8'), uint8(1)]);
+            end
+            
+            rows = rows(rows(:, 1) < recorded, :);
+            if ~isempty(rows)
+                % micros() wraps every 2^32 us (about 71 minutes)
+                rows(:, 2) = rows(:, 2) + 2^32 * cumsum([0; diff(rows(:, 2)) < 0]);
+            end
+            isCommand = rows(:, 3) <= 2;
+            commands = repmat({''}, size(rows, 1), 1);
+            commands(isCommand) = obj.commandNames(rows(isCommand, 4));
+            trace = table(rows(:, 1), rows(:, 2), categorical(obj.TRACE_NAMES(rows(:, 3))', obj.TRACE_NAMES), ...
+                categorical(commands), rows(:, 4), rows(:, 5), ...
+                'VariableNames', {'Sequence', 'TimeUs', 'Type', 'Command', 'Arg0', 'Arg1'});
+        end
+        
+        function memory = getMemory(obj)
+            % GETMEMORY Read the device's heap and stack high-water marks
+            %
+            % Syntax:
+            %   memory = getMemory(synth)
+            %
+            % Outputs:
+            %   memory - struct with fields (bytes):
+            %     FreeHeap         - Heap free now
+            %     MinFreeHeap      - Lowest free heap since boot
+            %     LargestFreeBlock - Largest single allocation possible now
+            %     StackHighWater   - Unused loop task stack at its deepest
+            %
+            % Example:
+            %   memory = synth.getMemory();
+            
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_GET_MEMORY, uint8([]));
+            values = double(typecast(uint8(response(2:17)), 'uint32'));
+            memory.FreeHeap = values(1);
+            memory.MinFreeHeap = values(2);
+            memory.LargestFreeBlock = values(3);
+            memory.StackHighWater = values(4);
+        end
+        
+        function report = soakTest(obj, duration, varargin)
+            % SOAKTEST Drive sustained random note and expression traffic and report
+            %
+            % Syntax:
+            %   report = soakTest(synth, duration)
+            %   report = soakTest(synth, duration, 'NoteRate', 40, 'CCRate', 20, 'Mode', 'direct')
+            %
+            % Inputs:
+            %   duration - Seconds of generated traffic
+            %   Name-value options:
+            %     'NoteRate'   - Note-ons per second over all channels (default 20)
+            %     'CCRate'     - Expression changes per second (default 10)
+            %     'NoteLength' - Note duration in seconds (default 0.1)
+            %     'Channels'   - Logical channels to use (default 0:NumChannels-1)
+            %     'Mode'       - 'queue' streams events through the device queue
+            %                    (lateness measured on the device), 'direct' sends
+            %                    one command per message when due (lateness
+            %                    measured at the host) (default 'queue')
+            %     'Seed'       - Random seed for the traffic (default 1)
+            %
+            % Device statistics and queue telemetry are reset at the start.
+            % Utilities/HostSim/M5UnitMLSoak.cpp runs the same load against
+            % the host build.
+            %
+            % Outputs:
+            %   report - struct with fields:
+            %     Mode, Elapsed (s), Messages, MessagesPerSecond,
+            %     Commands and CommandsPerSecond (accepted by the device),
+            %     MidiBytes per unit, LinkLoad (fraction of each unit's
+            %     31250 baud budget), Rejected (commands), Overflows,
+            %     Underruns, LatenessP50/P90/P99 and MaxLateness (s; queue
+            %     mode percentiles are histogram bucket upper edges),
+            %     QueueHighWater, Memory (getMemory after the run) and
+            %     HeapUsed (drop of the lowest free heap during the run)
+            %
+            % Example:
+            %   report = synth.soakTest(3600, 'NoteRate', 30);
+            
+            p = inputParser;
+            addRequired(p, 'duration', @(x) isnumeric(x) && isscalar(x) && x > 0);
+            addParameter(p, 'NoteRate', 20, @(x) isnumeric(x) && isscalar(x) && x >= 0);
+            addParameter(p, 'CCRate', 10, @(x) isnumeric(x) && isscalar(x) && x >= 0);
+            addParameter(p, 'NoteLength', 0.1, @(x) isnumeric(x) && isscalar(x) && x > 0);
+            addParameter(p, 'Channels', 0:obj.NumChannels - 1, @(x) isnumeric(x) && all(x >= 0 & x < obj.NumChannels));
+            addParameter(p, 'Mode', 'queue', @(x) any(strcmpi(x, {'queue', 'direct'})));
+            addParameter(p, 'Seed', 1, @(x) isnumeric(x) && isscalar(x));
+            parse(p, duration, varargin{:});
+            opts = p.Results;
+            
+            % Poisson note and expression traffic as [time status data1 data2 bank]
+            stream = RandStream('mt19937ar', 'Seed', opts.Seed);
+            noteTimes = cumsum(-log(rand(stream, ceil(2 * duration * opts.NoteRate) + 10, 1)) / max(opts.NoteRate, eps));
+            noteTimes = noteTimes(noteTimes < duration);
+            ccTimes = cumsum(-log(rand(stream, ceil(2 * duration * opts.CCRate) + 10, 1)) / max(opts.CCRate, eps));
+            ccTimes = ccTimes(ccTimes < duration);
+            noteChannels = opts.Channels(randi(stream, numel(opts.Channels), numel(noteTimes), 1));
+            ccChannels = opts.Channels(randi(stream, numel(opts.Channels), numel(ccTimes), 1));
+            events = obj.noteEvents(noteChannels, randi(stream, [36 95], numel(noteTimes), 1), ...
+                noteTimes, opts.NoteLength, randi(stream, [40 127], numel(noteTimes), 1));
+            ccEvents = [ccTimes, 0xB0 + mod(ccChannels(:), 16), repmat(11, numel(ccTimes), 1), ...
+                randi(stream, [0 127], numel(ccTimes), 1), floor(ccChannels(:) / 16)];
+            events = sortrows([events; ccEvents], 1);
+            
+            memoryBefore = obj.getMemory();
+            obj.getStats(true);
+            obj.getQueueStats(true);
+            
+            started = tic;
+            if strcmpi(opts.Mode, 'queue')
+                obj.streamEvents(events);
+                % streamEvents returns after the last upload; wait for playback to end
+                pause(max(0, events(end, 1) + 0.1 - toc(started)) + 0.2);
+                lateness = [];
+            else
+                lateness = zeros(size(events, 1), 1);
+                for k = 1:size(events, 1)
+                    while toc(started) < events(k, 1)
+                        if events(k, 1) - toc(started) > 0.002
+                            pause(0.001);
+                        end
+                    end
+                    lateness(k) = toc(started) - events(k, 1);
+                    channel = 16 * events(k, 5) + mod(events(k, 2), 16);
+                    switch bitand(events(k, 2), 0xF0)
+                        case 0x90
+                            obj.setNoteOn(channel, events(k, 3), events(k, 4));
+                        case 0x80
+                            obj.setNoteOff(channel, events(k, 3), 0);
+                        otherwise
+                            obj.setExpression(channel, events(k, 4));
+                    end
+                end
+            end
+            elapsed = toc(started);
+            
+            queue = obj.getQueueStats();
+            stats = obj.getStats();
+            memory = obj.getMemory();
+            
+            commands = stats.Commands(~ismember(stats.Commands.Opcode, ...
+                [obj.CMD_GET_STATS, obj.CMD_GET_QUEUE_STATS, obj.CMD_GET_MEMORY]), :);
+            report.Mode = lower(opts.Mode);
+            report.Elapsed = elapsed;
+            report.Messages = size(events, 1);
+            report.MessagesPerSecond = size(events, 1) / elapsed;
+            report.Commands = sum(commands.Accepted);
+            report.CommandsPerSecond = report.Commands / elapsed;
+            report.MidiBytes = stats.MidiBytes;
+            report.LinkLoad = stats.MidiBytes * obj.MIDI_BYTE_TIME / elapsed;
+            report.Rejected = sum(sum(commands{:, {'ShortPayload', 'NotInitialized', 'Invalid', 'Unknown'}}));
+            report.Overflows = queue.Overflows;
+            report.Underruns = queue.Underruns;
+            if isempty(lateness)
+                % Upper edge of the histogram bucket holding each percentile
+                edges = [queue.LatenessEdges(2:end), queue.MaxLateness];
+                cumulative = cumsum(queue.LatenessCounts) / max(1, sum(queue.LatenessCounts));
+                bucket = @(q) edges(find(cumulative >= q, 1));
+                report.LatenessP50 = bucket(0.5);
+                report.LatenessP90 = bucket(0.9);
+                report.LatenessP99 = bucket(0.99);
+                report.MaxLateness = queue.MaxLateness;
+            else
+                report.LatenessP50 = obj.percentile(lateness, 50);
+                report.LatenessP90 = obj.percentile(lateness, 90);
+                report.LatenessP99 = obj.percentile(lateness, 99);
+                report.MaxLateness = max(lateness);
+            end
+            report.QueueHighWater = queue.HighWater;
+            report.Memory = memory;
+            report.HeapUsed = memoryBefore.MinFreeHeap - memory.MinFreeHeap;
+        end
+        
+        function setPowerMode(obj, mode, maxWakeLatency, idleTime)
+            % SETPOWERMODE Let the device save power between scheduled events
+            %
+            % Syntax:
+            %   setPowerMode(synth, mode)
+            %   setPowerMode(synth, mode, maxWakeLatency, idleTime)
+            %
+            % Inputs:
+            %   mode           - 'off'   : always full speed (default at startup)
+            %                    'scale' : drop the CPU from 240 to 80 MHz while idle
+            %                    'sleep' : also light sleep during waitQuiet, until
+            %                              shortly before the next queued event,
+            %                              while the clock is stopped
+            %   maxWakeLatency - (Optional) Longest single sleep in seconds, and how
+            %                    far ahead a queued event keeps full speed
+            %                    (default 0.1, up to 65.535)
+            %   idleTime       - (Optional) Seconds without commands before the
+            %                    device powers down (default 1, up to 65.535)
+            %
+            % Light sleep gates the link UART, so the device only sleeps inside
+            % a window declared with waitQuiet, and wakes on its own timer; no
+            % command is ever lost to a wake-up. Queue playback and the MIDI
+            % output are not affected by either mode.
+            %
+            % Example:
+            %   synth.setPowerMode('sleep', 0.05, 2);
+            %   synth.queueEvents(events);
+            %   synth.startQueue();
+            %   synth.waitQuiet(events(end, 1) + 0.5);
+            %   stats = synth.getPowerStats();
+            
+            if nargin < 3
+                maxWakeLatency = 0.1;
+            end
+            if nargin < 4
+                idleTime = 1;
+            end
+            mode = validatestring(mode, obj.POWER_MODES, 'setPowerMode', 'mode');
+            validateattributes(maxWakeLatency, {'numeric'}, {'scalar', '>=', 0, '<=', 65.535}, 'setPowerMode', 'maxWakeLatency');
+            validateattributes(idleTime, {'numeric'}, {'scalar', '>=', 0, '<=', 65.535}, 'setPowerMode', 'idleTime');
+            
+            data = [uint8(find(strcmp(obj.POWER_MODES, mode)) - 1), ...
+                typecast(uint16(round(maxWakeLatency * 1000)), 'uint8'), ...
+                typecast(uint16(round(idleTime * 1000)), 'uint8')];
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_SET_POWER, data);
+            if response(1) ~= 1
+                error('M5UnitSynth:PowerModeFailed', 'The device rejected power mode ''%s''.', mode);
+            end
+            obj.PowerMode = mode;
+        end
+        
+        function stats = getPowerStats(obj, resetAfterRead)
+            % GETPOWERSTATS Read the time the device spent awake and asleep
+            %
+            % Syntax:
+            %   stats = getPowerStats(synth)
+            %   stats = getPowerStats(synth, resetAfterRead)
+            %
+            % Inputs:
+            %   resetAfterRead - (Optional) Clear the counters after reading
+            %                    (default: false)
+            %
+            % Outputs:
+            %   stats - struct with fields:
+            %     Mode          - Power mode set on the device
+            %     FullClockTime - Seconds at full CPU clock
+            %     IdleClockTime - Seconds at the idle clock
+            %     AsleepTime    - Seconds in light sleep
+            %     AsleepFraction - AsleepTime over the total
+            %     Sleeps        - Light sleeps entered
+            %     QuietWindows  - Windows declared with waitQuiet
+            %
+            % Example:
+            %   stats = synth.getPowerStats(true);
+            %   fprintf('Asleep %.0f%% of the time\n', 100 * stats.AsleepFraction);
+            
+            if nargin < 2
+                resetAfterRead = false;
+            end
+            validateattributes(resetAfterRead, {'logical', 'numeric'}, {'scalar'}, 'getPowerStats', 'resetAfterRead');
+            
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_GET_POWER_STATS, uint8(logical(resetAfterRead)));
+            counters = double(typecast(uint8(response(4:23)), 'uint32'));
+            stats.Mode = obj.POWER_MODES{double(response(2)) + 1};
+            stats.FullClockTime = counters(1) / 1000;
+            stats.IdleClockTime = counters(2) / 1000;
+            stats.AsleepTime = counters(3) / 1000;
+            stats.AsleepFraction = stats.AsleepTime / max(eps, sum(counters(1:3)) / 1000);
+            stats.Sleeps = counters(4);
+            stats.QuietWindows = counters(5);
+        end
+        
+        function waitQuiet(obj, duration)
+            % WAITQUIET Wait while promising the device no commands, so it may sleep
+            %
+            % Syntax:
+            %   waitQuiet(synth, duration)
+            %
+            % Inputs:
+            %   duration - Seconds to wait (up to 600)
+            %
+            % Use in place of pause while queued events play. In 'sleep' power
+            % mode the device light-sleeps within the window; in the other modes
+            % it drops to the idle clock at once instead of after idleTime.
+            % Commands sent from callbacks during the window wait for its end.
+            %
+            % Example:
+            %   synth.startQueue();
+            %   synth.waitQuiet(30);
+            
+            validateattributes(duration, {'numeric'}, {'scalar', '>=', 0, '<=', obj.MAX_QUIET_TIME}, 'waitQuiet', 'duration');
+            
+            sendCommand(obj, obj.LibraryName, obj.CMD_SET_QUIET, typecast(uint32(round(duration * 1000)), 'uint8'));
+            obj.QuietStart = tic;
+            obj.QuietTime = duration;
+            pause(duration);
+            obj.QuietTime = 0;
+        end
+        
+        function setNoteTimeout(obj, channels, timeout)
+            % SETNOTETIMEOUT Release notes that sound longer than a limit
+            %
+            % Syntax:
+            %   setNoteTimeout(synth, channels, timeout)
+            %
+            % Inputs:
+            %   channels - Logical channels, a contiguous range such as 0:15
+            %   timeout  - Longest a note may sound in seconds (0 = no limit,
+            %              the default). The device sends the note off itself,
+            %              so notes left on by an interrupted script stop freeing
+            %              up SAM2695 voices.
+            %
+            % Example:
+            %   synth.setNoteTimeout(0:15, 10);   % No note longer than 10 s
+            %   synth.setNoteTimeout(9, 0);       % except on the drum channel
+            
+            validateattributes(channels, {'numeric'}, {'vector', 'integer', '>=', 0, '<=', obj.NumChannels - 1}, 'setNoteTimeout', 'channels');
+            validateattributes(timeout, {'numeric'}, {'scalar', '>=', 0, '<', 2^32 / 1000}, 'setNoteTimeout', 'timeout');
+            if any(diff(channels) ~= 1)
+                error('M5UnitSynth:BadChannels', 'channels must be a contiguous ascending range.');
+            end
+            
+            data = [uint8([channels(1), numel(channels)]), typecast(uint32(round(timeout * 1000)), 'uint8')];
+            sendCommand(obj, obj.LibraryName, obj.CMD_SET_NOTE_TIMEOUT, data);
+        end
+        
+        function setLinkTimeout(obj, timeout)
+            % SETLINKTIMEOUT Release every note when MATLAB goes silent
+            %
+            % Syntax:
+            %   setLinkTimeout(synth, timeout)
+            %
+            % Inputs:
+            %   timeout - Seconds without any command after which the device
+            %             sends All Notes Off on every channel (0 = off, the
+            %             default; at most 3600). Playback of queued events
+            %             counts as activity, so a long streamed phrase is not
+            %             cut; pick a timeout longer than the longest pause your
+            %             script makes with notes held (e.g. in playNote).
+            %
+            % Example:
+            %   synth.setLinkTimeout(5);
+            
+            validateattributes(timeout, {'numeric'}, {'scalar', '>=', 0, '<=', 3600}, 'setLinkTimeout', 'timeout');
+            
+            data = typecast(uint32(round(timeout * 1000)), 'uint8');
+            sendCommand(obj, obj.LibraryName, obj.CMD_SET_LINK_TIMEOUT, data);
+        end
+        
+        function stats = getReaperStats(obj, resetAfterRead)
+            % GETREAPERSTATS Read the stuck-voice reaper counters
+            %
+            % Syntax:
+            %   stats = getReaperStats(synth)
+            %   stats = getReaperStats(synth, resetAfterRead)
+            %
+            % Outputs:
+            %   stats - struct with fields:
+            %     TrackedNotes  - Notes sounding now with a known start time
+            %     UntrackedNotes - Note-ons not aged because the table was full
+            %     ReapedNotes   - Notes released by setNoteTimeout
+            %     LinkReleases  - Full releases after setLinkTimeout silence
+            
+            if nargin < 2
+                resetAfterRead = false;
+            end
+            validateattributes(resetAfterRead, {'logical', 'numeric'}, {'scalar'}, 'getReaperStats', 'resetAfterRead');
+            
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_GET_REAPER_STATS, uint8(logical(resetAfterRead)));
+            counters = double(typecast(uint8(response(3:14)), 'uint32'));
+            stats.TrackedNotes = double(response(2));
+            stats.UntrackedNotes = counters(1);
+            stats.ReapedNotes = counters(2);
+            stats.LinkReleases = counters(3);
+        end
+        
+        function startJournal(obj, clearFirst)
+            % STARTJOURNAL Record every command the device receives
+            %
+            % Syntax:
+            %   startJournal(synth)
+            %   startJournal(synth, clearFirst)
+            %
+            % The device keeps the last JOURNAL_SIZE commands with their receive
+            % time in microseconds, so a timing glitch can be replayed exactly
+            % with replayJournal or, after saveJournal, in the host simulation.
+            % The journal commands themselves are not recorded.
+            %
+            % Inputs:
+            %   clearFirst - (Optional) Empty the journal first (default: true)
+            %
+            % Example:
+            %   synth.startJournal();
+            %   ... % reproduce the glitch
+            %   synth.stopJournal();
+            %   synth.saveJournal('glitch.journal');
+            
+            if nargin < 2
+                clearFirst = true;
+            end
+            validateattributes(clearFirst, {'logical', 'numeric'}, {'scalar'}, 'startJournal', 'clearFirst');
+            
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_SET_JOURNAL, uint8([1, logical(clearFirst)]));
+            if response(1) == 0
+                error('M5UnitSynth:JournalBusy', 'The device is replaying its journal; call stopReplay first.');
+            end
+        end
+        
+        function stopJournal(obj)
+            % STOPJOURNAL Stop recording commands, keeping the journal
+            %
+            % Syntax:
+            %   stopJournal(synth)
+            
+            sendCommand(obj, obj.LibraryName, obj.CMD_SET_JOURNAL, uint8(0));
+        end
+        
+        function journal = getJournal(obj, clearAfterRead)
+            % GETJOURNAL Read the device's command journal
+            %
+            % Syntax:
+            %   journal = getJournal(synth)
+            %   journal = getJournal(synth, clearAfterRead)
+            %
+            % Inputs:
+            %   clearAfterRead - (Optional) Empty the journal after reading
+            %                    (default: false)
+            %
+            % Outputs:
+            %   journal - table with one row per received command: Sequence,
+            %             TimeUs (device micros() at receipt, unwrapped),
+            %             Command, Opcode, Payload (uint8 row) and Truncated
+            %             (payload longer than JOURNAL_PAYLOAD bytes; such
+            %             commands are skipped on replay)
+            
+            if nargin < 2
+                clearAfterRead = false;
+            end
+            validateattributes(clearAfterRead, {'logical', 'numeric'}, {'scalar'}, 'getJournal', 'clearAfterRead');
+            
+            rows = zeros(0, 4);
+            payloads = cell(0, 1);
+            next = 0;
+            recorded = Inf;
+            while next < recorded
+                response = uint8(sendCommand(obj, obj.LibraryName, obj.CMD_GET_JOURNAL, [typecast(uint32(next), 'uint8'), uint8(0)]));
+                header = double(typecast(response(3:10), 'uint32'));
+                % Stop at the length seen on the first read so a recording device cannot keep us chasing
+                recorded = min(recorded, header(1));
+                count = double(response(11));
+                if header(2) > next
+                    warning('M5UnitSynth:JournalOverrun', '%d journal entries were overwritten before they were read.', ...
+                        header(2) - next);
+                end
+                offset = 12;
+                for k = 1:count
+                    sizeBytes = double(response(offset + 5));
+                    kept = min(sizeBytes, obj.JOURNAL_PAYLOAD);
+                    rows(end + 1, :) = [header(2) + k - 1, double(typecast(response(offset:offset + 3), 'uint32')), ...
+                        double(response(offset + 4)), sizeBytes > kept]; %#ok<AGROW>
+                    payloads{end + 1, 1} = response(offset + 6:offset + 5 + kept); %#ok<AGROW>
+                    offset = offset + 6 + kept;
+                end
+                next = header(2) + count;
+                if count == 0
+                    break;
+                end
+            end
+            if clearAfterRead
+                sendCommand(obj, obj.LibraryName, obj.CMD_GET_JOURNAL, [typecast(uint32(next), 'uint8'), uint8(1)]);
+            end
+            
+            keep = rows(:, 1) < recorded;
+            rows = rows(keep, :);
+            payloads = payloads(keep);
+            if ~isempty(rows)
+                % micros() wraps every 2^32 us (about 71 minutes)
+                rows(:, 2) = rows(:, 2) + 2^32 * cumsum([0; diff(rows(:, 2)) < 0]);
+            end
+            journal = table(rows(:, 1), rows(:, 2), categorical(obj.commandNames(rows(:, 3))), rows(:, 3), ...
+                payloads, logical(rows(:, 4)), ...
+                'VariableNames', {'Sequence', 'TimeUs', 'Command', 'Opcode', 'Payload', 'Truncated'});
+        end
+        
+        function saveJournal(obj, filename, journal)
+            % SAVEJOURNAL Write the command journal for the host simulation
+            %
+            % Syntax:
+            %   saveJournal(synth, filename)
+            %   saveJournal(synth, filename, journal)
+            %
+            % Writes one line per command (receive time in us from the first
+            % command, opcode, payload bytes), the input of
+            % Utilities/HostSim/M5UnitMLReplay.cpp.
+            %
+            % Inputs:
+            %   filename - Output file
+            %   journal  - (Optional) Table from getJournal (default: read it now)
+            
+            if nargin < 3
+                journal = getJournal(obj);
+            end
+            validateattributes(filename, {'char', 'string'}, {'scalartext'}, 'saveJournal', 'filename');
+            if any(journal.Truncated)
+                warning('M5UnitSynth:JournalTruncated', '%d truncated commands are left out.', nnz(journal.Truncated));
+                journal = journal(~journal.Truncated, :);
+            end
+            
+            fid = fopen(filename, 'w');
+            if fid < 0
+                error('M5UnitSynth:OpenFailed', 'Cannot open %s for writing.', filename);
+            end
+            cleanup = onCleanup(@() fclose(fid));
+            fprintf(fid, '# m5unitml journal v1: receive time in us, opcode, payload bytes\n');
+            for k = 1:height(journal)
+                fprintf(fid, '%d %d%s\n', journal.TimeUs(k) - journal.TimeUs(1), journal.Opcode(k), ...
+                    sprintf(' %d', journal.Payload{k}));
+            end
+        end
+        
+        function count = replayJournal(obj)
+            % REPLAYJOURNAL Replay the journal on the device with its original timing
+            %
+            % Syntax:
+            %   count = replayJournal(synth)
+            %
+            % The device feeds every recorded command back to its command handler
+            % with the spacing it was received with, starting now, and drops the
+            % replies. Recording stops. Other methods can still be called while
+            % the replay runs.
+            %
+            % Outputs:
+            %   count - Number of commands that will be replayed
+            
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_REPLAY_JOURNAL, uint8(1));
+            if response(1) == 0
+                error('M5UnitSynth:JournalEmpty', 'The device journal is empty.');
+            end
+            count = double(typecast(uint8(response(2:5)), 'uint32'));
+        end
+        
+        function remaining = stopReplay(obj)
+            % STOPREPLAY Stop a journal replay
+            %
+            % Syntax:
+            %   remaining = stopReplay(synth)
+            %
+            % Outputs:
+            %   remaining - Commands that were not replayed
+            
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_REPLAY_JOURNAL, uint8(0));
+            remaining = double(typecast(uint8(response(2:5)), 'uint32'));
+        end
+        
+        function setMidiInput(obj, enable, varargin)
+            % SETMIDIINPUT Play a MIDI keyboard wired to the device
+            %
+            % Syntax:
+            %   setMidiInput(synth, enable)
+            %   setMidiInput(synth, enable, Name, Value, ...)
+            %
+            % The Unit-Synth never transmits, so the RX pin of a unit's UART is
+            % free for a MIDI input (through the usual opto-isolator). The device
+            % parses it (running status, real-time bytes anywhere; system
+            % exclusive is skipped) and plays each message as it arrives, with
+            % routing, balancing and voice tracking as for queued events, without
+            % a round trip through MATLAB. While the input is on, the device does
+            % not light-sleep and setLinkTimeout does not release notes.
+            %
+            % Inputs:
+            %   enable - true to start, false to stop
+            %
+            % Name-Value Arguments:
+            %   'Unit'    - Unit whose UART receives (default: 0)
+            %   'RXPin'   - RX pin, only used when that unit has not been
+            %               started; a started unit receives on its RXPin
+            %   'Mirror'  - Keep a copy of every message for readMidiInput
+            %               (default: false)
+            %   'Channel' - Logical channel to play everything on (default: []:
+            %               input channel n plays on logical channel n)
+            %
+            % Example:
+            %   synth.setMidiInput(true, 'Mirror', true, 'Channel', 20);
+            %   pause(10);
+            %   take = synth.readMidiInput();
+            
+            p = inputParser;
+            addParameter(p, 'Unit', 0, @(x) isnumeric(x) && isscalar(x) && any(x == 0:obj.MAX_UNITS - 1));
+            addParameter(p, 'RXPin', [], @(x) isempty(x) || (isnumeric(x) && isscalar(x) && x >= 0 && x <= 39));
+            addParameter(p, 'Mirror', false, @(x) (islogical(x) || isnumeric(x)) && isscalar(x));
+            addParameter(p, 'Channel', [], @(x) isempty(x) || (isnumeric(x) && isscalar(x) && any(x == 0:obj.NumChannels - 1)));
+            parse(p, varargin{:});
+            validateattributes(enable, {'logical', 'numeric'}, {'scalar'}, 'setMidiInput', 'enable');
+            
+            if ~enable
+                sendCommand(obj, obj.LibraryName, obj.CMD_SET_MIDI_INPUT, uint8(0));
+                return;
+            end
+            rxPin = p.Results.RXPin;
+            if isempty(rxPin)
+                rxPin = 0;
+            end
+            channel = p.Results.Channel;
+            if isempty(channel)
+                channel = obj.MIDI_IN_KEEP_CHANNEL;
+            end
+            data = uint8([1, p.Results.Unit, rxPin, logical(p.Results.Mirror), channel]);
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_SET_MIDI_INPUT, data);
+            if response(1) == 0
+                error('M5UnitSynth:MidiInputFailed', 'Unit %d has not been started; give its RXPin.', p.Results.Unit);
+            end
+        end
+        
+        function [events, info] = readMidiInput(obj)
+            % READMIDIINPUT Take the MIDI input messages mirrored since the last read
+            %
+            % Syntax:
+            %   events = readMidiInput(synth)
+            %   [events, info] = readMidiInput(synth)
+            %
+            % Outputs:
+            %   events - N-by-5 matrix in the queueEvents layout: [time (s, device
+            %            clock), status, data1, data2, bank], status carrying the
+            %            logical channel the message played on
+            %   info   - struct with fields Received (messages since the input
+            %            was enabled), Skipped (real-time, system and stray bytes)
+            %            and Dropped (copies lost because the buffer was full)
+            %
+            % Example:
+            %   take = synth.readMidiInput();
+            %   take(:, 1) = take(:, 1) - take(1, 1);
+            %   synth.streamEvents(take);      % play the take back
+            
+            events = zeros(0, 5);
+            remaining = 1;
+            while remaining > 0
+                response = uint8(sendCommand(obj, obj.LibraryName, obj.CMD_GET_MIDI_INPUT, uint8([])));
+                counters = double(typecast(response(2:13), 'uint32'));
+                remaining = double(response(14));
+                count = double(response(15));
+                for k = 1:count
+                    entry = response(16 + (k - 1) * obj.EVENT_BYTES:15 + k * obj.EVENT_BYTES);
+                    channel = double(entry(8));
+                    events(end + 1, :) = [double(typecast(entry(1:4), 'uint32')) / 1000, ...
+                        bitand(double(entry(5)), 0xF0) + mod(channel, 16), double(entry(6)), double(entry(7)), ...
+                        floor(channel / 16)]; %#ok<AGROW>
+                end
+                if count == 0
+                    break;
+                end
+            end
+            info.Received = counters(1);
+            info.Skipped = counters(2);
+            info.Dropped = counters(3);
+        end
+        
+        function setNotifications(obj, onAck, types)
+            % SETNOTIFICATIONS Choose which device notifications are kept and how they arrive
+            %
+            % Syntax:
+            %   setNotifications(synth, onAck)
+            %   setNotifications(synth, onAck, types)
+            %
+            % The device records events MATLAB would otherwise have to poll for
+            % (queue drained, queued markers reached, queue overflows, voices
+            % stolen past the SAM2695's 64, notes reaped, link releases, journal
+            % replay done, MIDI input waiting), coalescing repeats into one
+            % record with a count. They are delivered to NotificationFcn, or
+            % returned by pollNotifications.
+            %
+            % Inputs:
+            %   onAck - true to append pending records to the ack of every
+            %           command, so a busy script sees them without extra round
+            %           trips; false to fetch them only with pollNotifications
+            %   types - (Optional) Names from NOTIFY_NAMES to keep (default: all)
+            %
+            % Example:
+            %   synth.NotificationFcn = @(s, n) disp(n);
+            %   synth.setNotifications(true, {'Marker', 'QueueDrained'});
+            %   synth.streamEvents([events; 2.0 synth.MARKER_STATUS 1 0]);
+            
+            if nargin < 3
+                types = obj.NOTIFY_NAMES;
+            end
+            validateattributes(onAck, {'logical', 'numeric'}, {'scalar'}, 'setNotifications', 'onAck');
+            types = cellstr(types);
+            mask = 0;
+            for k = 1:numel(types)
+                name = validatestring(types{k}, obj.NOTIFY_NAMES, 'setNotifications', 'types');
+                mask = bitset(mask, find(strcmp(obj.NOTIFY_NAMES, name)));
+            end
+            
+            % The reply to this command already follows the new setting
+            previous = obj.NotifyOnAck;
+            obj.NotifyOnAck = logical(onAck);
+            try
+                sendCommand(obj, obj.LibraryName, obj.CMD_SET_NOTIFY, [uint8(logical(onAck)), typecast(uint16(mask), 'uint8')]);
+            catch e
+                obj.NotifyOnAck = previous;
+                rethrow(e);
+            end
+        end
+        
+        function notifications = pollNotifications(obj)
+            % POLLNOTIFICATIONS Fetch all pending device notifications in one go
+            %
+            % Syntax:
+            %   notifications = pollNotifications(synth)
+            %
+            % Outputs:
+            %   notifications - table with one row per record: Time (when MATLAB
+            %                   received it), Type, Arg (marker id, unit or
+            %                   logical channel) and Count (coalesced repeats).
+            %                   Records that arrived on acks while no
+            %                   NotificationFcn was set come first. When
+            %                   NotificationFcn is set it is called with the
+            %                   fetched records too.
+            
+            rows = obj.PendingNotifications;
+            obj.PendingNotifications = zeros(0, 4);
+            fetched = zeros(0, 4);
+            remaining = 1;
+            while remaining > 0
+                response = uint8(sendCommand(obj, obj.LibraryName, obj.CMD_GET_NOTIFY, uint8([])));
+                lost = double(typecast(response(2:5), 'uint32'));
+                remaining = double(response(6));
+                count = double(response(7));
+                fetched = [fetched; obj.decodeNotifications(response(8:7 + count * obj.NOTIFY_BYTES))]; %#ok<AGROW>
+                if count == 0
+                    break;
+                end
+            end
+            if lost > 0
+                warning('M5UnitSynth:NotificationsLost', '%d device notifications were lost since boot (ring full).', lost);
+            end
+            if ~isempty(fetched) && ~isempty(obj.NotificationFcn)
+                obj.NotificationFcn(obj, obj.notificationTable(fetched));
+            end
+            notifications = obj.notificationTable([rows; fetched]);
+        end
+        
+        function setTuningTable(obj, table, pitches)
+            % SETTUNINGTABLE Load a microtonal tuning table on the device
+            %
+            % Syntax:
+            %   setTuningTable(synth, table, pitches)
+            %
+            % Inputs:
+            %   table   - Table number (0-3)
+            %   pitches - 128 fractional MIDI note numbers, the pitch each key
+            %             plays (NaN = key stays silent), e.g. from
+            %             Utilities/readScalaTuning.m
+            %
+            % Each key is stored as the nearest note and its offset in 1/100
+            % cent; a tuned channel plays the offset as pitch bend. Tables start
+            % as 12-tone equal temperament.
+            %
+            % Example:
+            %   pitches = readScalaTuning('meantone.scl');
+            %   synth.setTuningTable(0, pitches);
+            %   synth.setChannelTuning(0, 0, 0:5);
+            
+            validateattributes(table, {'numeric'}, {'scalar', 'integer', '>=', 0, '<', obj.TUNING_TABLES}, 'setTuningTable', 'table');
+            validateattributes(pitches, {'numeric'}, {'vector', 'numel', 128}, 'setTuningTable', 'pitches');
+            
+            pitches = double(pitches(:)');
+            mapped = ~isnan(pitches);
+            notes = repmat(obj.TUNING_UNMAPPED, 1, 128);
+            notes(mapped) = round(pitches(mapped));
+            if any(notes(mapped) < 0 | notes(mapped) > 127)
+                error('M5UnitSynth:TuningOutOfRange', 'Tuned pitches must round to MIDI notes 0-127.');
+            end
+            offsets = zeros(1, 128);
+            offsets(mapped) = round((pitches(mapped) - notes(mapped)) * 10000);
+            offsetBytes = reshape(typecast(int16(offsets), 'uint8'), 2, []);
+            
+            keys = [uint8(notes); offsetBytes];
+            for first = 0:obj.TUNING_CHUNK:127
+                count = min(obj.TUNING_CHUNK, 128 - first);
+                chunk = keys(:, first + 1:first + count);
+                data = [uint8([table, first, count]), chunk(:)'];
+                response = sendCommand(obj, obj.LibraryName, obj.CMD_SET_TUNING_TABLE, data);
+                if response(1) ~= 1
+                    error('M5UnitSynth:SetTuningFailed', 'Device rejected keys %d to %d of tuning table %d.', ...
+                        first, first + count - 1, table);
+                end
+            end
+        end
+        
+        function setChannelTuning(obj, channel, table, poolChannels)
+            % SETCHANNELTUNING Play a channel through a tuning table
+            %
+            % Syntax:
+            %   setChannelTuning(synth, channel, table)
+            %   setChannelTuning(synth, channel, table, poolChannels)
+            %
+            % Inputs:
+            %   channel      - Logical MIDI channel (0 to NumChannels-1)
+            %   table        - Tuning table (0-3), or [] to play untuned again
+            %   poolChannels - (Optional) Consecutive logical channels the notes
+            %                  are played on (default: unchanged, initially
+            %                  channel; an MPE zone's members, see setMpeZone)
+            %
+            % The SAM2695 bends whole channels, so each tuned note is played on
+            % a pool channel already bent by its offset, or on an idle one that
+            % is bent first. Notes held together that need different offsets
+            % need as many pool channels; set the pool's instrument, volume and
+            % bend range like the tuned channel. Notes held on the channel are
+            % released.
+            %
+            % Example:
+            %   for ch = 0:5
+            %       synth.setInstrument(0, ch, 19);   % Church organ
+            %   end
+            %   synth.setChannelTuning(0, 0, 0:5);
+            %   synth.setNoteOn(0, 61, 100);          % plays key 61 of table 0
+            
+            if nargin < 4
+                poolChannels = [];
+            end
+            validateattributes(channel, {'numeric'}, {'scalar', 'integer', '>=', 0, '<=', obj.NumChannels - 1}, 'setChannelTuning', 'channel');
+            if isempty(table)
+                table = obj.NO_TUNING;
+            else
+                validateattributes(table, {'numeric'}, {'scalar', 'integer', '>=', 0, '<', obj.TUNING_TABLES}, 'setChannelTuning', 'table');
+            end
+            data = uint8([channel, table]);
+            if ~isempty(poolChannels)
+                validateattributes(poolChannels, {'numeric'}, {'vector', 'integer', '>=', 0, '<=', obj.NumChannels - 1}, 'setChannelTuning', 'poolChannels');
+                if any(diff(poolChannels) ~= 1)
+                    error('M5UnitSynth:PoolNotContiguous', 'poolChannels must be consecutive.');
+                end
+                data = [data, uint8([poolChannels(1), numel(poolChannels)])];
+            end
+            
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_SET_CHANNEL_TUNING, data);
+            if response(1) ~= 1
+                warning('M5UnitSynth:SetChannelTuningFailed', 'Device rejected the channel tuning.');
+            end
+        end
+        
+        function setMpeZone(obj, master, members)
+            % SETMPEZONE Give every note of a channel a member channel of its own
+            %
+            % Syntax:
+            %   setMpeZone(synth, master, members)
+            %   setMpeZone(synth, master, [])          % end the zone
+            %
+            % Inputs:
+            %   master  - Logical channel the notes are sent to (0 to NumChannels-1)
+            %   members - Consecutive logical channels the notes rotate over
+            %
+            % The SAM2695 bends and shapes whole channels, so per-note
+            % expression needs one note per channel. The device plays each
+            % note of the master on the least recently used member (stealing
+            % the oldest note when all are busy) and resets the member's bend
+            % and expression first. Members get the master's instrument,
+            % volume and effect settings now and whenever they change. Notes
+            % held on the master are released.
+            %
+            % Example:
+            %   synth.setInstrument(0, 0, 40);        % Violin
+            %   synth.setMpeZone(0, 1:8);
+            %   synth.setNoteOn(0, 64, 100);
+            %   synth.setNoteExpression(0, 64, 'Bend', 2048);
+            
+            validateattributes(master, {'numeric'}, {'scalar', 'integer', '>=', 0, '<=', obj.NumChannels - 1}, 'setMpeZone', 'master');
+            if isempty(members)
+                data = uint8([master, 0, 0]);
+            else
+                validateattributes(members, {'numeric'}, {'vector', 'integer', '>=', 0, '<=', obj.NumChannels - 1}, 'setMpeZone', 'members');
+                if any(diff(members) ~= 1)
+                    error('M5UnitSynth:ZoneNotContiguous', 'members must be consecutive.');
+                end
+                data = uint8([master, members(1), numel(members)]);
+            end
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_SET_MPE_ZONE, data);
+            if response(1) ~= 1
+                warning('M5UnitSynth:SetMpeZoneFailed', 'Device rejected the MPE zone.');
+            end
+        end
+        
+        function held = setNoteExpression(obj, master, pitch, type, value)
+            % SETNOTEEXPRESSION Bend or shape one held note of an MPE zone
+            %
+            % Syntax:
+            %   held = setNoteExpression(synth, master, pitch, type, value)
+            %
+            % Inputs:
+            %   master - Master channel of the zone (see setMpeZone)
+            %   pitch  - Key of the held note (0-127)
+            %   type   - 'Bend' (-8192 to 8191, on top of any tuning offset) or
+            %            'Pressure' (0-127, sent as expression)
+            %   value  - New value
+            %
+            % Outputs:
+            %   held - false when the key is not held in the zone
+            %
+            % Example:
+            %   for bend = 0:256:4096
+            %       synth.setNoteExpression(0, 64, 'Bend', bend);  % slide up
+            %   end
+            
+            type = validatestring(type, obj.NOTE_EXPRESSION_NAMES, 'setNoteExpression', 'type');
+            obj.checkArgs('setNoteExpression', {'master', 'pitch'}, [obj.NumChannels - 1, 127], master, pitch);
+            if obj.Validate
+                if strcmp(type, 'Bend')
+                    validateattributes(value, {'numeric'}, {'scalar', 'integer', '>=', -8192, '<=', 8191}, 'setNoteExpression', 'value');
+                else
+                    validateattributes(value, {'numeric'}, {'scalar', 'integer', '>=', 0, '<=', 127}, 'setNoteExpression', 'value');
+                end
+            end
+            
+            data = [uint8([master, pitch, find(strcmp(obj.NOTE_EXPRESSION_NAMES, type)) - 1]), typecast(int16(value), 'uint8')];
+            response = sendCommand(obj, obj.LibraryName, obj.CMD_SET_NOTE_EXPRESSION, data);
+            held = response(1) == 1;
+        end
+        
+        function setGroove(obj, channels, varargin)
+            % SETGROOVE Quantize, swing and humanize a channel's queued notes on the device
+            %
+            % Syntax:
+            %   setGroove(synth, channels, Name, Value, ...)
+            %   setGroove(synth, channels)             % back to the events as queued
+            %
+            % The device moves the note-ons of queued events as it plays them,
+            % so material can be tightened or loosened without reprocessing it
+            % in MATLAB; each note-off moves with its note-on. The grid follows
+            % setTempo and, while startClock runs, the clock ticks. Timing
+            % humanization makes the device take events from the queue up to
+            % the largest possible pull earlier ahead of their time.
+            %
+            % Inputs:
+            %   channels - Logical channel, or a vector of channels set alike
+            %
+            % Name-Value Arguments:
+            %   'Grid'             - Grid step in quarter notes, e.g. 1/4 for
+            %                        sixteenths; [] or 0 for no quantization
+            %                        (default: [])
+            %   'Strength'         - Fraction of the way to the grid (default: 1)
+            %   'Swing'            - Position of every second step within a pair,
+            %                        0.5 straight to 0.75 (default: 0.5)
+            %   'HumanizeTime'     - Random timing spread either way, seconds
+            %                        (0-0.05, default: 0)
+            %   'HumanizeVelocity' - Random velocity spread either way (0-64,
+            %                        default: 0)
+            %   'Seed'             - Random seed; the sequence restarts with every
+            %                        startQueue, so takes repeat (default: 0)
+            %
+            % Example:
+            %   synth.setGroove(9, 'Grid', 1/4, 'Swing', 0.62, 'HumanizeVelocity', 8);
+            %   synth.streamEvents(drumEvents);
+            
+            p = inputParser;
+            addParameter(p, 'Grid', [], @(x) isempty(x) || (isnumeric(x) && isscalar(x) && x >= 0));
+            addParameter(p, 'Strength', 1, @(x) isnumeric(x) && isscalar(x) && x >= 0 && x <= 1);
+            addParameter(p, 'Swing', 0.5, @(x) isnumeric(x) && isscalar(x) && x >= 0.5 && x <= obj.GROOVE_MAX_SWING / 100);
+            addParameter(p, 'HumanizeTime', 0, @(x) isnumeric(x) && isscalar(x) && x >= 0 && x <= obj.GROOVE_MAX_HUMANIZE / 1000);
+            addParameter(p, 'HumanizeVelocity', 0, @(x) isnumeric(x) && isscalar(x) && any(x == 0:obj.GROOVE_MAX_VELOCITY));
+            addParameter(p, 'Seed', 0, @(x) isnumeric(x) && isscalar(x) && x >= 0 && x < 2^32 && x == round(x));
+            parse(p, varargin{:});
+            validateattributes(channels, {'numeric'}, {'vector', 'integer', '>=', 0, '<=', obj.NumChannels - 1}, 'setGroove', 'channels');
+            
+            gridTicks = 0;
+            if ~isempty(p.Results.Grid)
+                gridTicks = p.Results.Grid * obj.PPQN;
+                if gridTicks ~= round(gridTicks) || gridTicks > obj.GROOVE_MAX_GRID
+                    error('M5UnitSynth:BadGrid', 'Grid must be a whole number of 1/%d quarter notes, up to %d quarter notes.', ...
+                        obj.PPQN, obj.GROOVE_MAX_GRID / obj.PPQN);
+                end
+            end
+            settings = uint8([gridTicks, round(100 * p.Results.Strength), round(100 * p.Results.Swing), ...
+                round(1000 * p.Results.HumanizeTime), p.Results.HumanizeVelocity]);
+            seed = typecast(uint32(p.Results.Seed), 'uint8');
+            for channel = channels(:)'
+                sendCommand(obj, obj.LibraryName, obj.CMD_SET_GROOVE, [uint8(channel), settings, seed]);
+            end
+        end
+        
+        function playNote(obj, channel, pitch, duration, velocity)
+            % PLAYNOTE Play a note for a specified duration
+            %
+            % Syntax:
+            %   playNote(synth, channel, pitch, duration)
+            %   playNote(synth, channel, pitch, duration, velocity)
+            %
+            % Inputs:
+            %   channel  - MIDI channel (0-15, up to NumChannels-1 with several units)
+            %   pitch    - MIDI note number (0-127)
+            %   duration - Duration in seconds
+            %   velocity - (Optional) Note velocity (0-127), default = 100
+            %
+            % This is a convenience function that turns on a note, waits,
+            % then turns it off.
+            %
+            % Example:
+            %   synth.playNote(0, 60, 0.5);      % Play middle C for 0.5 seconds
+            %   synth.playNote(0, 64, 1.0, 80);  % Play E for 1 second at velocity 80
+            
+            if nargin < 5
+                velocity = 100;
+            end
+            
+            obj.setNoteOn(channel, pitch, velocity);
+            pause(duration);
+            obj.setNoteOff(channel, pitch, 0);
+        end
+    end
+    
+    methods(Static)
+        function events = noteEvents(channel, pitch, startTime, duration, velocity)
+            % NOTEEVENTS Build a queue event matrix from note lists
+            %
+            % Syntax:
+            %   events = M5UnitSynth.noteEvents(channel, pitch, startTime, duration, velocity)
+            %
+            % Inputs:
+            %   channel   - MIDI channel (0-15, up to NumChannels-1 with several units), scalar or one per note
+            %   pitch     - MIDI note numbers
+            %   startTime - Note start times in seconds, scalar or one per note
+            %   duration  - Note durations in seconds, scalar or one per note
+            %   velocity  - Note velocities (0-127), scalar or one per note
+            %
+            % Outputs:
+            %   events - 2N-by-5 matrix of note on/off events sorted by time,
+            %            ready for queueEvents or streamEvents
+            
+            n = numel(pitch);
+            channel = channel(:) .* ones(n, 1);
+            startTime = startTime(:) .* ones(n, 1);
+            duration = duration(:) .* ones(n, 1);
+            velocity = velocity(:) .* ones(n, 1);
+            pitch = pitch(:);
+            
+            bank = floor(channel / 16);
+            onEvents = [startTime, 0x90 + mod(channel, 16), pitch, velocity, bank];
+            offEvents = [startTime + duration, 0x80 + mod(channel, 16), pitch, zeros(n, 1), bank];
+            % Note offs first so a repeated pitch is released before it restarts
+            events = sortrows([offEvents; onEvents], 1);
+        end
+    end
+    
+    methods(Static, Access = private)
+        function value = percentile(x, p)
+            % Nearest-rank percentile ignoring NaN (no Statistics Toolbox needed)
+            x = sort(x(~isnan(x)));
+            if isempty(x)
+                value = NaN;
+            else
+                value = x(max(1, ceil(p / 100 * numel(x))));
+            end
+        end
+    end
+    
+    methods(Static, Hidden)
+        function ok = bytesInRange(upper, varargin)
+            % True when every argument is a real numeric scalar in 0..upper(k),
+            % tested with one vectorized comparison
+            values = [varargin{:}];
+            ok = isnumeric(values) && isreal(values) && numel(values) == numel(upper) && ...
+                all(values >= 0 & values <= upper);
+        end
+    end
+    
+    methods(Access = private)
+        function checkArgs(obj, functionName, names, upper, varargin)
+            % Validate the byte arguments of a message. The fast vectorized check
+            % covers valid calls; validateattributes only runs when it fails, to
+            % raise the usual error naming the offending argument.
+            if obj.Profiling
+                obj.ProfileCallStart = tic;
+            end
+            if obj.Validate && ~obj.bytesInRange(upper, varargin{:})
+                for k = 1:numel(varargin)
+                    validateattributes(varargin{k}, {'numeric'}, {'scalar', '>=', 0, '<=', upper(k)}, functionName, names{k});
+                end
+            end
+            if obj.Profiling
+                obj.ProfileValidated = toc(obj.ProfileCallStart);
+            end
+        end
+        
+        function recordProfile(obj, commandID, sendTime)
+            % Log one command; the time since checkArgs not spent validating
+            % or sending is the payload packing
+            validation = NaN;
+            packing = NaN;
+            if ~isempty(obj.ProfileCallStart)
+                validation = obj.ProfileValidated;
+                packing = toc(obj.ProfileCallStart) - validation - sendTime;
+                obj.ProfileCallStart = [];
+            end
+            obj.ProfileCount = obj.ProfileCount + 1;
+            if obj.ProfileCount > size(obj.ProfileLog, 1)
+                obj.ProfileLog(2 * size(obj.ProfileLog, 1), :) = 0;
+            end
+            obj.ProfileLog(obj.ProfileCount, :) = [toc(obj.ProfileEpoch), double(commandID), validation, packing, sendTime];
+        end
+        
+        function names = commandNames(obj, commandIDs)
+            % Method-style names ('SET_NOTE_ON') for command IDs, from the CMD_ constants
+            meta = metaclass(obj);
+            props = meta.PropertyList;
+            isCommand = startsWith({props.Name}, 'CMD_');
+            ids = [props(isCommand).DefaultValue];
+            labels = erase({props(isCommand).Name}, 'CMD_');
+            names = cell(size(commandIDs));
+            for k = 1:numel(commandIDs)
+                match = find(ids == commandIDs(k), 1);
+                if isempty(match)
+                    names{k} = sprintf('0x%02X', commandIDs(k));
+                else
+                    names{k} = labels{match};
+                end
+            end
+        end
+        
+        function rows = decodeNotifications(obj, records)
+            % [time, type, arg, count] rows from records of type, arg, count (uint16)
+            records = reshape(uint8(records), obj.NOTIFY_BYTES, []).';
+            rows = zeros(size(records, 1), 4);
+            for k = 1:size(records, 1)
+                rows(k, :) = [now, double(records(k, 1)), double(records(k, 2)), ...
+                    double(typecast(records(k, 3:4), 'uint16'))];
+            end
+        end
+        
+        function notifications = notificationTable(obj, rows)
+            notifications = table(datetime(rows(:, 1), 'ConvertFrom', 'datenum'), ...
+                categorical(obj.NOTIFY_NAMES(rows(:, 2))', obj.NOTIFY_NAMES), rows(:, 3), rows(:, 4), ...
+                'VariableNames', {'Time', 'Type', 'Arg', 'Count'});
+        end
+        
+        function data = packEvents(~, events)
+            % Encode events as CMD_QUEUE_EVENTS payload: count, then per event
+            % time in ms (uint32, LSB first), status, data1, data2, bank
+            count = size(events, 1);
+            packed = zeros(8, count, 'uint8');
+            for k = 1:count
+                packed(1:4, k) = typecast(uint32(round(events(k, 1) * 1000)), 'uint8');
+            end
+            packed(5:8, :) = uint8(events(:, 2:5)');
+            data = [uint8(count), packed(:)'];
+        end
+        
+        function id = chordQualityId(obj, quality)
+            % Map a chord quality name or user table number to the device quality byte
+            if ischar(quality) || isstring(quality)
+                id = find(strcmpi(obj.CHORD_NAMES, quality), 1) - 1;
+                if isempty(id)
+                    error('M5UnitSynth:UnknownChord', 'Unknown chord quality ''%s''.', quality);
+                end
+            else
+                if obj.Validate
+                    validateattributes(quality, {'numeric'}, {'scalar', 'integer', '>=', 0, '<', obj.USER_CHORDS}, 'chordOn', 'quality');
+                end
+                id = obj.CHORD_USER_FIRST + quality;
+            end
+        end
+    end
+    
+    methods(Access = protected)
+        function output = sendCommand(obj, libName, commandID, inputs)
+            % SENDCOMMAND Send command to Arduino
+            if obj.QuietTime > 0
+                % A callback during waitQuiet: the device may be asleep until the window ends
+                pause(max(0, obj.QuietTime - toc(obj.QuietStart)));
+                obj.QuietTime = 0;
+            end
+            if obj.Profiling
+                sendStart = tic;
+            end
+            try
+                output = sendCommand@matlabshared.addon.LibraryBase(obj, libName, commandID, inputs);
+            catch e
+                error('M5UnitSynth:CommandFailed', 'Failed to send command to M5UnitSynth: %s', e.message);
+            end
+            if obj.Profiling
+                obj.recordProfile(commandID, toc(sendStart));
+            end
+            % The last byte of every ack is the device's free event queue slot count
+            if ~isempty(output)
+                obj.FreeEventSlots = double(output(end));
+            end
+            % Piggybacked notifications sit before it: [reply, records, record count, free slots]
+            if obj.NotifyOnAck && numel(output) >= 2
+                count = double(output(end - 1));
+                tail = numel(output) - 1 - count * obj.NOTIFY_BYTES;
+                records = obj.decodeNotifications(output(tail:end - 2));
+                output = output([1:tail - 1, end]);
+                if ~isempty(records) && isempty(obj.NotificationFcn)
+                    obj.PendingNotifications = [obj.PendingNotifications; records];
+                elseif ~isempty(records)
+                    try
+                        obj.NotificationFcn(obj, obj.notificationTable(records));
+                    catch e
+                        warning('M5UnitSynth:NotificationFcnFailed', 'NotificationFcn failed: %s', e.message);
+                    end
+                end
             end
         end
     end
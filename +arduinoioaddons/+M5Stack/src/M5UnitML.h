@@ -25,9 +25,21 @@
 #ifndef M5UNITML_H
 #define M5UNITML_H
 
+// Standalone firmware (Firmware/M5UnitMLStandalone) replaces the MATLAB server
+#if defined(M5UNITML_STANDALONE)
+#include "M5UnitMLStandalone.h"
+#else
 #include "LibraryBase.h"
+#endif
 #include "M5UnitSynth.h"
 
+#if defined(ARDUINO_ARCH_ESP32)
+#include <Preferences.h>
+#include <esp_sleep.h>
+#else
+#include <stdio.h>
+#endif
+
 // Command IDs for communication between MATLAB and Arduino
 #define CMD_BEGIN                   0x01
 #define CMD_SET_INSTRUMENT          0x02
@@ -50,60 +62,2477 @@
 #define CMD_SET_MOD_WHEEL           0x13
 #define CMD_SET_ALL_DRUMS           0x14
 #define CMD_RESET                   0x15
+#define CMD_SET_TEMPO               0x16
+#define CMD_START_CLOCK             0x17
+#define CMD_STOP_CLOCK              0x18
+#define CMD_PRESET_STORE            0x19
+#define CMD_PRESET_RECALL           0x1A
+#define CMD_CHORD_ON                0x1B
+#define CMD_CHORD_OFF               0x1C
+#define CMD_SET_CHORD_TABLE         0x1D
+#define CMD_QUEUE_EVENTS            0x1E
+#define CMD_QUEUE_START             0x1F
+#define CMD_QUEUE_STOP              0x20
+#define CMD_GET_QUEUE_STATS         0x21
+#define CMD_SET_ROUTE               0x22
+#define CMD_SET_BALANCE             0x23
+#define CMD_GET_PROFILE             0x24
+#define CMD_GET_STATS               0x25
+#define CMD_GET_TRACE               0x26
+#define CMD_GET_MEMORY              0x27
+#define CMD_SET_POWER               0x28
+#define CMD_GET_POWER_STATS         0x29
+#define CMD_SET_NOTE_TIMEOUT        0x2A
+#define CMD_SET_LINK_TIMEOUT        0x2B
+#define CMD_GET_REAPER_STATS        0x2C
+#define CMD_SET_JOURNAL             0x2D
+#define CMD_GET_JOURNAL             0x2E
+#define CMD_REPLAY_JOURNAL          0x2F
+#define CMD_SET_MIDI_INPUT          0x30
+#define CMD_GET_MIDI_INPUT          0x31
+#define CMD_SET_NOTIFY              0x32
+#define CMD_GET_NOTIFY              0x33
+#define CMD_SET_TUNING_TABLE        0x34
+#define CMD_SET_CHANNEL_TUNING      0x35
+#define CMD_SET_MPE_ZONE            0x36
+#define CMD_SET_NOTE_EXPRESSION     0x37
+#define CMD_SET_GROOVE              0x38
+#define CMD_SET_QUIET               0x39
+
+// MIDI channel message status bytes
+#define MIDI_NOTE_OFF               0x80
+#define MIDI_NOTE_ON                0x90
+#define MIDI_PROGRAM_CHANGE         0xC0
+#define MIDI_CHANNEL_PRESSURE       0xD0
+#define MIDI_PITCH_BEND             0xE0
+#define MIDI_SYSEX_START            0xF0
+#define MIDI_SYSEX_END              0xF7
+#define MIDI_REALTIME_FIRST         0xF8
+
+// MIDI system real-time bytes
+#define MIDI_CLOCK                  0xF8
+#define MIDI_START                  0xFA
+#define MIDI_STOP                   0xFC
+
+// Tempo engine configuration
+#define M5UNITML_PPQN               24          // MIDI clock ticks per quarter note
+#define M5UNITML_MAX_TICK_HANDLERS  4           // device-side features that can follow the clock
+#define M5UNITML_MIN_TEMPO          20000       // 20 BPM, in 1/1000 BPM
+#define M5UNITML_MAX_TEMPO          300000      // 300 BPM, in 1/1000 BPM
+#define M5UNITML_DEFAULT_TEMPO      120000      // 120 BPM, in 1/1000 BPM
+#define CLOCK_FLAG_SEND_MIDI        0x01        // emit Clock/Start/Stop bytes on the synth UART
+
+// Per-channel parameter groups mirrored in the shadow synth state
+#define STATE_INSTRUMENT            0           // bank, instrument
+#define STATE_VOLUME                1           // level
+#define STATE_EXPRESSION            2           // expression
+#define STATE_PAN                   3           // value
+#define STATE_BEND_RANGE            4           // range
+#define STATE_REVERB                5           // program, level, delay feedback
+#define STATE_CHORUS                6           // program, level, feedback, delay
+#define STATE_EQUALIZER             7           // 4 band gains, 4 band frequencies
+#define STATE_TUNING                8           // fine, coarse
+#define STATE_VIBRATE               9           // rate, depth, delay
+#define STATE_TVF                   10          // cutoff, resonance
+#define STATE_ENVELOPE              11          // attack, decay, release
+#define STATE_MOD_WHEEL             12          // 7 modulation parameters
+#define STATE_GROUP_COUNT           13
+#define STATE_CHANNEL_BYTES         38          // sum of all group sizes
+
+// Chord expansion
+#define CHORD_MAJOR                 0
+#define CHORD_MINOR                 1
+#define CHORD_DOMINANT_7            2
+#define CHORD_MAJOR_7               3
+#define CHORD_MINOR_7               4
+#define CHORD_SUS2                  5
+#define CHORD_SUS4                  6
+#define CHORD_DIMINISHED            7
+#define CHORD_AUGMENTED             8
+#define CHORD_BUILTIN_COUNT         9
+#define CHORD_USER_FIRST            16          // qualities 16.. use the user-defined tables
+#define M5UNITML_USER_CHORDS        4
+#define M5UNITML_MAX_CHORD_NOTES    6
+
+// Scheduled event queue
+#define M5UNITML_EVENT_QUEUE_SIZE   128         // must fit the one-byte credit in every ack
+#define M5UNITML_EVENT_BYTES        8           // wire size of one event in CMD_QUEUE_EVENTS
+#define M5UNITML_LATENESS_BUCKETS   16          // bucket 0: < 64 us, bucket n: [2^(n+5), 2^(n+6)) us
+#define M5UNITML_RESPONSE_SIZE      96
+#define M5UNITML_ACK_TAIL           2           // piggybacked notification count, free event slots
+
+// Synth units and logical channels. ESP32 UART0 carries the MATLAB link, leaving UART2
+// and UART1 for Unit-Synth modules; both can be mapped to the pins of any Core2 port.
+#define M5UNITML_MAX_UNITS          2
+#define M5UNITML_UNIT_CHANNELS      16
+#define M5UNITML_CHANNELS           (M5UNITML_MAX_UNITS * M5UNITML_UNIT_CHANNELS)
+
+// Per-opcode cycle profiling, read with CMD_GET_PROFILE. Compiled out unless
+// M5UNITML_PROFILE is defined to 1 before this header is included.
+#ifndef M5UNITML_PROFILE
+#define M5UNITML_PROFILE            0
+#endif
+#define M5UNITML_PROFILE_OPCODES    64          // slot 0 holds loop() passes that wrote MIDI
+#define M5UNITML_PROFILE_ENTRY_BYTES 33         // opcode, then count/min/mean/max for dispatch and UART
+#define M5UNITML_PROFILE_PAGE       2           // entries per CMD_GET_PROFILE reply
+#define M5UNITML_PROFILE_DONE       0xFF        // next-opcode value of the last page
+
+// Command statistics, read with CMD_GET_STATS. Always on: one counter increment per command.
+#define M5UNITML_STATS_OPCODES      64          // opcodes with their own counters
+#define M5UNITML_STATS_ENTRY_BYTES  21          // opcode, then five uint32_t counters
+#define M5UNITML_STATS_PAGE         3           // entries per CMD_GET_STATS reply
+#define M5UNITML_STATS_DONE         0xFF        // next-opcode value of the last page
+#define M5UNITML_NO_CHANNEL         0xFF        // CommandSpec: no logical channel in the payload
+
+// Timeline trace ring, read with CMD_GET_TRACE. Entries carry micros() timestamps.
+#define M5UNITML_TRACE_SIZE         256         // entries, power of two
+#define M5UNITML_TRACE_PAGE         10          // entries per CMD_GET_TRACE reply
+#define TRACE_COMMAND               1           // arg0 opcode, arg1 payload size
+#define TRACE_COMMAND_DONE          2           // arg0 opcode, arg1 status byte of the reply
+#define TRACE_EVENT_QUEUED          3           // arg0 status, arg1 queue depth
+#define TRACE_EVENT_EMITTED         4           // arg0 status, arg1 lateness in us (saturated)
+#define TRACE_MIDI_WRITE            5           // arg0 unit, arg1 bytes written since the last entry
+#define TRACE_QUEUE_OVERFLOW        6           // arg1 queue depth
+#define TRACE_QUEUE_DRAINED         7
+#define TRACE_MIDI_INPUT            8           // arg0 status, arg1 (data1 << 8) | data2
+
+// Idle power management. The CPU clock never drops below 80 MHz, so the APB clock, the
+// UART baud rates and the tempo timer are unaffected; light sleep is only entered while the
+// tempo clock is stopped, because the hardware timer is gated during sleep. UART RX is gated
+// too, so the device only sleeps inside a quiet window the host declared with CMD_SET_QUIET
+// and wakes on its timer alone.
+#define POWER_MODE_OFF              0           // always full speed
+#define POWER_MODE_SCALE            1           // idle clock while the host is quiet
+#define POWER_MODE_SLEEP            2           // also light sleep in declared quiet windows
+#define POWER_AWAKE                 0
+#define POWER_SCALED                1
+#define POWER_ASLEEP                2
+#define M5UNITML_CPU_MHZ_FULL       240
+#define M5UNITML_CPU_MHZ_IDLE       80
+#define M5UNITML_WAKE_MARGIN_US     1500        // back at full speed this long before an event
+#define M5UNITML_MIN_SLEEP_US       2000        // shorter gaps are not worth a light sleep
+#define M5UNITML_MAX_QUIET_MS       600000      // longest CMD_SET_QUIET window
+
+// Stuck-voice reaper: notes older than their channel's timeout are released, and every note
+// is released when MATLAB has sent nothing for the link timeout while no queued events remain
+#define M5UNITML_REAPER_NOTES       128         // sounding notes tracked with their start time
+#define M5UNITML_REAPER_SCAN_MS     10          // interval between reaper passes
+
+// Command journal: every received command with its micros() receive time, read with
+// CMD_GET_JOURNAL and replayed through commandHandler with the original spacing. The journal
+// commands themselves are not recorded.
+#define M5UNITML_JOURNAL_SIZE       64          // entries, power of two
+#define M5UNITML_JOURNAL_PAYLOAD    72          // payload bytes kept per entry (CMD_QUEUE_EVENTS needs 65)
+#define JOURNAL_RECORDING           0x01        // CMD_GET_JOURNAL state flags
+#define JOURNAL_REPLAYING           0x02
+
+// MIDI input: a keyboard wired to the RX pin of a unit UART (the Unit-Synth never transmits,
+// so that pin is free) is parsed in loop() and played through the same path as queued events
+#define M5UNITML_MIDI_IN_MIRROR     128         // messages kept for MATLAB
+#define M5UNITML_MIDI_IN_PAGE       9           // messages per CMD_GET_MIDI_INPUT reply
+#define MIDI_IN_FLAG_MIRROR         0x01        // CMD_SET_MIDI_INPUT: keep a copy for MATLAB
+#define MIDI_IN_KEEP_CHANNEL        0xFF        // CMD_SET_MIDI_INPUT: play input channel n on logical n
+
+// Notifications: what the host would otherwise poll for, coalesced into 4-byte records
+// [type, arg, count (uint16_t)]. Read with CMD_GET_NOTIFY, or appended to every ack once
+// CMD_SET_NOTIFY turns piggybacking on: [reply..., records..., record count, free slots].
+#define M5UNITML_NOTIFY_SIZE        32          // pending records
+#define M5UNITML_NOTIFY_BYTES       4
+#define M5UNITML_NOTIFY_PAGE        20          // records per CMD_GET_NOTIFY reply
+#define M5UNITML_UNIT_VOICES        64          // SAM2695 polyphony; further notes steal voices
+#define M5UNITML_MARKER_STATUS      0xF9        // queued event that only notifies, data1 = marker id
+#define NOTIFY_QUEUE_DRAINED        1
+#define NOTIFY_MARKER               2           // arg marker id
+#define NOTIFY_QUEUE_OVERFLOW       3
+#define NOTIFY_VOICE_STOLEN         4           // arg unit
+#define NOTIFY_NOTE_REAPED          5           // arg logical channel
+#define NOTIFY_LINK_RELEASE         6
+#define NOTIFY_REPLAY_DONE          7
+#define NOTIFY_MIDI_INPUT           8           // mirrored input messages are waiting
+#define NOTIFY_ALL                  0x00FF      // CMD_SET_NOTIFY mask, bit n-1 enables type n
+
+// Microtonal tuning tables: each key maps to the nearest note and an offset in 1/100 cent.
+// Notes on a tuned channel are spread over a pool of logical channels so that notes needing
+// different pitch bends never share a channel, and the pool channel is bent before the note-on.
+#define M5UNITML_TUNING_TABLES      4
+#define M5UNITML_TUNING_CHUNK       16          // keys per CMD_SET_TUNING_TABLE
+#define M5UNITML_POOL_NOTES         64          // held keys on tuned channels and MPE zones
+#define M5UNITML_DEFAULT_BEND_RANGE 2           // semitones, the SAM2695 power-on range
+#define M5UNITML_NO_TUNING          0xFF        // CMD_SET_CHANNEL_TUNING: channel plays untuned
+#define TUNING_UNMAPPED             0xFF        // table note of a key that stays silent
+
+// MPE zones: every note of the master channel gets a member channel of its own, so pitch bend
+// and expression can follow each note. Members copy the master's configuration.
+#define POOL_MPE                    0x01        // ChannelTuning flags: one note per pool channel
+#define NOTE_EXPRESSION_BEND        0           // CMD_SET_NOTE_EXPRESSION: bend on top of tuning
+#define NOTE_EXPRESSION_PRESSURE    1           // CMD_SET_NOTE_EXPRESSION: expression (CC 11)
+
+// Groove: queued events of a grooved channel are taken from the queue up to the largest pull
+// earlier ahead of time, moved, and held until their new time
+#define M5UNITML_GROOVE_HOLD        32          // events waiting for their grooved time
+#define M5UNITML_GROOVE_SHIFTS      M5UNITML_EVENT_QUEUE_SIZE // note-on shifts kept for their note-offs
+#define M5UNITML_GROOVE_MAX_GRID    96          // ticks, a whole note
+#define M5UNITML_GROOVE_MAX_SWING   75          // percent; 50 is straight, 67 triplet feel
+#define M5UNITML_GROOVE_MAX_HUMANIZE 50         // ms of timing spread either way
+#define M5UNITML_GROOVE_MAX_VELOCITY 64         // velocity spread either way
+
+// Preset storage
+#define M5UNITML_PRESET_SLOTS       8
+#define M5UNITML_PRESET_VERSION     2
+#define M5UNITML_PRESET_NAMESPACE   "m5unitml"
+#ifndef M5UNITML_PRESET_DIR
+#define M5UNITML_PRESET_DIR         "."         // host builds keep presets in files here
+#endif
+
+// Tick counter shared with the tempo timer interrupt. The ISR only counts; ticks are
+// dispatched from loop() so that no UART or library code ever runs in interrupt context.
+static volatile uint32_t m5unitmlPendingTicks = 0;
+
+#if defined(ARDUINO_ARCH_ESP32)
+static void IRAM_ATTR m5unitmlOnTempoTimer() {
+    m5unitmlPendingTicks++;
+}
+#endif
+
+#if M5UNITML_PROFILE
+// CPU cycle counter (Xtensa CCOUNT). Host builds count microseconds instead.
+static inline uint32_t m5unitmlCycles() {
+#if defined(ARDUINO_ARCH_ESP32)
+    return ESP.getCycleCount();
+#else
+    return micros();
+#endif
+}
+
+// Time a library call or UART write; the cycles add to the current opcode's UART total
+#define M5UNITML_TIMED_UART(...) do { \
+        uint32_t uartStart = m5unitmlCycles(); \
+        __VA_ARGS__; \
+        profileUartCycles += m5unitmlCycles() - uartStart; \
+    } while (0)
+
+struct CycleStats {
+    uint32_t count;
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint64_t totalCycles;
+};
+
+struct OpcodeProfile {
+    CycleStats dispatch;                        // whole commandHandler case (or loop() pass)
+    CycleStats uart;                            // library calls and UART writes within it
+};
+#else
+#define M5UNITML_TIMED_UART(...) do { __VA_ARGS__; } while (0)
+#endif
+
+// Last value sent for every parameter group of one MIDI channel
+struct ChannelState {
+    uint16_t valid;                             // bit n set when group n has been sent
+    uint8_t params[STATE_CHANNEL_BYTES];
+};
+
+// Complete synth configuration; this is also the preset storage format
+struct SynthState {
+    uint8_t version;
+    uint8_t masterVolume;
+    uint8_t masterVolumeValid;
+    ChannelState channels[M5UNITML_CHANNELS];
+};
+
+// A channel message scheduled relative to the start of queue playback
+struct ScheduledEvent {
+    uint32_t timeMs;
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+    uint8_t channel;                            // logical channel
+};
+
+// Groove of one logical channel, applied to its queued events as they are emitted
+struct Groove {
+    uint8_t gridTicks;                          // quantize grid in clock ticks, 0 = off
+    uint8_t strength;                           // percent of the way to the grid
+    uint8_t swing;                              // percent; delays odd grid steps above 50
+    uint8_t humanizeMs;
+    uint8_t humanizeVelocity;
+    uint32_t seed;
+    uint32_t random;                            // xorshift state, reseeded at queue start
+};
+
+// A queued event taken early and waiting for its grooved time
+struct GroovedEvent {
+    uint32_t dueUs;
+    ScheduledEvent event;
+};
+
+// How far a note-on was moved, so its note-off moves with it
+struct GrooveShift {
+    int32_t shiftUs;
+    uint32_t noteOnUs;                          // grooved time of the note-on
+    uint8_t channel;
+    uint8_t pitch;
+};
+
+// Start time of a sounding note, for the stuck-voice reaper
+struct NoteAge {
+    uint32_t startMs;
+    uint8_t logical;
+    uint8_t pitch;
+};
+
+// Unit UART that counts every byte written through it, including the bytes the
+// M5UnitSynth library writes itself
+class CountingSerial : public HardwareSerial {
+public:
+    explicit CountingSerial(int uartNr) : HardwareSerial(uartNr), bytesWritten(0) {}
+
+    size_t write(uint8_t value) override {
+        bytesWritten++;
+        return HardwareSerial::write(value);
+    }
+    size_t write(const uint8_t* buffer, size_t size) override {
+        bytesWritten += size;
+        return HardwareSerial::write(buffer, size);
+    }
+    using HardwareSerial::write;
+
+    uint32_t bytesWritten;
+};
+
+// Outcome counters of one opcode
+struct OpcodeStats {
+    uint32_t accepted;
+    uint32_t shortPayload;                      // payload shorter than the command needs
+    uint32_t notInitialized;                    // no unit started (CMD_BEGIN) for the target
+    uint32_t invalid;                           // argument out of range or operation failed
+    uint32_t unknown;                           // opcode not handled by this firmware
+};
+
+// One trace ring entry, 8 bytes on the wire
+struct TraceEntry {
+    uint32_t timeUs;
+    uint8_t type;
+    uint8_t arg0;
+    uint16_t arg1;
+};
+
+// One received command. Longer payloads keep their size but only the first
+// M5UNITML_JOURNAL_PAYLOAD bytes, and are skipped on replay.
+struct JournalEntry {
+    uint32_t timeUs;
+    uint8_t cmdID;
+    uint8_t size;
+    uint8_t payload[M5UNITML_JOURNAL_PAYLOAD];
+};
+
+// Streaming MIDI parser state: running status survives between messages, real-time bytes
+// may arrive anywhere, system exclusive and system common messages are skipped
+struct MidiParser {
+    uint8_t status;                             // running status, 0 = none
+    uint8_t data[2];
+    uint8_t count;                              // data bytes received for the current message
+};
+
+// A pending notification; repeats of the newest record only raise its count
+struct Notification {
+    uint8_t type;
+    uint8_t arg;
+    uint16_t count;
+};
+
+// Per-key tuning: nearest MIDI note and the bend to apply, in 1/100 cent
+struct TuningTable {
+    uint8_t notes[128];
+    int16_t offsets[128];
+};
+
+// Tuning of one logical channel and the channels its notes are spread over; an MPE zone's
+// pool is its member channels
+struct ChannelTuning {
+    uint8_t table;                              // M5UNITML_NO_TUNING when untuned
+    uint8_t poolFirst;
+    uint8_t poolCount;
+    uint8_t flags;                              // POOL_MPE
+};
+
+// A held key of a tuned channel or MPE zone and the note that plays it
+struct PoolNote {
+    uint8_t source;                             // logical channel the key arrived on
+    uint8_t key;
+    uint8_t logical;                            // pool channel
+    uint8_t note;
+};
+
+// What a command needs, used to tell why it was rejected
+struct CommandSpec {
+    uint8_t minPayload;
+    bool needsUnit;
+    uint8_t channelByte;                        // payload index of the logical channel
+};
+
+// One Unit-Synth module and the UART it is attached to
+struct SynthUnit {
+    M5UnitSynth* synth;
+    HardwareSerial* serial;
+};
+
+// Event queue telemetry, cleared on request
+struct QueueStats {
+    uint32_t emitted;                           // events written to the synth
+    uint32_t underruns;                         // events that arrived after their due time
+    uint32_t overflows;                         // events rejected because the queue was full
+    uint32_t drains;                            // times the queue ran empty during playback
+    uint32_t maxLatenessUs;
+    uint32_t lateness[M5UNITML_LATENESS_BUCKETS];
+    uint16_t highWater;                         // deepest queue depth seen
+};
 
 class M5UnitML : public LibraryBase {
+public:
+    // Clock subscriber: called from loop() once per 1/24 quarter note while the clock runs
+    typedef void (M5UnitML::*TickHandler)(uint32_t tick);
+
 private:
-    M5UnitSynth* synth;
+    SynthUnit units[M5UNITML_MAX_UNITS];
+    CountingSerial unit0Uart;
+    CountingSerial unit1Uart;
+    uint8_t channelRoutes[M5UNITML_CHANNELS];   // (unit << 4) | unit channel, per logical channel
+
+    // Polyphony balancing: balanced channels are mirrored on every unit and their notes go
+    // to the least loaded unit. activeNotes holds unit + 1 for each sounding note, 0 if off.
+    uint32_t balancedChannels;
+    uint8_t activeNotes[M5UNITML_CHANNELS][128];
+    uint16_t unitVoices[M5UNITML_MAX_UNITS];
     MWArduinoClass& arduino;
 
-public:
-    // Constructor
-    M5UnitML(MWArduinoClass& a) : LibraryBase(), arduino(a) {
-        libName = "M5Stack/M5UnitSynth";
-        synth = nullptr;
-        a.registerLibrary(this);
+    // Tempo engine state. Tempo is kept in 1/1000 BPM and the tick period in 1/10 us so
+    // fractional tempos do not drift over long runs.
+    uint32_t tempo;
+    uint32_t rampStartTempo;
+    uint32_t rampTargetTempo;
+    uint32_t rampStartMs;
+    uint32_t rampDurationMs;
+    uint32_t tickPeriod;
+    uint32_t clockTicks;
+    uint8_t clockFlags;
+    bool clockRunning;
+    TickHandler tickHandlers[M5UNITML_MAX_TICK_HANDLERS];
+    uint8_t tickHandlerCount;
+
+    // Shadow of what has been sent to the synth, plus scratch space for preset recall
+    SynthState state;
+    SynthState presetBuffer;
+
+    // User chord tables and the notes of the chord currently held on each channel
+    uint8_t userChordIntervals[M5UNITML_USER_CHORDS][M5UNITML_MAX_CHORD_NOTES];
+    uint8_t userChordSizes[M5UNITML_USER_CHORDS];
+    uint8_t heldChordNotes[M5UNITML_CHANNELS][M5UNITML_MAX_CHORD_NOTES];
+    uint8_t heldChordSizes[M5UNITML_CHANNELS];
+
+    // Scheduled event ring buffer, played from loop() once started
+    ScheduledEvent eventQueue[M5UNITML_EVENT_QUEUE_SIZE];
+    uint16_t eventHead;
+    uint16_t eventCount;
+    uint32_t queueEpochUs;
+    bool queueRunning;
+    QueueStats queueStats;
+
+    // Groove engine; grooveTickUs is when clock tick grooveTick was serviced, so the grid
+    // follows the running clock
+    Groove grooves[M5UNITML_CHANNELS];
+    uint32_t groovedChannels;
+    GroovedEvent grooveHeld[M5UNITML_GROOVE_HOLD];
+    uint8_t grooveHeldCount;
+    GrooveShift grooveShifts[M5UNITML_GROOVE_SHIFTS];   // oldest first
+    uint8_t grooveShiftCount;
+    uint32_t grooveTickUs;
+    uint32_t grooveTick;
+#if M5UNITML_PROFILE
+    OpcodeProfile opcodeProfile[M5UNITML_PROFILE_OPCODES];
+    uint32_t profileUartCycles;                 // UART cycles of the dispatch in progress
+#endif
+    OpcodeStats opcodeStats[M5UNITML_STATS_OPCODES];
+    uint32_t unknownHighOpcodes;                // unknown opcodes beyond the table
+
+    // Timeline trace; entry n lives at traceRing[n % M5UNITML_TRACE_SIZE]
+    TraceEntry traceRing[M5UNITML_TRACE_SIZE];
+    uint32_t traceCount;                        // entries recorded since the last clear
+    uint32_t traceUartBytes[M5UNITML_MAX_UNITS]; // UART byte counts already traced
+
+    // Idle power management
+    uint8_t powerMode;
+    uint8_t powerState;                         // POWER_AWAKE, POWER_SCALED or POWER_ASLEEP
+    uint16_t maxWakeLatencyMs;                  // longest single light sleep
+    uint16_t powerIdleMs;                       // host quiet time before powering down
+    uint32_t lastCommandUs;
+    uint32_t powerStateSinceUs;
+    uint64_t powerStateUs[3];                   // time spent in each power state
+    uint32_t sleepCount;
+    bool quiet;                                 // inside the host's declared quiet window
+    uint32_t quietUntilUs;                      // end of that window
+    uint32_t quietWindows;                      // CMD_SET_QUIET windows declared
+
+    // Stuck-voice reaper; noteAges is unordered, entries are swap-removed
+    NoteAge noteAges[M5UNITML_REAPER_NOTES];
+    uint8_t noteAgeCount;
+    uint32_t noteTimeoutMs[M5UNITML_CHANNELS];  // 0 = notes may sound forever
+    uint32_t linkTimeoutMs;                     // 0 = never release on host silence
+    bool linkReleased;                          // released since the last command
+    uint32_t reaperLastScanMs;
+    uint32_t untrackedNotes;                    // note-ons with noteAges full
+    uint32_t reapedNotes;
+    uint32_t linkReleases;
+
+    // Command journal; entry n lives at journal[n % M5UNITML_JOURNAL_SIZE]
+    JournalEntry journal[M5UNITML_JOURNAL_SIZE];
+    uint32_t journalCount;                      // entries recorded since the last clear
+    bool journalRecording;
+    bool replaying;
+    bool replayDispatch;                        // a replayed command is running: no response
+    uint32_t replayNext;                        // sequence number of the next entry to replay
+    uint32_t replayEnd;
+    uint32_t replayBaseUs;                      // receive time of the first replayed entry
+    uint32_t replayStartUs;                     // micros() that receive time maps to
+
+    // MIDI input passthrough; midiMirror holds ScheduledEvents timed in millis()
+    HardwareSerial* midiInput;                  // nullptr = input off
+    MidiParser midiParser;
+    uint8_t midiInputChannel;                   // logical channel, or MIDI_IN_KEEP_CHANNEL
+    bool midiInputMirror;
+    ScheduledEvent midiMirror[M5UNITML_MIDI_IN_MIRROR];
+    uint16_t midiMirrorHead;
+    uint16_t midiMirrorCount;
+    uint32_t midiInputMessages;
+    uint32_t midiInputSkipped;                  // real-time, system and stray data bytes
+    uint32_t midiMirrorDropped;                 // copies lost because MATLAB read too late
+
+    // Notification ring, oldest first
+    Notification notifications[M5UNITML_NOTIFY_SIZE];
+    uint8_t notifyHead;
+    uint8_t notifyCount;
+    uint16_t notifyMask;
+    bool notifyPiggyback;
+    uint32_t notifyLost;                        // records dropped with the ring full
+
+    // Microtonal tuning; poolNotes is kept oldest first
+    TuningTable tuningTables[M5UNITML_TUNING_TABLES];
+    ChannelTuning channelTuning[M5UNITML_CHANNELS];
+    int16_t channelBend[M5UNITML_CHANNELS];    // last pitch bend sent, -8192 to 8191
+    uint32_t poolLastUse[M5UNITML_CHANNELS];
+    uint32_t poolUses;
+    PoolNote poolNotes[M5UNITML_POOL_NOTES];
+    uint8_t poolNoteCount;
+    uint32_t pressedChannels;                   // MPE members whose expression a note changed
+#if defined(ARDUINO_ARCH_ESP32)
+    hw_timer_t* tempoTimer;
+#else
+    uint32_t lastClockPollUs;
+    uint32_t tickPhase;
+#endif
+
+    // Little-endian helpers matching the byte order used by M5UnitSynth.m
+    static uint32_t readUInt32(const byte* data) {
+        return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+    }
+    static unsigned int writeUInt16(byte* data, uint16_t value) {
+        data[0] = value & 0xFF;
+        data[1] = (value >> 8) & 0xFF;
+        return 2;
+    }
+    static unsigned int writeUInt32(byte* data, uint32_t value) {
+        writeUInt16(data, value & 0xFFFF);
+        writeUInt16(&data[2], (value >> 16) & 0xFFFF);
+        return 4;
     }
 
-    // Destructor
-    ~M5UnitML() {
-        if (synth != nullptr) {
-            delete synth;
+    static uint8_t stateGroupOffset(uint8_t group) {
+        static const uint8_t offsets[STATE_GROUP_COUNT] = { 0, 2, 3, 4, 5, 6, 9, 13, 21, 23, 26, 28, 31 };
+        return offsets[group];
+    }
+
+    static uint8_t stateGroupSize(uint8_t group) {
+        static const uint8_t sizes[STATE_GROUP_COUNT] = { 2, 1, 1, 1, 1, 3, 4, 8, 2, 3, 2, 3, 7 };
+        return sizes[group];
+    }
+
+    void clearState() {
+        memset(&state, 0, sizeof(state));
+        state.version = M5UNITML_PRESET_VERSION;
+    }
+
+    // Remember the parameters of a group after they have been sent to the synth
+    void recordState(uint8_t channel, uint8_t group, const byte* params) {
+        if (channel >= M5UNITML_CHANNELS) {
+            return;
         }
+        ChannelState& ch = state.channels[channel];
+        memcpy(&ch.params[stateGroupOffset(group)], params, stateGroupSize(group));
+        ch.valid |= (uint16_t)(1u << group);
     }
 
-    // Command handler for processing MATLAB commands
-    void commandHandler(byte cmdID, byte* dataIn, unsigned int payloadSize) {
-        byte responseData[32];
-        unsigned int responseSize = 0;
+    // Send one parameter group to every unit a logical channel plays on, and to the members
+    // of an MPE zone it is the master of
+    void applyState(uint8_t logical, uint8_t group, const uint8_t* p) {
+        applyRoutedState(logical, group, p);
+        if (logical < M5UNITML_CHANNELS && (channelTuning[logical].flags & POOL_MPE)) {
+            const ChannelTuning& zone = channelTuning[logical];
+            for (uint8_t member = zone.poolFirst; member < zone.poolFirst + zone.poolCount; member++) {
+                if (member != logical) {
+                    applyRoutedState(member, group, p);
+                    recordState(member, group, p);
+                }
+            }
+        }
+    }
 
-        switch (cmdID) {
-            case CMD_BEGIN: {
-                // Initialize the M5UnitSynth with UART
-                // dataIn[0] = RX pin
-                // dataIn[1] = TX pin
-                // dataIn[2-3] = Baud rate (uint16_t, default: 31250)
-                uint8_t rxPin = (payloadSize > 0) ? dataIn[0] : 16;
-                uint8_t txPin = (payloadSize > 1) ? dataIn[1] : 17;
-                uint16_t baud = (payloadSize > 3) ? (dataIn[2] | (dataIn[3] << 8)) : 31250;
-                
-                if (synth == nullptr) {
-                    synth = new M5UnitSynth();
+    void applyRoutedState(uint8_t logical, uint8_t group, const uint8_t* p) {
+        uint8_t channel = 0;
+        uint8_t targets = channelTargets(logical, channel);
+        for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+            if (targets & (1u << u)) {
+                M5UNITML_TIMED_UART(applyUnitState(units[u].synth, channel, group, p));
+            }
+        }
+    }
+
+    void applyUnitState(M5UnitSynth* synth, uint8_t channel, uint8_t group, const uint8_t* p) {
+        switch (group) {
+            case STATE_INSTRUMENT:  synth->setInstrument(p[0], channel, p[1]); break;
+            case STATE_VOLUME:      synth->setVolume(channel, p[0]); break;
+            case STATE_EXPRESSION:  synth->setExpression(channel, p[0]); break;
+            case STATE_PAN:         synth->setPan(channel, p[0]); break;
+            case STATE_BEND_RANGE:  synth->setPitchBendRange(channel, p[0]); break;
+            case STATE_REVERB:      synth->setReverb(channel, p[0], p[1], p[2]); break;
+            case STATE_CHORUS:      synth->setChorus(channel, p[0], p[1], p[2], p[3]); break;
+            case STATE_EQUALIZER:   synth->setEqualizer(channel, p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]); break;
+            case STATE_TUNING:      synth->setTuning(channel, p[0], p[1]); break;
+            case STATE_VIBRATE:     synth->setVibrate(channel, p[0], p[1], p[2]); break;
+            case STATE_TVF:         synth->setTvf(channel, p[0], p[1]); break;
+            case STATE_ENVELOPE:    synth->setEnvelope(channel, p[0], p[1], p[2]); break;
+            case STATE_MOD_WHEEL:   synth->setModWheel(channel, p[0], p[1], p[2], p[3], p[4], p[5], p[6]); break;
+            default: break;
+        }
+    }
+
+    // Bring the synth to the configuration in presetBuffer, sending only groups that differ.
+    // Returns the number of parameter groups sent.
+    uint16_t recallPresetBuffer() {
+        uint16_t sent = 0;
+        if (presetBuffer.masterVolumeValid &&
+            (!state.masterVolumeValid || state.masterVolume != presetBuffer.masterVolume)) {
+            for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+                if (units[u].synth != nullptr) {
+                    M5UNITML_TIMED_UART(units[u].synth->setMasterVolume(presetBuffer.masterVolume));
+                }
+            }
+            state.masterVolume = presetBuffer.masterVolume;
+            state.masterVolumeValid = 1;
+            sent++;
+        }
+        for (uint8_t channel = 0; channel < M5UNITML_CHANNELS; channel++) {
+            ChannelState& target = presetBuffer.channels[channel];
+            ChannelState& current = state.channels[channel];
+            for (uint8_t group = 0; group < STATE_GROUP_COUNT; group++) {
+                uint16_t bit = (uint16_t)(1u << group);
+                if (!(target.valid & bit)) {
+                    continue;
+                }
+                const uint8_t* wanted = &target.params[stateGroupOffset(group)];
+                if ((current.valid & bit) &&
+                    memcmp(wanted, &current.params[stateGroupOffset(group)], stateGroupSize(group)) == 0) {
+                    continue;
+                }
+                applyState(channel, group, wanted);
+                recordState(channel, group, wanted);
+                sent++;
+            }
+        }
+        return sent;
+    }
+
+    // Presets live in NVS on the ESP32 and in one file per slot on host builds
+    bool savePreset(uint8_t slot) {
+#if defined(ARDUINO_ARCH_ESP32)
+        char key[4] = { 'p', (char)('0' + slot), '\0', '\0' };
+        Preferences prefs;
+        if (!prefs.begin(M5UNITML_PRESET_NAMESPACE, false)) {
+            return false;
+        }
+        size_t written = prefs.putBytes(key, &state, sizeof(state));
+        prefs.end();
+        return written == sizeof(state);
+#else
+        char path[128];
+        snprintf(path, sizeof(path), "%s/m5unitml_preset_%u.bin", M5UNITML_PRESET_DIR, (unsigned)slot);
+        FILE* f = fopen(path, "wb");
+        if (f == nullptr) {
+            return false;
+        }
+        size_t written = fwrite(&state, 1, sizeof(state), f);
+        fclose(f);
+        return written == sizeof(state);
+#endif
+    }
+
+    bool loadPreset(uint8_t slot) {
+        size_t length = 0;
+#if defined(ARDUINO_ARCH_ESP32)
+        char key[4] = { 'p', (char)('0' + slot), '\0', '\0' };
+        Preferences prefs;
+        if (!prefs.begin(M5UNITML_PRESET_NAMESPACE, true)) {
+            return false;
+        }
+        if (prefs.getBytesLength(key) == sizeof(presetBuffer)) {
+            length = prefs.getBytes(key, &presetBuffer, sizeof(presetBuffer));
+        }
+        prefs.end();
+#else
+        char path[128];
+        snprintf(path, sizeof(path), "%s/m5unitml_preset_%u.bin", M5UNITML_PRESET_DIR, (unsigned)slot);
+        FILE* f = fopen(path, "rb");
+        if (f == nullptr) {
+            return false;
+        }
+        length = fread(&presetBuffer, 1, sizeof(presetBuffer), f);
+        fclose(f);
+#endif
+        return length == sizeof(presetBuffer) && presetBuffer.version == M5UNITML_PRESET_VERSION;
+    }
+
+    uint8_t eventQueueFree() const {
+        return (uint8_t)(M5UNITML_EVENT_QUEUE_SIZE - eventCount);
+    }
+
+    void notify(uint8_t type, uint8_t arg) {
+        if (!(notifyMask & (1u << (type - 1)))) {
+            return;
+        }
+        if (notifyCount > 0) {
+            Notification& last = notifications[(notifyHead + notifyCount - 1) % M5UNITML_NOTIFY_SIZE];
+            if (last.type == type && last.arg == arg) {
+                if (last.count < 0xFFFF) {
+                    last.count++;
+                }
+                return;
+            }
+        }
+        if (notifyCount >= M5UNITML_NOTIFY_SIZE) {
+            notifyLost++;
+            return;
+        }
+        Notification& n = notifications[(notifyHead + notifyCount) % M5UNITML_NOTIFY_SIZE];
+        n.type = type;
+        n.arg = arg;
+        n.count = 1;
+        notifyCount++;
+    }
+
+    // Move the oldest pending records into a reply while maxBytes allows; returns how many
+    uint8_t takeNotifications(byte* out, unsigned int maxBytes) {
+        uint8_t taken = 0;
+        while (notifyCount > 0 && (taken + 1u) * M5UNITML_NOTIFY_BYTES <= maxBytes) {
+            const Notification& n = notifications[notifyHead];
+            byte* record = out + taken * M5UNITML_NOTIFY_BYTES;
+            record[0] = n.type;
+            record[1] = n.arg;
+            writeUInt16(&record[2], n.count);
+            notifyHead = (notifyHead + 1) % M5UNITML_NOTIFY_SIZE;
+            notifyCount--;
+            taken++;
+        }
+        return taken;
+    }
+
+    bool pushEvent(const byte* data) {
+        if (eventCount >= M5UNITML_EVENT_QUEUE_SIZE) {
+            queueStats.overflows++;
+            notify(NOTIFY_QUEUE_OVERFLOW, 0);
+            trace(TRACE_QUEUE_OVERFLOW, 0, eventCount);
+            return false;
+        }
+        ScheduledEvent& e = eventQueue[(eventHead + eventCount) % M5UNITML_EVENT_QUEUE_SIZE];
+        e.timeMs = readUInt32(data);
+        e.status = data[4];
+        e.data1 = data[5] & 0x7F;
+        e.data2 = data[6] & 0x7F;
+        e.channel = (uint8_t)((data[7] << 4) | (data[4] & 0x0F));
+        eventCount++;
+        if (eventCount > queueStats.highWater) {
+            queueStats.highWater = eventCount;
+        }
+        if (queueRunning && (int32_t)(micros() - (queueEpochUs + e.timeMs * 1000u)) > 0) {
+            queueStats.underruns++;
+        }
+        trace(TRACE_EVENT_QUEUED, e.status, eventCount);
+        return true;
+    }
+
+    static uint8_t latenessBucket(uint32_t latenessUs) {
+        if (latenessUs < 64) {
+            return 0;
+        }
+        uint8_t bucket = (uint8_t)(31 - __builtin_clz(latenessUs) - 5);
+        return (bucket < M5UNITML_LATENESS_BUCKETS) ? bucket : M5UNITML_LATENESS_BUCKETS - 1;
+    }
+
+    void recordLateness(uint32_t latenessUs) {
+        queueStats.emitted++;
+        queueStats.lateness[latenessBucket(latenessUs)]++;
+        if (latenessUs > queueStats.maxLatenessUs) {
+            queueStats.maxLatenessUs = latenessUs;
+        }
+    }
+
+#if M5UNITML_PROFILE
+    void clearProfile() {
+        memset(opcodeProfile, 0, sizeof(opcodeProfile));
+        profileUartCycles = 0;
+    }
+
+    static void recordCycles(CycleStats& stats, uint32_t cycles) {
+        if (stats.count == 0 || cycles < stats.minCycles) {
+            stats.minCycles = cycles;
+        }
+        if (cycles > stats.maxCycles) {
+            stats.maxCycles = cycles;
+        }
+        stats.count++;
+        stats.totalCycles += cycles;
+    }
+
+    // Close the profile of one dispatch; UART time counts only when something was written
+    void recordOpcode(uint8_t opcode, uint32_t cycles) {
+        if (opcode >= M5UNITML_PROFILE_OPCODES) {
+            return;
+        }
+        recordCycles(opcodeProfile[opcode].dispatch, cycles);
+        if (profileUartCycles > 0) {
+            recordCycles(opcodeProfile[opcode].uart, profileUartCycles);
+        }
+    }
+
+    // count, min, mean, max as uint32_t, LSB first
+    uint8_t writeCycleStats(uint8_t* out, const CycleStats& stats) {
+        uint8_t size = writeUInt32(out, stats.count);
+        size += writeUInt32(out + size, stats.minCycles);
+        size += writeUInt32(out + size, stats.count ? (uint32_t)(stats.totalCycles / stats.count) : 0);
+        size += writeUInt32(out + size, stats.maxCycles);
+        return size;
+    }
+#endif
+
+    void clearStats() {
+        memset(opcodeStats, 0, sizeof(opcodeStats));
+        unknownHighOpcodes = 0;
+        unit0Uart.bytesWritten = 0;
+        unit1Uart.bytesWritten = 0;
+        memset(traceUartBytes, 0, sizeof(traceUartBytes));
+    }
+
+    void trace(uint8_t type, uint8_t arg0, uint16_t arg1) {
+        TraceEntry& t = traceRing[traceCount % M5UNITML_TRACE_SIZE];
+        t.timeUs = micros();
+        t.type = type;
+        t.arg0 = arg0;
+        t.arg1 = arg1;
+        traceCount++;
+    }
+
+    // One TRACE_MIDI_WRITE entry per unit that was written to since the last call
+    void traceMidiWrites() {
+        for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+            uint32_t written = unitUart(u)->bytesWritten - traceUartBytes[u];
+            if (written > 0) {
+                trace(TRACE_MIDI_WRITE, u, (uint16_t)(written < 0xFFFF ? written : 0xFFFF));
+                traceUartBytes[u] += written;
+            }
+        }
+    }
+
+    bool journaled(byte cmdID) const {
+        return journalRecording && cmdID != CMD_SET_JOURNAL && cmdID != CMD_GET_JOURNAL && cmdID != CMD_REPLAY_JOURNAL &&
+               cmdID != CMD_SET_QUIET;
+    }
+
+    void recordJournal(byte cmdID, const byte* dataIn, unsigned int payloadSize, uint32_t timeUs) {
+        JournalEntry& j = journal[journalCount % M5UNITML_JOURNAL_SIZE];
+        j.timeUs = timeUs;
+        j.cmdID = cmdID;
+        j.size = (uint8_t)(payloadSize < 0xFF ? payloadSize : 0xFF);
+        memcpy(j.payload, dataIn, payloadSize < M5UNITML_JOURNAL_PAYLOAD ? payloadSize : M5UNITML_JOURNAL_PAYLOAD);
+        journalCount++;
+    }
+
+    uint32_t oldestJournalEntry() const {
+        return (journalCount > M5UNITML_JOURNAL_SIZE) ? journalCount - M5UNITML_JOURNAL_SIZE : 0;
+    }
+
+    // Feed every journal entry that is due back to commandHandler, keeping the spacing the
+    // commands were received with. Their responses are dropped.
+    void serviceReplay() {
+        while (replaying && replayNext < replayEnd) {
+            const JournalEntry& j = journal[replayNext % M5UNITML_JOURNAL_SIZE];
+            if ((int32_t)(micros() - replayStartUs - (j.timeUs - replayBaseUs)) < 0) {
+                return;
+            }
+            replayNext++;
+            if (j.size <= M5UNITML_JOURNAL_PAYLOAD) {
+                byte payload[M5UNITML_JOURNAL_PAYLOAD];
+                memcpy(payload, j.payload, j.size);
+                replayDispatch = true;
+                commandHandler(j.cmdID, payload, j.size);
+                replayDispatch = false;
+            }
+        }
+        if (replaying) {
+            notify(NOTIFY_REPLAY_DONE, 0);
+        }
+        replaying = false;
+    }
+
+    static bool statsUsed(const OpcodeStats& stats) {
+        return (stats.accepted | stats.shortPayload | stats.notInitialized | stats.invalid | stats.unknown) != 0;
+    }
+
+    static CommandSpec commandSpec(uint8_t cmdID) {
+        static const CommandSpec specs[] = {
+            { 0, false, M5UNITML_NO_CHANNEL },  // CMD_BEGIN
+            { 3, true,  1 },                    // CMD_SET_INSTRUMENT
+            { 3, true,  0 },                    // CMD_SET_NOTE_ON
+            { 3, true,  0 },                    // CMD_SET_NOTE_OFF
+            { 1, true,  0 },                    // CMD_SET_ALL_NOTE_OFF
+            { 3, true,  0 },                    // CMD_SET_PITCH_BEND
+            { 2, true,  0 },                    // CMD_SET_PITCH_BEND_RANGE
+            { 1, true,  M5UNITML_NO_CHANNEL },  // CMD_SET_MASTER_VOLUME
+            { 2, true,  0 },                    // CMD_SET_CHANNEL_VOLUME
+            { 2, true,  0 },                    // CMD_SET_EXPRESSION
+            { 4, true,  0 },                    // CMD_SET_REVERB
+            { 5, true,  0 },                    // CMD_SET_CHORUS
+            { 2, true,  0 },                    // CMD_SET_PAN
+            { 9, true,  0 },                    // CMD_SET_EQUALIZER
+            { 3, true,  0 },                    // CMD_SET_TUNING
+            { 4, true,  0 },                    // CMD_SET_VIBRATE
+            { 3, true,  0 },                    // CMD_SET_TVF
+            { 4, true,  0 },                    // CMD_SET_ENVELOPE
+            { 8, true,  0 },                    // CMD_SET_MOD_WHEEL
+            { 0, true,  M5UNITML_NO_CHANNEL },  // CMD_SET_ALL_DRUMS
+            { 0, true,  M5UNITML_NO_CHANNEL },  // CMD_RESET
+            { 4, false, M5UNITML_NO_CHANNEL },  // CMD_SET_TEMPO
+            { 0, false, M5UNITML_NO_CHANNEL },  // CMD_START_CLOCK
+            { 0, false, M5UNITML_NO_CHANNEL },  // CMD_STOP_CLOCK
+            { 1, false, M5UNITML_NO_CHANNEL },  // CMD_PRESET_STORE
+            { 1, true,  M5UNITML_NO_CHANNEL },  // CMD_PRESET_RECALL
+            { 6, true,  0 },                    // CMD_CHORD_ON
+            { 1, true,  0 },                    // CMD_CHORD_OFF
+            { 2, false, M5UNITML_NO_CHANNEL },  // CMD_SET_CHORD_TABLE
+            { 1, false, M5UNITML_NO_CHANNEL },  // CMD_QUEUE_EVENTS
+            { 0, true,  M5UNITML_NO_CHANNEL },  // CMD_QUEUE_START
+            { 0, false, M5UNITML_NO_CHANNEL },  // CMD_QUEUE_STOP
+            { 0, false, M5UNITML_NO_CHANNEL },  // CMD_GET_QUEUE_STATS
+            { 2, false, M5UNITML_NO_CHANNEL },  // CMD_SET_ROUTE
+            { 2, true,  0 },                    // CMD_SET_BALANCE
+            { 0, false, M5UNITML_NO_CHANNEL },  // CMD_GET_PROFILE
+            { 0, false, M5UNITML_NO_CHANNEL },  // CMD_GET_STATS
+            { 0, false, M5UNITML_NO_CHANNEL },  // CMD_GET_TRACE
+            { 0, false, M5UNITML_NO_CHANNEL },  // CMD_GET_MEMORY
+            { 1, false, M5UNITML_NO_CHANNEL },  // CMD_SET_POWER
+            { 0, false, M5UNITML_NO_CHANNEL },  // CMD_GET_POWER_STATS
+            { 6, false, M5UNITML_NO_CHANNEL },  // CMD_SET_NOTE_TIMEOUT
+            { 4, false, M5UNITML_NO_CHANNEL },  // CMD_SET_LINK_TIMEOUT
+            { 0, false, M5UNITML_NO_CHANNEL },  // CMD_GET_REAPER_STATS
+            { 1, false, M5UNITML_NO_CHANNEL },  // CMD_SET_JOURNAL
+            { 0, false, M5UNITML_NO_CHANNEL },  // CMD_GET_JOURNAL
+            { 1, false, M5UNITML_NO_CHANNEL },  // CMD_REPLAY_JOURNAL
+            { 1, false, M5UNITML_NO_CHANNEL },  // CMD_SET_MIDI_INPUT
+            { 0, false, M5UNITML_NO_CHANNEL },  // CMD_GET_MIDI_INPUT
+            { 1, false, M5UNITML_NO_CHANNEL },  // CMD_SET_NOTIFY
+            { 0, false, M5UNITML_NO_CHANNEL },  // CMD_GET_NOTIFY
+            { 3, false, M5UNITML_NO_CHANNEL },  // CMD_SET_TUNING_TABLE
+            { 2, false, M5UNITML_NO_CHANNEL },  // CMD_SET_CHANNEL_TUNING
+            { 3, false, M5UNITML_NO_CHANNEL },  // CMD_SET_MPE_ZONE
+            { 5, false, M5UNITML_NO_CHANNEL },  // CMD_SET_NOTE_EXPRESSION
+            { 10, false, M5UNITML_NO_CHANNEL }, // CMD_SET_GROOVE
+            { 4, false, M5UNITML_NO_CHANNEL },  // CMD_SET_QUIET
+        };
+        static const CommandSpec none = { 0, false, M5UNITML_NO_CHANNEL };
+        return (cmdID >= 1 && cmdID <= sizeof(specs) / sizeof(specs[0])) ? specs[cmdID - 1] : none;
+    }
+
+    // Count the outcome of one command. Rejections are attributed after the fact from the
+    // command's needs, so the handlers themselves stay unchanged.
+    void recordOutcome(byte cmdID, const byte* dataIn, unsigned int payloadSize, bool known, bool accepted) {
+        if (cmdID >= M5UNITML_STATS_OPCODES) {
+            unknownHighOpcodes++;
+            return;
+        }
+        OpcodeStats& stats = opcodeStats[cmdID];
+        if (!known) {
+            stats.unknown++;
+        } else if (accepted) {
+            stats.accepted++;
+        } else {
+            CommandSpec spec = commandSpec(cmdID);
+            if (payloadSize < spec.minPayload) {
+                stats.shortPayload++;
+                return;
+            }
+            bool routed = spec.channelByte == M5UNITML_NO_CHANNEL || dataIn[spec.channelByte] >= M5UNITML_CHANNELS ||
+                          units[routeUnit(dataIn[spec.channelByte])].synth != nullptr;
+            if (spec.needsUnit && (unitCount() == 0 || !routed)) {
+                stats.notInitialized++;
+            } else {
+                stats.invalid++;
+            }
+        }
+    }
+
+    void emitEvent(const ScheduledEvent& e) {
+        if (e.status == M5UNITML_MARKER_STATUS) {
+            notify(NOTIFY_MARKER, e.data1);
+            return;
+        }
+        uint8_t type = e.status & 0xF0;
+        if (type == MIDI_NOTE_ON) {
+            sendNoteOn(e.channel, e.data1, e.data2);
+        } else if (type == MIDI_NOTE_OFF) {
+            sendNoteOff(e.channel, e.data1, e.data2);
+        } else {
+            writeChannelMessage(e.channel, type, e.data1, e.data2);
+        }
+    }
+
+    // Play now the note-offs still waiting in the groove hold and the queue for notes that
+    // sound, so a queue stopped mid-phrase leaves no voice hanging. Note-offs whose note-on
+    // is itself still waiting are dropped with it.
+    void releaseQueuedNotes() {
+        uint32_t waiting[M5UNITML_CHANNELS][4];     // note-on still waiting, one bit per pitch
+        memset(waiting, 0, sizeof(waiting));
+        for (uint16_t i = 0; i < grooveHeldCount + eventCount; i++) {
+            const ScheduledEvent& e = (i < grooveHeldCount) ? grooveHeld[i].event :
+                                      eventQueue[(eventHead + i - grooveHeldCount) % M5UNITML_EVENT_QUEUE_SIZE];
+            uint8_t type = e.status & 0xF0;
+            uint8_t pitch = e.data1 & 0x7F;
+            if (e.channel >= M5UNITML_CHANNELS || (type != MIDI_NOTE_ON && type != MIDI_NOTE_OFF)) {
+                continue;
+            }
+            uint32_t& bits = waiting[e.channel][pitch >> 5];
+            uint32_t bit = 1ul << (pitch & 31);
+            if (type == MIDI_NOTE_ON && e.data2 > 0) {
+                bits |= bit;
+            } else if (bits & bit) {
+                bits &= ~bit;
+            } else if (pooled(e.channel) || activeNotes[e.channel][pitch] != 0) {
+                sendNoteOff(e.channel, pitch, 0);
+            }
+        }
+    }
+
+    void playScheduled(const ScheduledEvent& e, uint32_t due, uint32_t now) {
+        emitEvent(e);
+        recordLateness(now - due);
+        trace(TRACE_EVENT_EMITTED, e.status, (uint16_t)((now - due) < 0xFFFF ? (now - due) : 0xFFFF));
+    }
+
+    void serviceEventQueue() {
+        if (!queueRunning) {
+            return;
+        }
+        uint32_t now = micros();
+        uint32_t lookaheadUs = grooveLookahead();
+        bool played = false;
+        while (eventCount > 0) {
+            const ScheduledEvent& e = eventQueue[eventHead];
+            uint32_t due = queueEpochUs + e.timeMs * 1000u;
+            if ((int32_t)(now + lookaheadUs - due) < 0) {
+                break;
+            }
+            if (lookaheadUs > 0 || grooveHeldCount > 0) {
+                // Everything goes through the hold while grooving, so events stay in time order
+                if (grooveHeldCount >= M5UNITML_GROOVE_HOLD) {
+                    break;
+                }
+                holdGroovedEvent(e, due);
+            } else {
+                playScheduled(e, due, now);
+                played = true;
+            }
+            eventHead = (eventHead + 1) % M5UNITML_EVENT_QUEUE_SIZE;
+            eventCount--;
+        }
+        uint8_t released = 0;
+        while (released < grooveHeldCount && (int32_t)(now - grooveHeld[released].dueUs) >= 0) {
+            playScheduled(grooveHeld[released].event, grooveHeld[released].dueUs, now);
+            released++;
+        }
+        if (released > 0) {
+            grooveHeldCount -= released;
+            memmove(&grooveHeld[0], &grooveHeld[released], grooveHeldCount * sizeof(GroovedEvent));
+        }
+        if (eventCount == 0 && grooveHeldCount == 0 && (played || released > 0)) {
+            queueStats.drains++;
+            notify(NOTIFY_QUEUE_DRAINED, 0);
+            trace(TRACE_QUEUE_DRAINED, 0, 0);
+        }
+    }
+
+    // Largest pull earlier any grooved channel can give an event, 0 when none is grooved
+    uint32_t grooveLookahead() const {
+        uint32_t lookaheadUs = 0;
+        for (uint8_t c = 0; groovedChannels != 0 && c < M5UNITML_CHANNELS; c++) {
+            if (groovedChannels & (1ul << c)) {
+                const Groove& g = grooves[c];
+                uint32_t pullUs = (uint32_t)((uint64_t)g.gridTicks * tickPeriod * g.strength / 2000u) + g.humanizeMs * 1000u;
+                if (pullUs > lookaheadUs) {
+                    lookaheadUs = pullUs;
+                }
+            }
+        }
+        return lookaheadUs;
+    }
+
+    void holdGroovedEvent(const ScheduledEvent& e, uint32_t due) {
+        GroovedEvent held;
+        held.event = e;
+        held.dueUs = (e.channel < M5UNITML_CHANNELS && (groovedChannels & (1ul << e.channel))) ? grooveEvent(held.event, due) : due;
+        uint8_t i = grooveHeldCount;
+        while (i > 0 && (int32_t)(held.dueUs - grooveHeld[i - 1].dueUs) < 0) {
+            grooveHeld[i] = grooveHeld[i - 1];
+            i--;
+        }
+        grooveHeld[i] = held;
+        grooveHeldCount++;
+    }
+
+    static uint32_t xorshift(uint32_t& state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    // Uniform in -range..range
+    static int32_t grooveRandom(Groove& g, uint32_t range) {
+        return (int32_t)(xorshift(g.random) % (2 * range + 1)) - (int32_t)range;
+    }
+
+    static int64_t floorDivide(int64_t a, int64_t b) {
+        return (a >= 0) ? a / b : -((-a + b - 1) / b);
+    }
+
+    // Time an event of a grooved channel plays at: note-ons are pulled toward the grid (at the
+    // current tempo, in step with the clock while it runs), swung and humanized; note-offs
+    // move with their note-on so note lengths survive, and never ahead of it; other messages
+    // keep their time. A note-on is not moved when every shift is still waiting for its note-off.
+    uint32_t grooveEvent(ScheduledEvent& e, uint32_t dueUs) {
+        Groove& g = grooves[e.channel];
+        uint8_t type = e.status & 0xF0;
+        if (type == MIDI_NOTE_OFF || (type == MIDI_NOTE_ON && e.data2 == 0)) {
+            // Repeats of a pitch end in the order they started
+            for (uint8_t i = 0; i < grooveShiftCount; i++) {
+                const GrooveShift& shift = grooveShifts[i];
+                if (shift.pitch == (e.data1 & 0x7F) && shift.channel == e.channel) {
+                    uint32_t offUs = dueUs + (uint32_t)shift.shiftUs;
+                    if ((int32_t)(offUs - shift.noteOnUs) < 0) {
+                        offUs = shift.noteOnUs;
+                    }
+                    grooveShiftCount--;
+                    memmove(&grooveShifts[i], &grooveShifts[i + 1], (grooveShiftCount - i) * sizeof(GrooveShift));
+                    return offUs;
+                }
+            }
+            return dueUs;
+        }
+        if (type != MIDI_NOTE_ON) {
+            return dueUs;
+        }
+        if (grooveShiftCount >= M5UNITML_GROOVE_SHIFTS) {
+            return dueUs;
+        }
+        int32_t shiftUs = 0;
+        if (g.gridTicks > 0) {
+            // Positions in 1/10 us from the anchor; the anchor's offset within two grid steps
+            // keeps odd and even steps in line with the clock
+            bool clocked = clockRunning;
+            uint32_t anchorUs = clocked ? grooveTickUs : queueEpochUs;
+            int64_t stepPeriod = (int64_t)g.gridTicks * tickPeriod;
+            int64_t anchorOffset = (int64_t)((clocked ? grooveTick : 0) % (2u * g.gridTicks)) * tickPeriod;
+            int64_t position = (int64_t)(int32_t)(dueUs - anchorUs) * 10 + anchorOffset;
+            int64_t step = floorDivide(position + stepPeriod / 2, stepPeriod);
+            shiftUs = (int32_t)((step * stepPeriod - position) * g.strength / 1000);
+            if ((step & 1) && g.swing > 50) {
+                shiftUs += (int32_t)(stepPeriod * (g.swing - 50) / 500);
+            }
+        }
+        if (g.humanizeMs > 0) {
+            shiftUs += grooveRandom(g, g.humanizeMs * 1000u);
+        }
+        if (g.humanizeVelocity > 0) {
+            int32_t velocity = e.data2 + grooveRandom(g, g.humanizeVelocity);
+            e.data2 = (uint8_t)(velocity < 1 ? 1 : (velocity > 127 ? 127 : velocity));
+        }
+        GrooveShift& shift = grooveShifts[grooveShiftCount++];
+        shift.shiftUs = shiftUs;
+        shift.noteOnUs = dueUs + (uint32_t)shiftUs;
+        shift.channel = e.channel;
+        shift.pitch = e.data1 & 0x7F;
+        return shift.noteOnUs;
+    }
+
+    // Clock subscriber anchoring the groove grid
+    void grooveOnTick(uint32_t tick) {
+        grooveTickUs = micros();
+        grooveTick = tick;
+    }
+
+    void resetGroove() {
+        grooveHeldCount = 0;
+        grooveShiftCount = 0;
+        for (uint8_t c = 0; c < M5UNITML_CHANNELS; c++) {
+            grooves[c].random = randomState(grooves[c].seed);
+        }
+    }
+
+    // xorshift must not start from 0
+    static uint32_t randomState(uint32_t seed) {
+        return (seed != 0x9E3779B9u) ? (seed ^ 0x9E3779B9u) : 1;
+    }
+
+    static uint32_t periodForTempo(uint32_t milliBpm) {
+        // 60 s / (BPM * 24) expressed in 1/10 us: 25e9 / (1/1000 BPM)
+        return (uint32_t)(25000000000ULL / milliBpm);
+    }
+
+    // Hardware UART driving each unit; UART0 stays with the MATLAB link
+    CountingSerial* unitUart(uint8_t unit) {
+        return (unit == 0) ? &unit0Uart : &unit1Uart;
+    }
+
+    uint8_t unitCount() const {
+        uint8_t count = 0;
+        for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+            if (units[u].synth != nullptr) {
+                count++;
+            }
+        }
+        return count;
+    }
+
+    // Map a logical channel to its unit and the MIDI channel on that unit.
+    // Returns nullptr when the channel is out of range or its unit has not been started.
+    M5UnitSynth* routeChannel(uint8_t logical, uint8_t& channel) const {
+        if (logical >= M5UNITML_CHANNELS) {
+            return nullptr;
+        }
+        uint8_t route = channelRoutes[logical];
+        channel = route & 0x0F;
+        return units[route >> 4].synth;
+    }
+
+    uint8_t routeUnit(uint8_t logical) const {
+        return channelRoutes[logical] >> 4;
+    }
+
+    // Units that channel-wide messages for a logical channel must reach: its routed unit,
+    // or every started unit when the channel is balanced. Returns a bitmask of units.
+    uint8_t channelTargets(uint8_t logical, uint8_t& channel) const {
+        if (routeChannel(logical, channel) == nullptr) {
+            return 0;
+        }
+        if (!(balancedChannels & (1ul << logical))) {
+            return (uint8_t)(1u << routeUnit(logical));
+        }
+        uint8_t targets = 0;
+        for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+            if (units[u].synth != nullptr) {
+                targets |= (uint8_t)(1u << u);
+            }
+        }
+        return targets;
+    }
+
+    void clearActiveNotes() {
+        memset(activeNotes, 0, sizeof(activeNotes));
+        memset(unitVoices, 0, sizeof(unitVoices));
+        noteAgeCount = 0;
+        poolNoteCount = 0;
+    }
+
+    int findNoteAge(uint8_t logical, uint8_t pitch) const {
+        for (uint8_t i = 0; i < noteAgeCount; i++) {
+            if (noteAges[i].logical == logical && noteAges[i].pitch == pitch) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    // Unit a note-on should play on: the unit already sounding that pitch (retrigger), the
+    // routed unit, or for balanced channels the started unit with the fewest sounding notes
+    uint8_t selectNoteUnit(uint8_t logical, uint8_t pitch) const {
+        if (activeNotes[logical][pitch] != 0) {
+            return activeNotes[logical][pitch] - 1;
+        }
+        uint8_t best = routeUnit(logical);
+        if (balancedChannels & (1ul << logical)) {
+            for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+                if (units[u].synth != nullptr && unitVoices[u] < unitVoices[best]) {
+                    best = u;
+                }
+            }
+        }
+        return best;
+    }
+
+    void markNoteOn(uint8_t logical, uint8_t pitch, uint8_t unit) {
+        if (activeNotes[logical][pitch] == 0) {
+            activeNotes[logical][pitch] = unit + 1;
+            unitVoices[unit]++;
+            if (unitVoices[unit] > M5UNITML_UNIT_VOICES) {
+                notify(NOTIFY_VOICE_STOLEN, unit);
+            }
+            if (noteAgeCount < M5UNITML_REAPER_NOTES) {
+                NoteAge& age = noteAges[noteAgeCount++];
+                age.startMs = millis();
+                age.logical = logical;
+                age.pitch = pitch;
+            } else {
+                untrackedNotes++;
+            }
+        } else {
+            // A retrigger restarts the note, and its age with it
+            int i = findNoteAge(logical, pitch);
+            if (i >= 0) {
+                noteAges[i].startMs = millis();
+            }
+        }
+    }
+
+    // Returns the unit the note was sounding on, or the routed unit if it was not sounding
+    uint8_t markNoteOff(uint8_t logical, uint8_t pitch) {
+        uint8_t active = activeNotes[logical][pitch];
+        if (active == 0) {
+            return routeUnit(logical);
+        }
+        activeNotes[logical][pitch] = 0;
+        unitVoices[active - 1]--;
+        int i = findNoteAge(logical, pitch);
+        if (i >= 0) {
+            noteAges[i] = noteAges[--noteAgeCount];
+        }
+        return active - 1;
+    }
+
+    // All Notes Off on every channel of every unit, and forget held chords
+    void releaseAllNotes() {
+        for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+            if (units[u].synth != nullptr) {
+                for (uint8_t channel = 0; channel < M5UNITML_UNIT_CHANNELS; channel++) {
+                    M5UNITML_TIMED_UART(units[u].synth->setAllNotesOff(channel));
+                }
+            }
+        }
+        clearActiveNotes();
+        memset(heldChordSizes, 0, sizeof(heldChordSizes));
+    }
+
+    // Release notes past their channel's timeout, and everything once the host link has been
+    // silent for linkTimeoutMs with nothing left in the queue to end the notes on its own
+    void serviceReaper() {
+        uint32_t nowMs = millis();
+        if (nowMs - reaperLastScanMs < M5UNITML_REAPER_SCAN_MS) {
+            return;
+        }
+        reaperLastScanMs = nowMs;
+        // Notes played from the MIDI input are the keyboard's to release
+        if (linkTimeoutMs > 0 && !linkReleased && (!queueRunning || (eventCount == 0 && grooveHeldCount == 0)) && midiInput == nullptr &&
+            micros() - lastCommandUs >= linkTimeoutMs * 1000u) {
+            linkReleased = true;
+            uint16_t voices = 0;
+            for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+                voices += unitVoices[u];
+            }
+            if (voices > 0) {
+                releaseAllNotes();
+                linkReleases++;
+                notify(NOTIFY_LINK_RELEASE, 0);
+            }
+        }
+        uint8_t i = 0;
+        while (i < noteAgeCount) {
+            NoteAge age = noteAges[i];
+            uint32_t timeout = noteTimeoutMs[age.logical];
+            if (timeout == 0 || nowMs - age.startMs < timeout) {
+                i++;
+                continue;
+            }
+            reapedNotes++;
+            notify(NOTIFY_NOTE_REAPED, age.logical);
+            playNoteOff(age.logical, age.pitch, 0);
+            if (i < noteAgeCount && noteAges[i].logical == age.logical && noteAges[i].pitch == age.pitch) {
+                // Not routed any more, so playNoteOff could not clear it
+                markNoteOff(age.logical, age.pitch);
+            }
+        }
+    }
+
+    // Feed one received byte to the parser; returns true when it completed a channel message
+    bool parseMidiByte(uint8_t value) {
+        MidiParser& p = midiParser;
+        if (value >= MIDI_REALTIME_FIRST) {
+            midiInputSkipped++;
+            return false;
+        }
+        if (value >= MIDI_SYSEX_START) {
+            // System messages cancel running status; their data bytes are dropped below
+            p.status = 0;
+            midiInputSkipped++;
+            return false;
+        }
+        if (value & 0x80) {
+            p.status = value;
+            p.count = 0;
+            return false;
+        }
+        if (p.status == 0) {
+            midiInputSkipped++;
+            return false;
+        }
+        p.data[p.count++] = value;
+        uint8_t type = p.status & 0xF0;
+        uint8_t needed = (type == MIDI_PROGRAM_CHANGE || type == MIDI_CHANNEL_PRESSURE) ? 1 : 2;
+        if (p.count < needed) {
+            return false;
+        }
+        if (needed == 1) {
+            p.data[1] = 0;
+        }
+        p.count = 0;
+        return true;
+    }
+
+    // Play everything the input UART received since the last pass
+    void serviceMidiInput() {
+        if (midiInput == nullptr) {
+            return;
+        }
+        while (midiInput->available() > 0) {
+            if (!parseMidiByte((uint8_t)midiInput->read())) {
+                continue;
+            }
+            ScheduledEvent e;
+            e.timeMs = millis();
+            e.status = midiParser.status;
+            e.data1 = midiParser.data[0];
+            e.data2 = midiParser.data[1];
+            e.channel = (midiInputChannel == MIDI_IN_KEEP_CHANNEL) ? (midiParser.status & 0x0F) : midiInputChannel;
+            emitEvent(e);
+            midiInputMessages++;
+            trace(TRACE_MIDI_INPUT, e.status, (uint16_t)((e.data1 << 8) | e.data2));
+            if (!midiInputMirror) {
+                continue;
+            }
+            if (midiMirrorCount < M5UNITML_MIDI_IN_MIRROR) {
+                midiMirror[(midiMirrorHead + midiMirrorCount) % M5UNITML_MIDI_IN_MIRROR] = e;
+                midiMirrorCount++;
+                notify(NOTIFY_MIDI_INPUT, 0);
+            } else {
+                midiMirrorDropped++;
+            }
+        }
+    }
+
+    void clearChannelNotes(uint8_t logical) {
+        for (uint8_t pitch = 0; pitch < 128; pitch++) {
+            if (activeNotes[logical][pitch] != 0) {
+                markNoteOff(logical, pitch);
+            }
+        }
+    }
+
+    bool pooled(uint8_t logical) const {
+        return logical < M5UNITML_CHANNELS &&
+               (channelTuning[logical].table != M5UNITML_NO_TUNING || (channelTuning[logical].flags & POOL_MPE));
+    }
+
+    // Note-ons and note-offs from commands, the queue and the MIDI input; keys on tuned
+    // channels and MPE zones are played on their pool channels
+    void sendNoteOn(uint8_t logical, uint8_t pitch, uint8_t velocity) {
+        pitch &= 0x7F;
+        if (velocity == 0) {
+            sendNoteOff(logical, pitch, 0);
+        } else if (pooled(logical)) {
+            poolNoteOn(logical, pitch, velocity);
+        } else {
+            playNoteOn(logical, pitch, velocity);
+        }
+    }
+
+    void sendNoteOff(uint8_t logical, uint8_t pitch, uint8_t velocity) {
+        pitch &= 0x7F;
+        if (!pooled(logical) || !poolNoteOff(logical, pitch, velocity)) {
+            playNoteOff(logical, pitch, velocity);
+        }
+    }
+
+    // Every note written to a unit goes through these two so voice tracking stays exact
+    void playNoteOn(uint8_t logical, uint8_t pitch, uint8_t velocity) {
+        uint8_t channel;
+        if (routeChannel(logical, channel) == nullptr) {
+            return;
+        }
+        uint8_t u = selectNoteUnit(logical, pitch);
+        M5UNITML_TIMED_UART(units[u].synth->setNoteOn(channel, pitch, velocity));
+        markNoteOn(logical, pitch, u);
+    }
+
+    void playNoteOff(uint8_t logical, uint8_t pitch, uint8_t velocity) {
+        uint8_t channel;
+        if (routeChannel(logical, channel) == nullptr) {
+            return;
+        }
+        uint8_t u = markNoteOff(logical, pitch);
+        if (units[u].synth != nullptr) {
+            M5UNITML_TIMED_UART(units[u].synth->setNoteOff(channel, pitch, velocity));
+        }
+    }
+
+    void writePitchBend(uint8_t logical, int16_t value) {
+        uint8_t channel = 0;
+        uint8_t targets = channelTargets(logical, channel);
+        for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+            if (targets & (1u << u)) {
+                M5UNITML_TIMED_UART(units[u].synth->setPitchBend(channel, value));
+            }
+        }
+        channelBend[logical] = value;
+    }
+
+    uint8_t bendRange(uint8_t logical) const {
+        const ChannelState& ch = state.channels[logical];
+        return (ch.valid & (1u << STATE_BEND_RANGE)) ? ch.params[stateGroupOffset(STATE_BEND_RANGE)] : M5UNITML_DEFAULT_BEND_RANGE;
+    }
+
+    // Pitch bend raising a channel's notes by offset (1/100 cent), rounded to nearest
+    int16_t bendForOffset(uint8_t logical, int16_t offset) const {
+        int32_t range = bendRange(logical) * 10000;
+        if (range == 0) {
+            return 0;
+        }
+        int32_t bend = ((int32_t)offset * 8192 + (offset >= 0 ? range / 2 : -range / 2)) / range;
+        return (int16_t)(bend < -8192 ? -8192 : (bend > 8191 ? 8191 : bend));
+    }
+
+    bool poolChannelBusy(uint8_t logical) const {
+        for (uint8_t i = 0; i < poolNoteCount; i++) {
+            if (poolNotes[i].logical == logical && activeNotes[logical][poolNotes[i].note] != 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Pool channel for a note needing offset: one already bent that far (not in MPE zones),
+    // else the least recently used idle one, else the least recently used one
+    uint8_t selectPoolChannel(const ChannelTuning& t, int16_t offset) const {
+        uint8_t idle = M5UNITML_NO_CHANNEL;
+        uint8_t oldest = t.poolFirst;
+        for (uint8_t c = t.poolFirst; c < t.poolFirst + t.poolCount; c++) {
+            if (!(t.flags & POOL_MPE) && channelBend[c] == bendForOffset(c, offset)) {
+                return c;
+            }
+            if (poolLastUse[c] < poolLastUse[oldest]) {
+                oldest = c;
+            }
+            if ((idle == M5UNITML_NO_CHANNEL || poolLastUse[c] < poolLastUse[idle]) && !poolChannelBusy(c)) {
+                idle = c;
+            }
+        }
+        return (idle != M5UNITML_NO_CHANNEL) ? idle : oldest;
+    }
+
+    void removePoolNote(uint8_t i) {
+        memmove(&poolNotes[i], &poolNotes[i + 1], (poolNoteCount - i - 1) * sizeof(PoolNote));
+        poolNoteCount--;
+    }
+
+    // Nearest note and offset a key of a pooled channel plays; false when it is unmapped
+    bool poolKeyPitch(const ChannelTuning& t, uint8_t key, uint8_t& note, int16_t& offset) const {
+        note = key;
+        offset = 0;
+        if (t.table != M5UNITML_NO_TUNING) {
+            note = tuningTables[t.table].notes[key];
+            offset = tuningTables[t.table].offsets[key];
+        }
+        return note != TUNING_UNMAPPED;
+    }
+
+    void poolNoteOn(uint8_t source, uint8_t key, uint8_t velocity) {
+        const ChannelTuning& t = channelTuning[source];
+        uint8_t note;
+        int16_t offset;
+        if (!poolKeyPitch(t, key, note, offset)) {
+            return;
+        }
+        // A retriggered key releases its previous voice, which may sit on another channel
+        poolNoteOff(source, key, 0);
+        if (poolNoteCount >= M5UNITML_POOL_NOTES) {
+            // Forget notes the reaper released, then make room by releasing the oldest
+            for (uint8_t i = poolNoteCount; i > 0; i--) {
+                if (activeNotes[poolNotes[i - 1].logical][poolNotes[i - 1].note] == 0) {
+                    removePoolNote(i - 1);
+                }
+            }
+            if (poolNoteCount >= M5UNITML_POOL_NOTES) {
+                playNoteOff(poolNotes[0].logical, poolNotes[0].note, 0);
+                removePoolNote(0);
+            }
+        }
+        uint8_t logical = selectPoolChannel(t, offset);
+        if (t.flags & POOL_MPE) {
+            // A member plays one note: steal it from the oldest note when all are busy, and
+            // undo the previous note's expression
+            releaseChannelPoolNotes(logical);
+            if (pressedChannels & (1ul << logical)) {
+                const ChannelState& master = state.channels[source];
+                uint8_t expression = (master.valid & (1u << STATE_EXPRESSION)) ? master.params[stateGroupOffset(STATE_EXPRESSION)] : 127;
+                applyRoutedState(logical, STATE_EXPRESSION, &expression);
+                pressedChannels &= ~(1ul << logical);
+            }
+        }
+        int16_t bend = bendForOffset(logical, offset);
+        if (channelBend[logical] != bend) {
+            writePitchBend(logical, bend);
+        }
+        poolLastUse[logical] = ++poolUses;
+        playNoteOn(logical, note, velocity);
+        PoolNote& n = poolNotes[poolNoteCount++];
+        n.source = source;
+        n.key = key;
+        n.logical = logical;
+        n.note = note;
+    }
+
+    PoolNote* findPoolNote(uint8_t source, uint8_t key) {
+        for (uint8_t i = 0; i < poolNoteCount; i++) {
+            if (poolNotes[i].source == source && poolNotes[i].key == key) {
+                return &poolNotes[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // Returns false when the key is not held on the pooled channel
+    bool poolNoteOff(uint8_t source, uint8_t key, uint8_t velocity) {
+        PoolNote* n = findPoolNote(source, key);
+        if (n == nullptr) {
+            return false;
+        }
+        playNoteOff(n->logical, n->note, velocity);
+        removePoolNote((uint8_t)(n - poolNotes));
+        return true;
+    }
+
+    void releaseChannelPoolNotes(uint8_t logical) {
+        for (uint8_t i = poolNoteCount; i > 0; i--) {
+            if (poolNotes[i - 1].logical == logical) {
+                playNoteOff(logical, poolNotes[i - 1].note, 0);
+                removePoolNote(i - 1);
+            }
+        }
+    }
+
+    void releasePoolNotes(uint8_t source) {
+        for (uint8_t i = poolNoteCount; i > 0; i--) {
+            if (poolNotes[i - 1].source == source) {
+                poolNoteOff(source, poolNotes[i - 1].key, 0);
+            }
+        }
+    }
+
+    // Write a channel message to every unit the logical channel plays on
+    void writeChannelMessage(uint8_t logical, uint8_t type, uint8_t data1, uint8_t data2) {
+        uint8_t channel = 0;
+        uint8_t targets = channelTargets(logical, channel);
+        uint8_t message[3] = { (uint8_t)(type | channel), data1, data2 };
+        uint8_t length = (type == MIDI_PROGRAM_CHANGE || type == MIDI_CHANNEL_PRESSURE) ? 2 : 3;
+        if (type == MIDI_PITCH_BEND && logical < M5UNITML_CHANNELS) {
+            channelBend[logical] = (int16_t)((data1 | (data2 << 7)) - 8192);
+        }
+        for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+            if (targets & (1u << u)) {
+                writeMidi(u, message, length);
+            }
+        }
+    }
+
+    // Real-time bytes such as MIDI clock go to every unit
+    void broadcastMidiByte(uint8_t value) {
+        for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+            if (units[u].serial != nullptr) {
+                M5UNITML_TIMED_UART(units[u].serial->write(value));
+            }
+        }
+    }
+
+    void writeMidi(uint8_t unit, const uint8_t* data, size_t length) {
+        if (units[unit].serial != nullptr && length > 0) {
+            M5UNITML_TIMED_UART(units[unit].serial->write(data, length));
+        }
+    }
+
+    // Expand a chord into absolute MIDI notes; returns the number of notes in range.
+    // inversion moves the lowest note up an octave that many times, spread raises every
+    // second note of the voicing by that many octaves (open voicing).
+    uint8_t expandChord(uint8_t root, uint8_t quality, uint8_t inversion, uint8_t spread, uint8_t* notes) {
+        static const uint8_t builtinSizes[CHORD_BUILTIN_COUNT] = { 3, 3, 4, 4, 4, 3, 3, 3, 3 };
+        static const uint8_t builtinIntervals[CHORD_BUILTIN_COUNT][4] = {
+            { 0, 4, 7, 0 },  { 0, 3, 7, 0 },  { 0, 4, 7, 10 }, { 0, 4, 7, 11 }, { 0, 3, 7, 10 },
+            { 0, 2, 7, 0 },  { 0, 5, 7, 0 },  { 0, 3, 6, 0 },  { 0, 4, 8, 0 }
+        };
+
+        const uint8_t* intervals;
+        uint8_t size;
+        if (quality < CHORD_BUILTIN_COUNT) {
+            intervals = builtinIntervals[quality];
+            size = builtinSizes[quality];
+        } else if (quality >= CHORD_USER_FIRST && quality < CHORD_USER_FIRST + M5UNITML_USER_CHORDS) {
+            intervals = userChordIntervals[quality - CHORD_USER_FIRST];
+            size = userChordSizes[quality - CHORD_USER_FIRST];
+        } else {
+            return 0;
+        }
+
+        int16_t voicing[M5UNITML_MAX_CHORD_NOTES];
+        for (uint8_t i = 0; i < size; i++) {
+            voicing[i] = (int16_t)root + intervals[i];
+        }
+        for (uint8_t n = 0; n < inversion && size > 0; n++) {
+            int16_t lowest = voicing[0];
+            for (uint8_t i = 1; i < size; i++) {
+                voicing[i - 1] = voicing[i];
+            }
+            voicing[size - 1] = lowest + 12;
+        }
+
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < size; i++) {
+            int16_t note = voicing[i] + ((i & 1) ? 12 * spread : 0);
+            if (note >= 0 && note <= 127) {
+                notes[count++] = (uint8_t)note;
+            }
+        }
+        return count;
+    }
+
+    // Send note messages for a chord in a single UART write using running status
+    void writeChord(uint8_t type, uint8_t logical, const uint8_t* notes, uint8_t count, uint8_t velocity) {
+        uint8_t channel;
+        if (routeChannel(logical, channel) == nullptr) {
+            return;
+        }
+        if (pooled(logical)) {
+            // Tuned notes are bent one by one on their pool channels
+            for (uint8_t i = 0; i < count; i++) {
+                if (type == MIDI_NOTE_ON) {
+                    sendNoteOn(logical, notes[i], velocity);
+                } else {
+                    sendNoteOff(logical, notes[i], velocity);
+                }
+            }
+            return;
+        }
+        // One burst per unit; on balanced channels the notes may be spread over units
+        uint8_t noteUnits[M5UNITML_MAX_CHORD_NOTES];
+        for (uint8_t i = 0; i < count; i++) {
+            if (type == MIDI_NOTE_ON) {
+                noteUnits[i] = selectNoteUnit(logical, notes[i]);
+                markNoteOn(logical, notes[i], noteUnits[i]);
+            } else {
+                noteUnits[i] = markNoteOff(logical, notes[i]);
+            }
+        }
+        for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+            uint8_t burst[1 + 2 * M5UNITML_MAX_CHORD_NOTES];
+            uint8_t length = 0;
+            burst[length++] = (uint8_t)(type | channel);
+            for (uint8_t i = 0; i < count; i++) {
+                if (noteUnits[i] == u) {
+                    burst[length++] = notes[i];
+                    burst[length++] = velocity;
+                }
+            }
+            if (length > 1) {
+                writeMidi(u, burst, length);
+            }
+        }
+    }
+
+    void releaseHeldChord(uint8_t channel) {
+        writeChord(MIDI_NOTE_OFF, channel, heldChordNotes[channel], heldChordSizes[channel], 0);
+        heldChordSizes[channel] = 0;
+    }
+
+    void applyTickPeriod() {
+        tickPeriod = periodForTempo(tempo);
+#if defined(ARDUINO_ARCH_ESP32)
+        if (tempoTimer != nullptr) {
+            timerAlarmWrite(tempoTimer, tickPeriod, true);
+        }
+#endif
+    }
+
+    // Follows the ramp on wall time at every loop() pass, whether or not the clock runs, so
+    // the groove grid and a clock started later see the ramped tempo
+    void updateTempoRamp() {
+        if (rampDurationMs == 0) {
+            return;
+        }
+        uint32_t elapsed = millis() - rampStartMs;
+        if (elapsed >= rampDurationMs) {
+            tempo = rampTargetTempo;
+            rampDurationMs = 0;
+        } else {
+            int64_t delta = (int64_t)rampTargetTempo - (int64_t)rampStartTempo;
+            tempo = (uint32_t)((int64_t)rampStartTempo + delta * (int64_t)elapsed / (int64_t)rampDurationMs);
+        }
+        if (periodForTempo(tempo) != tickPeriod) {
+            applyTickPeriod();
+        }
+    }
+
+    void startTempoTimer() {
+        m5unitmlPendingTicks = 0;
+#if defined(ARDUINO_ARCH_ESP32)
+        if (tempoTimer == nullptr) {
+            // 80 MHz APB clock / 8 = 10 MHz, i.e. one timer count per 1/10 us
+            tempoTimer = timerBegin(0, 8, true);
+            timerAttachInterrupt(tempoTimer, &m5unitmlOnTempoTimer, true);
+        }
+        timerAlarmWrite(tempoTimer, tickPeriod, true);
+        timerWrite(tempoTimer, 0);
+        timerAlarmEnable(tempoTimer);
+#else
+        lastClockPollUs = micros();
+        tickPhase = 0;
+#endif
+    }
+
+    void stopTempoTimer() {
+#if defined(ARDUINO_ARCH_ESP32)
+        if (tempoTimer != nullptr) {
+            timerAlarmDisable(tempoTimer);
+        }
+#endif
+        m5unitmlPendingTicks = 0;
+    }
+
+    void serviceClock() {
+        if (!clockRunning) {
+            return;
+        }
+#if !defined(ARDUINO_ARCH_ESP32)
+        // Without a hardware timer, derive ticks from micros() at every loop() pass
+        uint32_t now = micros();
+        tickPhase += (now - lastClockPollUs) * 10;
+        lastClockPollUs = now;
+        while (tickPhase >= tickPeriod) {
+            tickPhase -= tickPeriod;
+            m5unitmlPendingTicks++;
+        }
+#endif
+        while (m5unitmlPendingTicks > 0) {
+            noInterrupts();
+            m5unitmlPendingTicks--;
+            interrupts();
+
+            if (clockFlags & CLOCK_FLAG_SEND_MIDI) {
+                broadcastMidiByte(MIDI_CLOCK);
+            }
+            clockTicks++;
+            for (uint8_t i = 0; i < tickHandlerCount; i++) {
+                (this->*tickHandlers[i])(clockTicks);
+            }
+        }
+    }
+
+public:
+    // Constructor
+    M5UnitML(MWArduinoClass& a) : LibraryBase(), unit0Uart(2), unit1Uart(1), arduino(a) {
+        libName = "M5Stack/M5UnitSynth";
+        for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+            units[u].synth = nullptr;
+            units[u].serial = nullptr;
+        }
+        for (uint8_t channel = 0; channel < M5UNITML_CHANNELS; channel++) {
+            channelRoutes[channel] = channel;   // logical channel n -> unit n / 16, channel n % 16
+        }
+        balancedChannels = 0;
+        clearActiveNotes();
+        tempo = M5UNITML_DEFAULT_TEMPO;
+        rampStartTempo = tempo;
+        rampTargetTempo = tempo;
+        rampStartMs = 0;
+        rampDurationMs = 0;
+        tickPeriod = periodForTempo(tempo);
+        clockTicks = 0;
+        clockFlags = 0;
+        clockRunning = false;
+        tickHandlerCount = 0;
+        memset(grooves, 0, sizeof(grooves));
+        groovedChannels = 0;
+        grooveTickUs = 0;
+        grooveTick = 0;
+        resetGroove();
+        subscribeTick(&M5UnitML::grooveOnTick);
+        clearState();
+        memset(userChordIntervals, 0, sizeof(userChordIntervals));
+        memset(userChordSizes, 0, sizeof(userChordSizes));
+        memset(heldChordSizes, 0, sizeof(heldChordSizes));
+        eventHead = 0;
+        eventCount = 0;
+        queueEpochUs = 0;
+        queueRunning = false;
+        memset(&queueStats, 0, sizeof(queueStats));
+#if M5UNITML_PROFILE
+        clearProfile();
+#endif
+        clearStats();
+        traceCount = 0;
+        powerMode = POWER_MODE_OFF;
+        powerState = POWER_AWAKE;
+        maxWakeLatencyMs = 100;
+        powerIdleMs = 1000;
+        lastCommandUs = 0;
+        powerStateSinceUs = 0;
+        memset(powerStateUs, 0, sizeof(powerStateUs));
+        sleepCount = 0;
+        quiet = false;
+        quietUntilUs = 0;
+        quietWindows = 0;
+        memset(noteTimeoutMs, 0, sizeof(noteTimeoutMs));
+        linkTimeoutMs = 0;
+        linkReleased = false;
+        reaperLastScanMs = 0;
+        untrackedNotes = 0;
+        reapedNotes = 0;
+        linkReleases = 0;
+        journalCount = 0;
+        journalRecording = false;
+        replaying = false;
+        replayDispatch = false;
+        replayNext = 0;
+        replayEnd = 0;
+        replayBaseUs = 0;
+        replayStartUs = 0;
+        midiInput = nullptr;
+        memset(&midiParser, 0, sizeof(midiParser));
+        midiInputChannel = MIDI_IN_KEEP_CHANNEL;
+        midiInputMirror = false;
+        midiMirrorHead = 0;
+        midiMirrorCount = 0;
+        midiInputMessages = 0;
+        midiInputSkipped = 0;
+        midiMirrorDropped = 0;
+        notifyHead = 0;
+        notifyCount = 0;
+        notifyMask = NOTIFY_ALL;
+        notifyPiggyback = false;
+        notifyLost = 0;
+        for (uint8_t t = 0; t < M5UNITML_TUNING_TABLES; t++) {
+            for (uint8_t key = 0; key < 128; key++) {
+                tuningTables[t].notes[key] = key;
+                tuningTables[t].offsets[key] = 0;
+            }
+        }
+        for (uint8_t i = 0; i < M5UNITML_CHANNELS; i++) {
+            channelTuning[i].table = M5UNITML_NO_TUNING;
+            channelTuning[i].poolFirst = i;
+            channelTuning[i].poolCount = 1;
+            channelTuning[i].flags = 0;
+        }
+        pressedChannels = 0;
+        memset(channelBend, 0, sizeof(channelBend));
+        memset(poolLastUse, 0, sizeof(poolLastUse));
+        poolUses = 0;
+#if defined(ARDUINO_ARCH_ESP32)
+        tempoTimer = nullptr;
+#else
+        lastClockPollUs = 0;
+        tickPhase = 0;
+#endif
+        a.registerLibrary(this);
+    }
+
+    // Destructor
+    ~M5UnitML() {
+#if defined(ARDUINO_ARCH_ESP32)
+        if (tempoTimer != nullptr) {
+            timerAlarmDisable(tempoTimer);
+            timerDetachInterrupt(tempoTimer);
+            timerEnd(tempoTimer);
+        }
+#endif
+        for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+            if (units[u].synth != nullptr) {
+                delete units[u].synth;
+            }
+        }
+    }
+
+    // Account the time spent in the current power state, then switch to the next one
+    void setPowerState(uint8_t next) {
+        uint32_t now = micros();
+        powerStateUs[powerState] += now - powerStateSinceUs;
+        powerStateSinceUs = now;
+        if (next == powerState) {
+            return;
+        }
+#if defined(ARDUINO_ARCH_ESP32)
+        if (next == POWER_AWAKE) {
+            setCpuFrequencyMhz(M5UNITML_CPU_MHZ_FULL);
+        } else if (powerState == POWER_AWAKE) {
+            setCpuFrequencyMhz(M5UNITML_CPU_MHZ_IDLE);
+        }
+#endif
+        powerState = next;
+    }
+
+#if defined(ARDUINO_ARCH_ESP32)
+    // Light sleep for us microseconds, woken by the timer only. Bytes still in the unit UARTs
+    // are sent first.
+    void lightSleep(uint32_t us) {
+        for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+            if (units[u].serial != nullptr) {
+                units[u].serial->flush();
+            }
+        }
+        setPowerState(POWER_ASLEEP);
+        esp_sleep_enable_timer_wakeup(us);
+        esp_light_sleep_start();
+        sleepCount++;
+        setPowerState(POWER_SCALED);
+    }
+#endif
+
+    // Once the host has been quiet for powerIdleMs, or inside a declared quiet window, run at
+    // the idle clock and, in sleep mode, sleep within the window until shortly before the next
+    // queued event (at most maxWakeLatencyMs at a time)
+    void servicePower() {
+        if (powerMode == POWER_MODE_OFF) {
+            return;
+        }
+        uint32_t now = micros();
+        uint32_t idleUs = maxWakeLatencyMs * 1000u;
+        if (queueRunning && eventCount > 0) {
+            int32_t untilDue = (int32_t)(queueEpochUs + eventQueue[eventHead].timeMs * 1000u - grooveLookahead() - now);
+            if (untilDue < (int32_t)idleUs) {
+                idleUs = (untilDue > 0) ? (uint32_t)untilDue : 0;
+            }
+        }
+        if (queueRunning && grooveHeldCount > 0) {
+            int32_t untilDue = (int32_t)(grooveHeld[0].dueUs - now);
+            if (untilDue < (int32_t)idleUs) {
+                idleUs = (untilDue > 0) ? (uint32_t)untilDue : 0;
+            }
+        }
+        if (replaying) {
+            const JournalEntry& j = journal[replayNext % M5UNITML_JOURNAL_SIZE];
+            int32_t untilDue = (int32_t)(replayStartUs + (j.timeUs - replayBaseUs) - now);
+            if (untilDue < (int32_t)idleUs) {
+                idleUs = (untilDue > 0) ? (uint32_t)untilDue : 0;
+            }
+        }
+        if (quiet && (int32_t)(quietUntilUs - now) <= 0) {
+            quiet = false;
+        }
+        uint32_t quietUs = quiet ? quietUntilUs - now : 0;
+        if ((!quiet && now - lastCommandUs < powerIdleMs * 1000u) || idleUs < M5UNITML_WAKE_MARGIN_US) {
+            setPowerState(POWER_AWAKE);
+            return;
+        }
+        setPowerState(POWER_SCALED);
+        if (quiet && quietUs < idleUs) {
+            idleUs = quietUs;
+        }
+#if defined(ARDUINO_ARCH_ESP32)
+        if (powerMode == POWER_MODE_SLEEP && quiet && !clockRunning && midiInput == nullptr &&
+            idleUs >= M5UNITML_MIN_SLEEP_US + M5UNITML_WAKE_MARGIN_US) {
+            lightSleep(idleUs - M5UNITML_WAKE_MARGIN_US);
+        }
+#endif
+    }
+
+    // Register a device-side feature to be called on every clock tick
+    bool subscribeTick(TickHandler handler) {
+        if (tickHandlerCount >= M5UNITML_MAX_TICK_HANDLERS) {
+            return false;
+        }
+        tickHandlers[tickHandlerCount++] = handler;
+        return true;
+    }
+
+    // Called by the MATLAB server on every pass of its main loop
+    void loop() {
+#if M5UNITML_PROFILE
+        uint32_t loopStart = m5unitmlCycles();
+        profileUartCycles = 0;
+#endif
+        serviceMidiInput();
+        serviceReplay();
+        updateTempoRamp();
+        serviceClock();
+        serviceEventQueue();
+        serviceReaper();
+        traceMidiWrites();
+        servicePower();
+#if M5UNITML_PROFILE
+        if (profileUartCycles > 0) {
+            recordOpcode(0, m5unitmlCycles() - loopStart);
+        }
+#endif
+    }
+
+    // Command handler for processing MATLAB commands
+    void commandHandler(byte cmdID, byte* dataIn, unsigned int payloadSize) {
+        byte responseData[M5UNITML_RESPONSE_SIZE];
+        unsigned int responseSize = 0;
+        bool known = true;
+#if M5UNITML_PROFILE
+        uint32_t dispatchStart = m5unitmlCycles();
+        profileUartCycles = 0;
+#endif
+        // Reading the trace is not traced, so a dump does not fill the ring with itself
+        bool traced = (cmdID != CMD_GET_TRACE);
+        if (traced) {
+            trace(TRACE_COMMAND, cmdID, (uint16_t)payloadSize);
+        }
+        if (journaled(cmdID)) {
+            recordJournal(cmdID, dataIn, payloadSize, micros());
+        }
+        lastCommandUs = micros();
+        quiet = false;                          // any command ends a quiet window
+        linkReleased = false;
+        if (powerState != POWER_AWAKE) {
+            setPowerState(POWER_AWAKE);
+        }
+
+        switch (cmdID) {
+            case CMD_BEGIN: {
+                // Initialize the M5UnitSynth with UART
+                // dataIn[0] = RX pin
+                // dataIn[1] = TX pin
+                // dataIn[2-3] = Baud rate (uint16_t, default: 31250)
+                // dataIn[4] = unit (0 to M5UNITML_MAX_UNITS-1, default: 0)
+                uint8_t rxPin = (payloadSize > 0) ? dataIn[0] : 16;
+                uint8_t txPin = (payloadSize > 1) ? dataIn[1] : 17;
+                uint16_t baud = (payloadSize > 3) ? (dataIn[2] | (dataIn[3] << 8)) : 31250;
+                uint8_t u = (payloadSize > 4) ? dataIn[4] : 0;
+                
+                if (u < M5UNITML_MAX_UNITS) {
+                    if (units[u].synth == nullptr) {
+                        units[u].synth = new M5UnitSynth();
+                    }
+                    units[u].serial = unitUart(u);
+                    units[u].synth->begin(units[u].serial, baud, rxPin, txPin);
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_INSTRUMENT: {
+                // Set instrument for a channel
+                // dataIn[0] = bank (0-127, usually 0)
+                // dataIn[1] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[2] = instrument (0-127)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 3) ? routeChannel(dataIn[1], channel) : nullptr;
+                if (unit != nullptr) {
+                    byte instrument[2] = { dataIn[0], dataIn[2] };
+                    applyState(dataIn[1], STATE_INSTRUMENT, instrument);
+                    recordState(dataIn[1], STATE_INSTRUMENT, instrument);
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_NOTE_ON: {
+                // Turn on a note
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1] = pitch (0-127)
+                // dataIn[2] = velocity (0-127)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 3) ? routeChannel(dataIn[0], channel) : nullptr;
+                if (unit != nullptr) {
+                    sendNoteOn(dataIn[0], dataIn[1], dataIn[2]);
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_NOTE_OFF: {
+                // Turn off a note
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1] = pitch (0-127)
+                // dataIn[2] = velocity (0-127)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 3) ? routeChannel(dataIn[0], channel) : nullptr;
+                if (unit != nullptr) {
+                    sendNoteOff(dataIn[0], dataIn[1], dataIn[2]);
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_ALL_NOTE_OFF: {
+                // Turn off all notes
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 1) ? routeChannel(dataIn[0], channel) : nullptr;
+                uint8_t targets = (unit != nullptr) ? channelTargets(dataIn[0], channel) : 0;
+                if (unit != nullptr) {
+                    if (pooled(dataIn[0])) {
+                        releasePoolNotes(dataIn[0]);
+                    }
+                    for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+                        if (targets & (1u << u)) {
+                            M5UNITML_TIMED_UART(units[u].synth->setAllNotesOff(channel));
+                        }
+                    }
+                    clearChannelNotes(dataIn[0]);
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_PITCH_BEND: {
+                // Set pitch bend
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1-2] = bend value (int16_t, signed, LSB first)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 3) ? routeChannel(dataIn[0], channel) : nullptr;
+                if (unit != nullptr) {
+                    writePitchBend(dataIn[0], (int16_t)(dataIn[1] | (dataIn[2] << 8)));
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_PITCH_BEND_RANGE: {
+                // Set pitch bend range
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1] = range value (0-127)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 2) ? routeChannel(dataIn[0], channel) : nullptr;
+                if (unit != nullptr) {
+                    applyState(dataIn[0], STATE_BEND_RANGE, &dataIn[1]);
+                    recordState(dataIn[0], STATE_BEND_RANGE, &dataIn[1]);
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_MASTER_VOLUME: {
+                // Set master volume
+                // dataIn[0] = level (0-127)
+                if (unitCount() > 0 && payloadSize >= 1) {
+                    for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+                        if (units[u].synth != nullptr) {
+                            M5UNITML_TIMED_UART(units[u].synth->setMasterVolume(dataIn[0]));
+                        }
+                    }
+                    state.masterVolume = dataIn[0];
+                    state.masterVolumeValid = 1;
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_CHANNEL_VOLUME: {
+                // Set volume for a specific channel
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1] = level (0-127)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 2) ? routeChannel(dataIn[0], channel) : nullptr;
+                if (unit != nullptr) {
+                    applyState(dataIn[0], STATE_VOLUME, &dataIn[1]);
+                    recordState(dataIn[0], STATE_VOLUME, &dataIn[1]);
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_EXPRESSION: {
+                // Set expression
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1] = expression (0-127)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 2) ? routeChannel(dataIn[0], channel) : nullptr;
+                if (unit != nullptr) {
+                    applyState(dataIn[0], STATE_EXPRESSION, &dataIn[1]);
+                    recordState(dataIn[0], STATE_EXPRESSION, &dataIn[1]);
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_REVERB: {
+                // Set reverb effect
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1] = program (0-127, reverb type)
+                // dataIn[2] = level (0-127)
+                // dataIn[3] = delay feedback (0-127)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 4) ? routeChannel(dataIn[0], channel) : nullptr;
+                if (unit != nullptr) {
+                    applyState(dataIn[0], STATE_REVERB, &dataIn[1]);
+                    recordState(dataIn[0], STATE_REVERB, &dataIn[1]);
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_CHORUS: {
+                // Set chorus effect
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1] = program (0-127, chorus type)
+                // dataIn[2] = level (0-127)
+                // dataIn[3] = feedback (0-127)
+                // dataIn[4] = chorus delay (0-127)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 5) ? routeChannel(dataIn[0], channel) : nullptr;
+                if (unit != nullptr) {
+                    applyState(dataIn[0], STATE_CHORUS, &dataIn[1]);
+                    recordState(dataIn[0], STATE_CHORUS, &dataIn[1]);
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_PAN: {
+                // Set pan (stereo balance)
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1] = pan value (0-127, 64 = center)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 2) ? routeChannel(dataIn[0], channel) : nullptr;
+                if (unit != nullptr) {
+                    applyState(dataIn[0], STATE_PAN, &dataIn[1]);
+                    recordState(dataIn[0], STATE_PAN, &dataIn[1]);
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_EQUALIZER: {
+                // Set equalizer
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1] = lowband (0-127)
+                // dataIn[2] = medlowband (0-127)
+                // dataIn[3] = medhighband (0-127)
+                // dataIn[4] = highband (0-127)
+                // dataIn[5] = lowfreq (0-127)
+                // dataIn[6] = medlowfreq (0-127)
+                // dataIn[7] = medhighfreq (0-127)
+                // dataIn[8] = highfreq (0-127)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 9) ? routeChannel(dataIn[0], channel) : nullptr;
+                if (unit != nullptr) {
+                    applyState(dataIn[0], STATE_EQUALIZER, &dataIn[1]);
+                    recordState(dataIn[0], STATE_EQUALIZER, &dataIn[1]);
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_TUNING: {
+                // Set tuning
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1] = fine (0-127, 64 is default)
+                // dataIn[2] = coarse (0-127, 64 is default)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 3) ? routeChannel(dataIn[0], channel) : nullptr;
+                if (unit != nullptr) {
+                    applyState(dataIn[0], STATE_TUNING, &dataIn[1]);
+                    recordState(dataIn[0], STATE_TUNING, &dataIn[1]);
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_VIBRATE: {
+                // Set vibrato
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1] = rate (0-127)
+                // dataIn[2] = depth (0-127)
+                // dataIn[3] = delay (0-127)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 4) ? routeChannel(dataIn[0], channel) : nullptr;
+                if (unit != nullptr) {
+                    applyState(dataIn[0], STATE_VIBRATE, &dataIn[1]);
+                    recordState(dataIn[0], STATE_VIBRATE, &dataIn[1]);
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
                 }
-                
-                synth->begin(&Serial2, baud, rxPin, txPin);
-                
-                responseData[0] = 1;
                 responseSize = 1;
                 break;
             }
 
-            case CMD_SET_INSTRUMENT: {
-                // Set instrument for a channel
-                // dataIn[0] = bank (0-127, usually 0)
-                // dataIn[1] = channel (0-15)
-                // dataIn[2] = instrument (0-127)
-                if (synth != nullptr && payloadSize >= 3) {
-                    synth->setInstrument(dataIn[0], dataIn[1], dataIn[2]);
+            case CMD_SET_TVF: {
+                // Set TVF (Time Variant Filter)
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1] = cutoff (0-127)
+                // dataIn[2] = resonance (0-127)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 3) ? routeChannel(dataIn[0], channel) : nullptr;
+                if (unit != nullptr) {
+                    applyState(dataIn[0], STATE_TVF, &dataIn[1]);
+                    recordState(dataIn[0], STATE_TVF, &dataIn[1]);
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -112,13 +2541,17 @@ public:
                 break;
             }
 
-            case CMD_SET_NOTE_ON: {
-                // Turn on a note
-                // dataIn[0] = channel (0-15)
-                // dataIn[1] = pitch (0-127)
-                // dataIn[2] = velocity (0-127)
-                if (synth != nullptr && payloadSize >= 3) {
-                    synth->setNoteOn(dataIn[0], dataIn[1], dataIn[2]);
+            case CMD_SET_ENVELOPE: {
+                // Set envelope
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1] = attack (0-127)
+                // dataIn[2] = decay (0-127)
+                // dataIn[3] = release (0-127)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 4) ? routeChannel(dataIn[0], channel) : nullptr;
+                if (unit != nullptr) {
+                    applyState(dataIn[0], STATE_ENVELOPE, &dataIn[1]);
+                    recordState(dataIn[0], STATE_ENVELOPE, &dataIn[1]);
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -127,13 +2560,21 @@ public:
                 break;
             }
 
-            case CMD_SET_NOTE_OFF: {
-                // Turn off a note
-                // dataIn[0] = channel (0-15)
+            case CMD_SET_MOD_WHEEL: {
+                // Set modulation wheel
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
                 // dataIn[1] = pitch (0-127)
-                // dataIn[2] = velocity (0-127)
-                if (synth != nullptr && payloadSize >= 3) {
-                    synth->setNoteOff(dataIn[0], dataIn[1], dataIn[2]);
+                // dataIn[2] = tvtcutoff (0-127)
+                // dataIn[3] = amplitude (0-127)
+                // dataIn[4] = rate (0-127)
+                // dataIn[5] = pitchdepth (0-127)
+                // dataIn[6] = tvfdepth (0-127)
+                // dataIn[7] = tvadepth (0-127)
+                uint8_t channel;
+                M5UnitSynth* unit = (payloadSize >= 8) ? routeChannel(dataIn[0], channel) : nullptr;
+                if (unit != nullptr) {
+                    applyState(dataIn[0], STATE_MOD_WHEEL, &dataIn[1]);
+                    recordState(dataIn[0], STATE_MOD_WHEEL, &dataIn[1]);
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -142,11 +2583,17 @@ public:
                 break;
             }
 
-            case CMD_SET_ALL_NOTE_OFF: {
-                // Turn off all notes
-                // dataIn[0] = channel (0-15)
-                if (synth != nullptr && payloadSize >= 1) {
-                    synth->setAllNotesOff(dataIn[0]);
+            case CMD_SET_ALL_DRUMS: {
+                // Set all instruments to drums
+                if (unitCount() > 0) {
+                    for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+                        if (units[u].synth != nullptr) {
+                            M5UNITML_TIMED_UART(units[u].synth->setAllInstrumentDrums());
+                        }
+                    }
+                    for (uint8_t channel = 0; channel < M5UNITML_CHANNELS; channel++) {
+                        state.channels[channel].valid &= (uint16_t)~(1u << STATE_INSTRUMENT);
+                    }
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -155,13 +2602,20 @@ public:
                 break;
             }
 
-            case CMD_SET_PITCH_BEND: {
-                // Set pitch bend
-                // dataIn[0] = channel (0-15)
-                // dataIn[1-2] = bend value (int16_t, signed, LSB first)
-                if (synth != nullptr && payloadSize >= 3) {
-                    int16_t bendValue = dataIn[1] | (dataIn[2] << 8);
-                    synth->setPitchBend(dataIn[0], bendValue);
+            case CMD_RESET: {
+                // System reset
+                if (unitCount() > 0) {
+                    for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+                        if (units[u].synth != nullptr) {
+                            M5UNITML_TIMED_UART(units[u].synth->reset());
+                        }
+                    }
+                    clearActiveNotes();
+                    clearState();
+                    memset(channelBend, 0, sizeof(channelBend));
+                    // The synth reset also ended held chords and reset MPE member expression
+                    memset(heldChordSizes, 0, sizeof(heldChordSizes));
+                    pressedChannels = 0;
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -170,12 +2624,21 @@ public:
                 break;
             }
 
-            case CMD_SET_PITCH_BEND_RANGE: {
-                // Set pitch bend range
-                // dataIn[0] = channel (0-15)
-                // dataIn[1] = range value (0-127)
-                if (synth != nullptr && payloadSize >= 2) {
-                    synth->setPitchBendRange(dataIn[0], dataIn[1]);
+            case CMD_SET_TEMPO: {
+                // Set clock tempo, optionally ramping from the current tempo
+                // dataIn[0-3] = tempo in 1/1000 BPM (uint32_t, LSB first, 20000-300000)
+                // dataIn[4-7] = ramp duration in ms (uint32_t, LSB first, 0 = immediate)
+                uint32_t newTempo = (payloadSize >= 4) ? readUInt32(&dataIn[0]) : 0;
+                uint32_t rampMs = (payloadSize >= 8) ? readUInt32(&dataIn[4]) : 0;
+                if (newTempo >= M5UNITML_MIN_TEMPO && newTempo <= M5UNITML_MAX_TEMPO) {
+                    rampStartTempo = tempo;
+                    rampTargetTempo = newTempo;
+                    rampStartMs = millis();
+                    rampDurationMs = rampMs;
+                    if (rampMs == 0) {
+                        tempo = newTempo;
+                        applyTickPeriod();
+                    }
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -184,11 +2647,41 @@ public:
                 break;
             }
 
-            case CMD_SET_MASTER_VOLUME: {
-                // Set master volume
-                // dataIn[0] = level (0-127)
-                if (synth != nullptr && payloadSize >= 1) {
-                    synth->setMasterVolume(dataIn[0]);
+            case CMD_START_CLOCK: {
+                // Start the 24 PPQN clock from tick 0
+                // dataIn[0] = flags (bit 0: send MIDI Start/Clock/Stop on the synth UART)
+                clockFlags = (payloadSize >= 1) ? dataIn[0] : 0;
+                clockTicks = 0;
+                grooveOnTick(0);
+                applyTickPeriod();
+                if (clockFlags & CLOCK_FLAG_SEND_MIDI) {
+                    broadcastMidiByte(MIDI_START);
+                }
+                startTempoTimer();
+                clockRunning = true;
+                responseData[0] = 1;
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_STOP_CLOCK: {
+                // Stop the clock
+                if (clockRunning) {
+                    stopTempoTimer();
+                    clockRunning = false;
+                    if (clockFlags & CLOCK_FLAG_SEND_MIDI) {
+                        broadcastMidiByte(MIDI_STOP);
+                    }
+                }
+                responseData[0] = 1;
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_PRESET_STORE: {
+                // Store the current configuration of all 16 channels in a preset slot
+                // dataIn[0] = slot (0 to M5UNITML_PRESET_SLOTS-1)
+                if (payloadSize >= 1 && dataIn[0] < M5UNITML_PRESET_SLOTS && savePreset(dataIn[0])) {
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -197,12 +2690,61 @@ public:
                 break;
             }
 
-            case CMD_SET_CHANNEL_VOLUME: {
-                // Set volume for a specific channel
-                // dataIn[0] = channel (0-15)
-                // dataIn[1] = level (0-127)
-                if (synth != nullptr && payloadSize >= 2) {
-                    synth->setVolume(dataIn[0], dataIn[1]);
+            case CMD_PRESET_RECALL: {
+                // Recall a preset slot, sending only parameters that differ from the current state
+                // dataIn[0] = slot (0 to M5UNITML_PRESET_SLOTS-1)
+                // Response: [status, groups sent (uint16_t, LSB first)]
+                uint16_t sent = 0;
+                if (unitCount() > 0 && payloadSize >= 1 && dataIn[0] < M5UNITML_PRESET_SLOTS && loadPreset(dataIn[0])) {
+                    sent = recallPresetBuffer();
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseData[1] = sent & 0xFF;
+                responseData[2] = (sent >> 8) & 0xFF;
+                responseSize = 3;
+                break;
+            }
+
+            case CMD_CHORD_ON: {
+                // Play a chord; any chord still held on the channel is released first
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1] = root note (0-127)
+                // dataIn[2] = quality (CHORD_MAJOR..CHORD_AUGMENTED, or CHORD_USER_FIRST + slot)
+                // dataIn[3] = inversion (0 = root position)
+                // dataIn[4] = spread in octaves (0 = close voicing)
+                // dataIn[5] = velocity (1-127; 0 only releases the held chord)
+                // Response: [status, notes played]
+                uint8_t count = 0;
+                uint8_t routed;
+                if (payloadSize >= 6 && routeChannel(dataIn[0], routed) != nullptr) {
+                    uint8_t channel = dataIn[0];
+                    uint8_t velocity = dataIn[5] & 0x7F;
+                    if (heldChordSizes[channel] > 0) {
+                        releaseHeldChord(channel);
+                    }
+                    if (velocity > 0) {
+                        uint8_t notes[M5UNITML_MAX_CHORD_NOTES] = { 0 };
+                        count = expandChord(dataIn[1], dataIn[2], dataIn[3], dataIn[4], notes);
+                        writeChord(MIDI_NOTE_ON, channel, notes, count, velocity);
+                        memcpy(heldChordNotes[channel], notes, count);
+                        heldChordSizes[channel] = count;
+                    }
+                    responseData[0] = (count > 0 || velocity == 0) ? 1 : 0;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseData[1] = count;
+                responseSize = 2;
+                break;
+            }
+
+            case CMD_CHORD_OFF: {
+                // Release the chord held on a channel
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                if (unitCount() > 0 && payloadSize >= 1 && dataIn[0] < M5UNITML_CHANNELS) {
+                    releaseHeldChord(dataIn[0]);
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -211,12 +2753,17 @@ public:
                 break;
             }
 
-            case CMD_SET_EXPRESSION: {
-                // Set expression
-                // dataIn[0] = channel (0-15)
-                // dataIn[1] = expression (0-127)
-                if (synth != nullptr && payloadSize >= 2) {
-                    synth->setExpression(dataIn[0], dataIn[1]);
+            case CMD_SET_CHORD_TABLE: {
+                // Define a user chord quality
+                // dataIn[0] = user slot (0 to M5UNITML_USER_CHORDS-1)
+                // dataIn[1] = number of intervals (1 to M5UNITML_MAX_CHORD_NOTES)
+                // dataIn[2..] = semitone intervals above the root (0-127)
+                uint8_t slot = (payloadSize >= 1) ? dataIn[0] : 0xFF;
+                uint8_t size = (payloadSize >= 2) ? dataIn[1] : 0;
+                if (slot < M5UNITML_USER_CHORDS && size >= 1 && size <= M5UNITML_MAX_CHORD_NOTES &&
+                    payloadSize >= 2u + size) {
+                    memcpy(userChordIntervals[slot], &dataIn[2], size);
+                    userChordSizes[slot] = size;
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -225,14 +2772,37 @@ public:
                 break;
             }
 
-            case CMD_SET_REVERB: {
-                // Set reverb effect
-                // dataIn[0] = channel (0-15)
-                // dataIn[1] = program (0-127, reverb type)
-                // dataIn[2] = level (0-127)
-                // dataIn[3] = delay feedback (0-127)
-                if (synth != nullptr && payloadSize >= 4) {
-                    synth->setReverb(dataIn[0], dataIn[1], dataIn[2], dataIn[3]);
+            case CMD_QUEUE_EVENTS: {
+                // Append events to the scheduled queue, in non-decreasing time order
+                // dataIn[0] = number of events
+                // dataIn[1..] = events, M5UNITML_EVENT_BYTES each:
+                //               time in ms from queue start (uint32_t, LSB first),
+                //               status, data1, data2, channel bank
+                //               (logical channel = bank * 16 + status channel)
+                // Response: [status, events accepted]; an empty batch just polls the credit
+                uint8_t requested = (payloadSize >= 1) ? dataIn[0] : 0;
+                uint8_t accepted = 0;
+                if (payloadSize >= 1u + (unsigned int)requested * M5UNITML_EVENT_BYTES) {
+                    while (accepted < requested && pushEvent(&dataIn[1 + accepted * M5UNITML_EVENT_BYTES])) {
+                        accepted++;
+                    }
+                    responseData[0] = (accepted == requested) ? 1 : 0;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseData[1] = accepted;
+                responseSize = 2;
+                break;
+            }
+
+            case CMD_QUEUE_START: {
+                // Start playing the queue; event times are relative to this moment
+                // dataIn[0-3] = start delay in ms (uint32_t, LSB first, optional)
+                uint32_t delayMs = (payloadSize >= 4) ? readUInt32(&dataIn[0]) : 0;
+                if (unitCount() > 0) {
+                    queueEpochUs = micros() + delayMs * 1000u;
+                    queueRunning = true;
+                    resetGroove();
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -241,15 +2811,98 @@ public:
                 break;
             }
 
-            case CMD_SET_CHORUS: {
-                // Set chorus effect
-                // dataIn[0] = channel (0-15)
-                // dataIn[1] = program (0-127, chorus type)
-                // dataIn[2] = level (0-127)
-                // dataIn[3] = feedback (0-127)
-                // dataIn[4] = chorus delay (0-127)
-                if (synth != nullptr && payloadSize >= 5) {
-                    synth->setChorus(dataIn[0], dataIn[1], dataIn[2], dataIn[3], dataIn[4]);
+            case CMD_QUEUE_STOP: {
+                // Stop queue playback and discard pending events, releasing the notes they
+                // would have ended
+                releaseQueuedNotes();
+                queueRunning = false;
+                eventHead = 0;
+                eventCount = 0;
+                grooveHeldCount = 0;
+                responseData[0] = 1;
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_GET_QUEUE_STATS: {
+                // Read event queue telemetry
+                // dataIn[0] = 1 to clear the statistics after reading (optional)
+                // Response: [status, high water (uint16_t), current depth (uint16_t),
+                //            emitted, underruns, overflows, drains, max lateness in us,
+                //            lateness histogram (M5UNITML_LATENESS_BUCKETS values)]
+                //            with all counters uint32_t, LSB first
+                responseData[0] = 1;
+                responseSize = 1;
+                responseSize += writeUInt16(&responseData[responseSize], queueStats.highWater);
+                responseSize += writeUInt16(&responseData[responseSize], eventCount);
+                responseSize += writeUInt32(&responseData[responseSize], queueStats.emitted);
+                responseSize += writeUInt32(&responseData[responseSize], queueStats.underruns);
+                responseSize += writeUInt32(&responseData[responseSize], queueStats.overflows);
+                responseSize += writeUInt32(&responseData[responseSize], queueStats.drains);
+                responseSize += writeUInt32(&responseData[responseSize], queueStats.maxLatenessUs);
+                for (uint8_t i = 0; i < M5UNITML_LATENESS_BUCKETS; i++) {
+                    responseSize += writeUInt32(&responseData[responseSize], queueStats.lateness[i]);
+                }
+                if (payloadSize >= 1 && dataIn[0] == 1) {
+                    memset(&queueStats, 0, sizeof(queueStats));
+                }
+                break;
+            }
+
+            case CMD_SET_ROUTE: {
+                // Route a range of logical channels to (unit, channel) pairs
+                // dataIn[0] = first logical channel
+                // dataIn[1] = number of routes
+                // dataIn[2..] = one byte per route: (unit << 4) | unit channel
+                uint8_t first = (payloadSize >= 2) ? dataIn[0] : 0;
+                uint8_t count = (payloadSize >= 2) ? dataIn[1] : 0;
+                bool valid = payloadSize >= 2u + count && first + count <= M5UNITML_CHANNELS;
+                for (uint8_t i = 0; valid && i < count; i++) {
+                    valid = (dataIn[2 + i] >> 4) < M5UNITML_MAX_UNITS;
+                }
+                if (valid) {
+                    for (uint8_t i = 0; i < count; i++) {
+                        uint8_t logical = first + i;
+                        if (channelRoutes[logical] == dataIn[2 + i]) {
+                            continue;
+                        }
+                        // Sounding notes are ended through the old route; the new one
+                        // would send their note-offs to another channel or unit
+                        if (heldChordSizes[logical] > 0) {
+                            releaseHeldChord(logical);
+                        }
+                        for (uint8_t pitch = 0; pitch < 128; pitch++) {
+                            if (activeNotes[logical][pitch] != 0) {
+                                playNoteOff(logical, pitch, 0);
+                            }
+                        }
+                        channelRoutes[logical] = dataIn[2 + i];
+                    }
+                }
+                responseData[0] = valid ? 1 : 0;
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_BALANCE: {
+                // Balance a logical channel's notes over all started units
+                // dataIn[0] = logical channel (0 to M5UNITML_CHANNELS-1)
+                // dataIn[1] = 1 to enable, 0 to disable
+                // On enable the channel's current configuration is copied to every unit. The
+                // channel keeps its routed MIDI channel number on all units.
+                if (unitCount() > 0 && payloadSize >= 2 && dataIn[0] < M5UNITML_CHANNELS) {
+                    uint8_t logical = dataIn[0];
+                    if (dataIn[1]) {
+                        balancedChannels |= (1ul << logical);
+                        const ChannelState& current = state.channels[logical];
+                        for (uint8_t group = 0; group < STATE_GROUP_COUNT; group++) {
+                            if (current.valid & (1u << group)) {
+                                applyState(logical, group, &current.params[stateGroupOffset(group)]);
+                            }
+                        }
+                    } else {
+                        balancedChannels &= ~(1ul << logical);
+                    }
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -258,12 +2911,156 @@ public:
                 break;
             }
 
-            case CMD_SET_PAN: {
-                // Set pan (stereo balance)
-                // dataIn[0] = channel (0-15)
-                // dataIn[1] = pan value (0-127, 64 = center)
-                if (synth != nullptr && payloadSize >= 2) {
-                    synth->setPan(dataIn[0], dataIn[1]);
+#if M5UNITML_PROFILE
+            case CMD_GET_PROFILE: {
+                // Read the per-opcode cycle counters, a page at a time
+                // dataIn[0] = first opcode to report (slot 0 is loop() servicing)
+                // dataIn[1] = 1 to clear the counters once the last page is read (optional)
+                // Response: [next opcode (M5UNITML_PROFILE_DONE after the last page),
+                //            cycles per us (uint16_t), entry count, entries...]
+                //            entry: opcode, then count/min/mean/max cycles (uint32_t) for the
+                //            dispatch and for the UART writes within it
+                uint8_t opcode = (payloadSize >= 1) ? dataIn[0] : 0;
+                uint8_t entries = 0;
+#if defined(ARDUINO_ARCH_ESP32)
+                uint16_t cyclesPerUs = getCpuFrequencyMhz();
+#else
+                uint16_t cyclesPerUs = 1;
+#endif
+                responseSize = 4;
+                for (; opcode < M5UNITML_PROFILE_OPCODES && entries < M5UNITML_PROFILE_PAGE; opcode++) {
+                    const OpcodeProfile& profile = opcodeProfile[opcode];
+                    if (profile.dispatch.count == 0) {
+                        continue;
+                    }
+                    responseData[responseSize++] = opcode;
+                    responseSize += writeCycleStats(&responseData[responseSize], profile.dispatch);
+                    responseSize += writeCycleStats(&responseData[responseSize], profile.uart);
+                    entries++;
+                }
+                while (opcode < M5UNITML_PROFILE_OPCODES && opcodeProfile[opcode].dispatch.count == 0) {
+                    opcode++;
+                }
+                bool done = (opcode >= M5UNITML_PROFILE_OPCODES);
+                responseData[0] = done ? M5UNITML_PROFILE_DONE : opcode;
+                writeUInt16(&responseData[1], cyclesPerUs);
+                responseData[3] = entries;
+                if (done && payloadSize >= 2 && dataIn[1] == 1) {
+                    clearProfile();
+                }
+                break;
+            }
+#endif
+
+            case CMD_GET_STATS: {
+                // Read the command statistics, a page of opcodes at a time
+                // dataIn[0] = first opcode to report
+                // dataIn[1] = 1 to clear the statistics once the last page is read (optional)
+                // Response: [status, next opcode (M5UNITML_STATS_DONE after the last page),
+                //            MIDI bytes written to unit 0 and unit 1, unknown opcodes beyond the
+                //            table, entry count, entries...], counters uint32_t LSB first
+                //            entry: opcode, accepted, short payload, not initialized, invalid,
+                //            unknown
+                uint8_t opcode = (payloadSize >= 1) ? dataIn[0] : 0;
+                uint8_t entries = 0;
+                responseData[0] = 1;
+                responseSize = 2;
+                responseSize += writeUInt32(&responseData[responseSize], unit0Uart.bytesWritten);
+                responseSize += writeUInt32(&responseData[responseSize], unit1Uart.bytesWritten);
+                responseSize += writeUInt32(&responseData[responseSize], unknownHighOpcodes);
+                unsigned int countIndex = responseSize++;
+                for (; opcode < M5UNITML_STATS_OPCODES && entries < M5UNITML_STATS_PAGE; opcode++) {
+                    const OpcodeStats& stats = opcodeStats[opcode];
+                    if (!statsUsed(stats)) {
+                        continue;
+                    }
+                    responseData[responseSize++] = opcode;
+                    responseSize += writeUInt32(&responseData[responseSize], stats.accepted);
+                    responseSize += writeUInt32(&responseData[responseSize], stats.shortPayload);
+                    responseSize += writeUInt32(&responseData[responseSize], stats.notInitialized);
+                    responseSize += writeUInt32(&responseData[responseSize], stats.invalid);
+                    responseSize += writeUInt32(&responseData[responseSize], stats.unknown);
+                    entries++;
+                }
+                while (opcode < M5UNITML_STATS_OPCODES && !statsUsed(opcodeStats[opcode])) {
+                    opcode++;
+                }
+                responseData[countIndex] = entries;
+                responseData[1] = (opcode >= M5UNITML_STATS_OPCODES) ? M5UNITML_STATS_DONE : opcode;
+                if (responseData[1] == M5UNITML_STATS_DONE && payloadSize >= 2 && dataIn[1] == 1) {
+                    clearStats();
+                }
+                break;
+            }
+
+            case CMD_GET_TRACE: {
+                // Read the trace ring in chunks
+                // dataIn[0-3] = sequence number of the first entry to read (uint32_t)
+                // dataIn[4] = 1 to clear the ring after this read (optional)
+                // Response: [status, entries recorded (uint32_t), sequence number of the first
+                //            entry returned (uint32_t), entry count, entries...]
+                //            entry: time in us (uint32_t), type, arg0, arg1 (uint16_t)
+                //            Entries older than the ring size are gone; the first sequence
+                //            number returned is then larger than the one requested.
+                uint32_t first = (payloadSize >= 4) ? readUInt32(&dataIn[0]) : 0;
+                uint32_t oldest = (traceCount > M5UNITML_TRACE_SIZE) ? traceCount - M5UNITML_TRACE_SIZE : 0;
+                if (first < oldest) {
+                    first = oldest;
+                }
+                uint8_t entries = 0;
+                responseData[0] = 1;
+                responseSize = 1;
+                responseSize += writeUInt32(&responseData[responseSize], traceCount);
+                responseSize += writeUInt32(&responseData[responseSize], first);
+                unsigned int countIndex = responseSize++;
+                for (uint32_t n = first; n < traceCount && entries < M5UNITML_TRACE_PAGE; n++, entries++) {
+                    const TraceEntry& t = traceRing[n % M5UNITML_TRACE_SIZE];
+                    responseSize += writeUInt32(&responseData[responseSize], t.timeUs);
+                    responseData[responseSize++] = t.type;
+                    responseData[responseSize++] = t.arg0;
+                    responseSize += writeUInt16(&responseData[responseSize], t.arg1);
+                }
+                responseData[countIndex] = entries;
+                if (payloadSize >= 5 && dataIn[4] == 1) {
+                    traceCount = 0;
+                }
+                break;
+            }
+
+            case CMD_GET_MEMORY: {
+                // Read heap and stack high-water marks for soak testing
+                // Response: [status, free heap, lowest free heap since boot, largest free block,
+                //            unused stack of the loop task at its deepest (bytes)], uint32_t each.
+                //            Host builds have no heap to report and return zeros.
+                uint32_t freeHeap = 0;
+                uint32_t minFreeHeap = 0;
+                uint32_t maxAlloc = 0;
+                uint32_t stackHighWater = 0;
+#if defined(ARDUINO_ARCH_ESP32)
+                freeHeap = ESP.getFreeHeap();
+                minFreeHeap = ESP.getMinFreeHeap();
+                maxAlloc = ESP.getMaxAllocHeap();
+                stackHighWater = uxTaskGetStackHighWaterMark(nullptr);
+#endif
+                responseData[0] = 1;
+                responseSize = 1;
+                responseSize += writeUInt32(&responseData[responseSize], freeHeap);
+                responseSize += writeUInt32(&responseData[responseSize], minFreeHeap);
+                responseSize += writeUInt32(&responseData[responseSize], maxAlloc);
+                responseSize += writeUInt32(&responseData[responseSize], stackHighWater);
+                break;
+            }
+
+            case CMD_SET_POWER: {
+                // Configure idle power management
+                // dataIn[0] = POWER_MODE_OFF, POWER_MODE_SCALE or POWER_MODE_SLEEP
+                // dataIn[1-2] = max wake latency in ms (uint16_t, default 100): longest light
+                //               sleep, and how far ahead an event keeps the clock up
+                // dataIn[3-4] = host quiet time in ms before powering down (uint16_t, default 1000)
+                if (payloadSize >= 1 && dataIn[0] <= POWER_MODE_SLEEP) {
+                    powerMode = dataIn[0];
+                    maxWakeLatencyMs = (payloadSize >= 3) ? (uint16_t)(dataIn[1] | (dataIn[2] << 8)) : 100;
+                    powerIdleMs = (payloadSize >= 5) ? (uint16_t)(dataIn[3] | (dataIn[4] << 8)) : 1000;
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -272,20 +3069,41 @@ public:
                 break;
             }
 
-            case CMD_SET_EQUALIZER: {
-                // Set equalizer
-                // dataIn[0] = channel (0-15)
-                // dataIn[1] = lowband (0-127)
-                // dataIn[2] = medlowband (0-127)
-                // dataIn[3] = medhighband (0-127)
-                // dataIn[4] = highband (0-127)
-                // dataIn[5] = lowfreq (0-127)
-                // dataIn[6] = medlowfreq (0-127)
-                // dataIn[7] = medhighfreq (0-127)
-                // dataIn[8] = highfreq (0-127)
-                if (synth != nullptr && payloadSize >= 9) {
-                    synth->setEqualizer(dataIn[0], dataIn[1], dataIn[2], dataIn[3], 
-                                       dataIn[4], dataIn[5], dataIn[6], dataIn[7], dataIn[8]);
+            case CMD_GET_POWER_STATS: {
+                // Read the time spent in each power state
+                // dataIn[0] = 1 to clear the statistics after reading (optional)
+                // Response: [status, mode, state, ms at full clock, ms at idle clock, ms asleep,
+                //            sleeps, quiet windows declared], counters uint32_t
+                setPowerState(powerState);
+                responseData[0] = 1;
+                responseData[1] = powerMode;
+                responseData[2] = powerState;
+                responseSize = 3;
+                for (uint8_t i = 0; i < 3; i++) {
+                    responseSize += writeUInt32(&responseData[responseSize], (uint32_t)(powerStateUs[i] / 1000));
+                }
+                responseSize += writeUInt32(&responseData[responseSize], sleepCount);
+                responseSize += writeUInt32(&responseData[responseSize], quietWindows);
+                if (payloadSize >= 1 && dataIn[0] == 1) {
+                    memset(powerStateUs, 0, sizeof(powerStateUs));
+                    sleepCount = 0;
+                    quietWindows = 0;
+                }
+                break;
+            }
+
+            case CMD_SET_NOTE_TIMEOUT: {
+                // Longest a note may sound before the reaper releases it
+                // dataIn[0] = first logical channel
+                // dataIn[1] = number of channels
+                // dataIn[2-5] = timeout in ms (uint32_t, 0 = no limit)
+                uint8_t first = (payloadSize >= 6) ? dataIn[0] : 0;
+                uint8_t count = (payloadSize >= 6) ? dataIn[1] : 0;
+                if (payloadSize >= 6 && first + count <= M5UNITML_CHANNELS) {
+                    uint32_t timeout = readUInt32(&dataIn[2]);
+                    for (uint8_t i = 0; i < count; i++) {
+                        noteTimeoutMs[first + i] = timeout;
+                    }
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -294,13 +3112,12 @@ public:
                 break;
             }
 
-            case CMD_SET_TUNING: {
-                // Set tuning
-                // dataIn[0] = channel (0-15)
-                // dataIn[1] = fine (0-127, 64 is default)
-                // dataIn[2] = coarse (0-127, 64 is default)
-                if (synth != nullptr && payloadSize >= 3) {
-                    synth->setTuning(dataIn[0], dataIn[1], dataIn[2]);
+            case CMD_SET_LINK_TIMEOUT: {
+                // Release every note once MATLAB has been silent this long and the queue is empty
+                // dataIn[0-3] = timeout in ms (uint32_t, 0 = off, at most one hour)
+                uint32_t timeout = (payloadSize >= 4) ? readUInt32(&dataIn[0]) : 0;
+                if (payloadSize >= 4 && timeout <= 3600000u) {
+                    linkTimeoutMs = timeout;
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -309,29 +3126,139 @@ public:
                 break;
             }
 
-            case CMD_SET_VIBRATE: {
-                // Set vibrato
-                // dataIn[0] = channel (0-15)
-                // dataIn[1] = rate (0-127)
-                // dataIn[2] = depth (0-127)
-                // dataIn[3] = delay (0-127)
-                if (synth != nullptr && payloadSize >= 4) {
-                    synth->setVibrate(dataIn[0], dataIn[1], dataIn[2], dataIn[3]);
+            case CMD_GET_REAPER_STATS: {
+                // Read the stuck-voice reaper counters
+                // dataIn[0] = 1 to clear the counters after reading (optional)
+                // Response: [status, notes tracked, note-ons not tracked (table full),
+                //            notes released by timeout, full releases on link silence],
+                //            counters uint32_t
+                responseData[0] = 1;
+                responseData[1] = noteAgeCount;
+                responseSize = 2;
+                responseSize += writeUInt32(&responseData[responseSize], untrackedNotes);
+                responseSize += writeUInt32(&responseData[responseSize], reapedNotes);
+                responseSize += writeUInt32(&responseData[responseSize], linkReleases);
+                if (payloadSize >= 1 && dataIn[0] == 1) {
+                    untrackedNotes = 0;
+                    reapedNotes = 0;
+                    linkReleases = 0;
+                }
+                break;
+            }
+
+            case CMD_SET_JOURNAL: {
+                // Start or stop recording received commands
+                // dataIn[0] = 1 to record, 0 to stop
+                // dataIn[1] = 1 to clear the journal first (optional)
+                if (payloadSize >= 1 && dataIn[0] <= 1) {
+                    if (payloadSize >= 2 && dataIn[1] == 1) {
+                        journalCount = 0;
+                        replaying = false;
+                    }
+                    journalRecording = (dataIn[0] == 1) && !replaying;
+                    responseData[0] = (journalRecording == (dataIn[0] == 1)) ? 1 : 0;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_GET_JOURNAL: {
+                // Read the journal in chunks
+                // dataIn[0-3] = sequence number of the first entry to read (uint32_t)
+                // dataIn[4] = 1 to clear the journal after this read (optional)
+                // Response: [status, JOURNAL_RECORDING | JOURNAL_REPLAYING, entries recorded
+                //            (uint32_t), sequence number of the first entry returned (uint32_t),
+                //            entry count, entries...]
+                //            entry: receive time in us (uint32_t), opcode, payload size, then
+                //            min(size, M5UNITML_JOURNAL_PAYLOAD) payload bytes.
+                //            As many entries as fit in one reply; entries older than the ring
+                //            size are gone, as with CMD_GET_TRACE.
+                uint32_t first = (payloadSize >= 4) ? readUInt32(&dataIn[0]) : 0;
+                if (first < oldestJournalEntry()) {
+                    first = oldestJournalEntry();
+                }
+                uint8_t entries = 0;
+                responseData[0] = 1;
+                responseData[1] = (journalRecording ? JOURNAL_RECORDING : 0) | (replaying ? JOURNAL_REPLAYING : 0);
+                responseSize = 2;
+                responseSize += writeUInt32(&responseData[responseSize], journalCount);
+                responseSize += writeUInt32(&responseData[responseSize], first);
+                unsigned int countIndex = responseSize++;
+                for (uint32_t n = first; n < journalCount; n++, entries++) {
+                    const JournalEntry& j = journal[n % M5UNITML_JOURNAL_SIZE];
+                    uint8_t kept = (j.size < M5UNITML_JOURNAL_PAYLOAD) ? j.size : M5UNITML_JOURNAL_PAYLOAD;
+                    // Leave room for the tail every ack ends with
+                    if (responseSize + 6 + kept + M5UNITML_ACK_TAIL > M5UNITML_RESPONSE_SIZE) {
+                        break;
+                    }
+                    responseSize += writeUInt32(&responseData[responseSize], j.timeUs);
+                    responseData[responseSize++] = j.cmdID;
+                    responseData[responseSize++] = j.size;
+                    memcpy(&responseData[responseSize], j.payload, kept);
+                    responseSize += kept;
+                }
+                responseData[countIndex] = entries;
+                if (payloadSize >= 5 && dataIn[4] == 1) {
+                    journalCount = 0;
+                    replaying = false;
+                }
+                break;
+            }
+
+            case CMD_REPLAY_JOURNAL: {
+                // Replay the journal through this handler with its original timing
+                // dataIn[0] = 1 to start (stops recording), 0 to stop
+                // Response: [status, entries to replay (uint32_t)]
+                uint32_t pending = 0;
+                if (payloadSize >= 1 && dataIn[0] == 1 && journalCount > 0) {
+                    journalRecording = false;
+                    replayNext = oldestJournalEntry();
+                    replayEnd = journalCount;
+                    replayBaseUs = journal[replayNext % M5UNITML_JOURNAL_SIZE].timeUs;
+                    replayStartUs = micros();
+                    replaying = true;
+                    pending = replayEnd - replayNext;
+                    responseData[0] = 1;
+                } else if (payloadSize >= 1 && dataIn[0] == 0) {
+                    if (replaying) {
+                        pending = replayEnd - replayNext;
+                    }
+                    replaying = false;
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
                 }
                 responseSize = 1;
+                responseSize += writeUInt32(&responseData[responseSize], pending);
                 break;
             }
 
-            case CMD_SET_TVF: {
-                // Set TVF (Time Variant Filter)
-                // dataIn[0] = channel (0-15)
-                // dataIn[1] = cutoff (0-127)
-                // dataIn[2] = resonance (0-127)
-                if (synth != nullptr && payloadSize >= 3) {
-                    synth->setTvf(dataIn[0], dataIn[1], dataIn[2]);
+            case CMD_SET_MIDI_INPUT: {
+                // Play MIDI received on the RX pin of a unit UART
+                // dataIn[0] = 1 to enable, 0 to disable
+                // dataIn[1] = unit whose UART receives (0 to M5UNITML_MAX_UNITS-1, default: 0)
+                // dataIn[2] = RX pin, used only when that unit has not been started; a started
+                //             unit receives on the RX pin and at the baud rate of its CMD_BEGIN
+                // dataIn[3] = flags: MIDI_IN_FLAG_MIRROR (default: 0)
+                // dataIn[4] = logical channel to play on, or MIDI_IN_KEEP_CHANNEL (default)
+                uint8_t u = (payloadSize >= 2) ? dataIn[1] : 0;
+                uint8_t channel = (payloadSize >= 5) ? dataIn[4] : MIDI_IN_KEEP_CHANNEL;
+                if (payloadSize >= 1 && dataIn[0] == 0) {
+                    midiInput = nullptr;
+                    responseData[0] = 1;
+                } else if (payloadSize >= 1 && dataIn[0] == 1 && u < M5UNITML_MAX_UNITS &&
+                           (channel < M5UNITML_CHANNELS || channel == MIDI_IN_KEEP_CHANNEL) &&
+                           (units[u].serial != nullptr || payloadSize >= 3)) {
+                    if (units[u].serial == nullptr) {
+                        unitUart(u)->begin(31250, SERIAL_8N1, dataIn[2], -1);
+                    }
+                    midiInput = unitUart(u);
+                    memset(&midiParser, 0, sizeof(midiParser));
+                    midiInputMirror = (payloadSize >= 4) && (dataIn[3] & MIDI_IN_FLAG_MIRROR);
+                    midiInputChannel = channel;
+                    midiMirrorCount = 0;
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -340,14 +3267,41 @@ public:
                 break;
             }
 
-            case CMD_SET_ENVELOPE: {
-                // Set envelope
-                // dataIn[0] = channel (0-15)
-                // dataIn[1] = attack (0-127)
-                // dataIn[2] = decay (0-127)
-                // dataIn[3] = release (0-127)
-                if (synth != nullptr && payloadSize >= 4) {
-                    synth->setEnvelope(dataIn[0], dataIn[1], dataIn[2], dataIn[3]);
+            case CMD_GET_MIDI_INPUT: {
+                // Take mirrored input messages, oldest first
+                // Response: [status, messages received (uint32_t), bytes skipped (uint32_t),
+                //            copies dropped (uint32_t), messages still buffered after this
+                //            reply, message count, messages...]
+                //            message: millis() at receipt (uint32_t), status, data1, data2,
+                //            logical channel played on (the CMD_QUEUE_EVENTS layout)
+                uint8_t count = (midiMirrorCount < M5UNITML_MIDI_IN_PAGE) ? midiMirrorCount : M5UNITML_MIDI_IN_PAGE;
+                responseData[0] = 1;
+                responseSize = 1;
+                responseSize += writeUInt32(&responseData[responseSize], midiInputMessages);
+                responseSize += writeUInt32(&responseData[responseSize], midiInputSkipped);
+                responseSize += writeUInt32(&responseData[responseSize], midiMirrorDropped);
+                responseData[responseSize++] = (uint8_t)(midiMirrorCount - count);
+                responseData[responseSize++] = count;
+                for (uint8_t i = 0; i < count; i++) {
+                    const ScheduledEvent& e = midiMirror[midiMirrorHead];
+                    responseSize += writeUInt32(&responseData[responseSize], e.timeMs);
+                    responseData[responseSize++] = e.status;
+                    responseData[responseSize++] = e.data1;
+                    responseData[responseSize++] = e.data2;
+                    responseData[responseSize++] = e.channel;
+                    midiMirrorHead = (midiMirrorHead + 1) % M5UNITML_MIDI_IN_MIRROR;
+                    midiMirrorCount--;
+                }
+                break;
+            }
+
+            case CMD_SET_NOTIFY: {
+                // Choose which notifications are kept and how they reach the host
+                // dataIn[0] = 1 to append pending records to every ack, 0 for CMD_GET_NOTIFY only
+                // dataIn[1-2] = mask of kept types, bit n-1 for type n (uint16_t, default NOTIFY_ALL)
+                if (payloadSize >= 1 && dataIn[0] <= 1) {
+                    notifyPiggyback = (dataIn[0] == 1);
+                    notifyMask = (payloadSize >= 3) ? (uint16_t)(dataIn[1] | (dataIn[2] << 8)) : NOTIFY_ALL;
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -356,19 +3310,44 @@ public:
                 break;
             }
 
-            case CMD_SET_MOD_WHEEL: {
-                // Set modulation wheel
-                // dataIn[0] = channel (0-15)
-                // dataIn[1] = pitch (0-127)
-                // dataIn[2] = tvtcutoff (0-127)
-                // dataIn[3] = amplitude (0-127)
-                // dataIn[4] = rate (0-127)
-                // dataIn[5] = pitchdepth (0-127)
-                // dataIn[6] = tvfdepth (0-127)
-                // dataIn[7] = tvadepth (0-127)
-                if (synth != nullptr && payloadSize >= 8) {
-                    synth->setModWheel(dataIn[0], dataIn[1], dataIn[2], dataIn[3], 
-                                      dataIn[4], dataIn[5], dataIn[6], dataIn[7]);
+            case CMD_GET_NOTIFY: {
+                // Take pending notifications, oldest first
+                // Response: [status, records lost with the ring full (uint32_t), records still
+                //            pending after this reply, record count, records...]
+                //            record: type, arg, count (uint16_t)
+                responseData[0] = 1;
+                responseSize = 1;
+                responseSize += writeUInt32(&responseData[responseSize], notifyLost);
+                unsigned int pendingIndex = responseSize++;
+                unsigned int countIndex = responseSize++;
+                uint8_t count = takeNotifications(&responseData[responseSize], M5UNITML_NOTIFY_PAGE * M5UNITML_NOTIFY_BYTES);
+                responseSize += count * M5UNITML_NOTIFY_BYTES;
+                responseData[pendingIndex] = notifyCount;
+                responseData[countIndex] = count;
+                break;
+            }
+
+            case CMD_SET_TUNING_TABLE: {
+                // Load part of a tuning table
+                // dataIn[0] = table (0 to M5UNITML_TUNING_TABLES-1)
+                // dataIn[1] = first key
+                // dataIn[2] = number of keys (up to M5UNITML_TUNING_CHUNK)
+                // dataIn[3..] = per key: nearest note (TUNING_UNMAPPED = silent), offset from it
+                //               in 1/100 cent (int16_t)
+                uint8_t table = (payloadSize >= 3) ? dataIn[0] : M5UNITML_TUNING_TABLES;
+                uint8_t first = (payloadSize >= 3) ? dataIn[1] : 0;
+                uint8_t count = (payloadSize >= 3) ? dataIn[2] : 0;
+                bool valid = table < M5UNITML_TUNING_TABLES && count <= M5UNITML_TUNING_CHUNK &&
+                             first + count <= 128 && payloadSize >= 3u + 3u * count;
+                for (uint8_t i = 0; valid && i < count; i++) {
+                    uint8_t note = dataIn[3 + 3 * i];
+                    valid = note < 128 || note == TUNING_UNMAPPED;
+                }
+                if (valid) {
+                    for (uint8_t i = 0; i < count; i++) {
+                        tuningTables[table].notes[first + i] = dataIn[3 + 3 * i];
+                        tuningTables[table].offsets[first + i] = (int16_t)(dataIn[4 + 3 * i] | (dataIn[5 + 3 * i] << 8));
+                    }
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -377,10 +3356,27 @@ public:
                 break;
             }
 
-            case CMD_SET_ALL_DRUMS: {
-                // Set all instruments to drums
-                if (synth != nullptr) {
-                    synth->setAllInstrumentDrums();
+            case CMD_SET_CHANNEL_TUNING: {
+                // Tune a logical channel; keys held on it are released
+                // dataIn[0] = logical channel
+                // dataIn[1] = table, or M5UNITML_NO_TUNING to play untuned
+                // dataIn[2] = first pool channel (default: unchanged, initially the channel itself)
+                // dataIn[3] = number of pool channels (default: unchanged, initially 1; one channel
+                //             means every note-on re-bends it, so only monophonic lines stay in tune)
+                // The pool of an MPE zone master stays its member channels.
+                uint8_t source = (payloadSize >= 2) ? dataIn[0] : M5UNITML_CHANNELS;
+                uint8_t table = (payloadSize >= 2) ? dataIn[1] : 0;
+                bool zone = source < M5UNITML_CHANNELS && (channelTuning[source].flags & POOL_MPE);
+                uint8_t poolFirst = (payloadSize >= 4 && !zone) ? dataIn[2] : (source < M5UNITML_CHANNELS ? channelTuning[source].poolFirst : 0);
+                uint8_t poolCount = (payloadSize >= 4 && !zone) ? dataIn[3] : (source < M5UNITML_CHANNELS ? channelTuning[source].poolCount : 0);
+                if (source < M5UNITML_CHANNELS && (table < M5UNITML_TUNING_TABLES || table == M5UNITML_NO_TUNING) &&
+                    poolCount > 0 && poolFirst + poolCount <= M5UNITML_CHANNELS) {
+                    if (pooled(source)) {
+                        releasePoolNotes(source);
+                    }
+                    channelTuning[source].table = table;
+                    channelTuning[source].poolFirst = poolFirst;
+                    channelTuning[source].poolCount = poolCount;
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -389,10 +3385,125 @@ public:
                 break;
             }
 
-            case CMD_RESET: {
-                // System reset
-                if (synth != nullptr) {
-                    synth->reset();
+            case CMD_SET_MPE_ZONE: {
+                // Make a logical channel the master of an MPE zone; keys held on it are released
+                // dataIn[0] = master logical channel
+                // dataIn[1] = first member channel
+                // dataIn[2] = number of member channels, 0 to end the zone
+                // Each note of the master plays alone on the least recently used member, so its
+                // bend and expression can be set with CMD_SET_NOTE_EXPRESSION. Members get the
+                // master's configuration now and on every later change. A tuning table set on
+                // the master still applies.
+                uint8_t master = (payloadSize >= 3) ? dataIn[0] : M5UNITML_CHANNELS;
+                uint8_t first = (payloadSize >= 3) ? dataIn[1] : 0;
+                uint8_t count = (payloadSize >= 3) ? dataIn[2] : 0;
+                if (master < M5UNITML_CHANNELS && first + count <= M5UNITML_CHANNELS) {
+                    ChannelTuning& zone = channelTuning[master];
+                    if (pooled(master)) {
+                        releasePoolNotes(master);
+                    }
+                    if (count > 0) {
+                        zone.poolFirst = first;
+                        zone.poolCount = count;
+                        zone.flags |= POOL_MPE;
+                        const ChannelState& current = state.channels[master];
+                        for (uint8_t member = first; member < first + count; member++) {
+                            pressedChannels &= ~(1ul << member);
+                            for (uint8_t group = 0; group < STATE_GROUP_COUNT; group++) {
+                                if (member != master && (current.valid & (1u << group))) {
+                                    applyRoutedState(member, group, &current.params[stateGroupOffset(group)]);
+                                    recordState(member, group, &current.params[stateGroupOffset(group)]);
+                                }
+                            }
+                        }
+                    } else {
+                        zone.flags &= (uint8_t)~POOL_MPE;
+                    }
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_NOTE_EXPRESSION: {
+                // Change one held note of an MPE zone
+                // dataIn[0] = master logical channel
+                // dataIn[1] = key
+                // dataIn[2] = NOTE_EXPRESSION_BEND or NOTE_EXPRESSION_PRESSURE
+                // dataIn[3-4] = bend (int16_t, -8192 to 8191, added to the key's tuning offset)
+                //               or expression (0-127)
+                // Returns status 0 when the key is not held.
+                uint8_t master = (payloadSize >= 5) ? dataIn[0] : M5UNITML_CHANNELS;
+                int16_t value = (payloadSize >= 5) ? (int16_t)(dataIn[3] | (dataIn[4] << 8)) : 0;
+                PoolNote* n = (master < M5UNITML_CHANNELS && (channelTuning[master].flags & POOL_MPE))
+                              ? findPoolNote(master, dataIn[1] & 0x7F) : nullptr;
+                responseData[0] = 0;
+                if (n != nullptr && dataIn[2] == NOTE_EXPRESSION_BEND) {
+                    uint8_t note;
+                    int16_t offset;
+                    poolKeyPitch(channelTuning[master], n->key, note, offset);
+                    int32_t bend = bendForOffset(n->logical, offset) + (int32_t)value;
+                    writePitchBend(n->logical, (int16_t)(bend < -8192 ? -8192 : (bend > 8191 ? 8191 : bend)));
+                    responseData[0] = 1;
+                } else if (n != nullptr && dataIn[2] == NOTE_EXPRESSION_PRESSURE && value >= 0 && value <= 127) {
+                    uint8_t expression = (uint8_t)value;
+                    applyRoutedState(n->logical, STATE_EXPRESSION, &expression);
+                    pressedChannels |= (1ul << n->logical);
+                    responseData[0] = 1;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_GROOVE: {
+                // Set how a logical channel's queued events are grooved as they are emitted
+                // dataIn[0] = logical channel
+                // dataIn[1] = quantize grid in clock ticks (24 = quarter note, 6 = sixteenth,
+                //             0 = off, up to M5UNITML_GROOVE_MAX_GRID)
+                // dataIn[2] = quantize strength in percent (0-100)
+                // dataIn[3] = swing in percent (50 = straight, up to M5UNITML_GROOVE_MAX_SWING),
+                //             delaying every second grid step
+                // dataIn[4] = timing humanization in ms either way (0-M5UNITML_GROOVE_MAX_HUMANIZE)
+                // dataIn[5] = velocity humanization either way (0-M5UNITML_GROOVE_MAX_VELOCITY)
+                // dataIn[6-9] = random seed (uint32_t); the sequence restarts at every queue start
+                // The grid follows the tempo and, while the clock runs, its ticks. Only note-ons
+                // are moved; note-offs follow their note-on.
+                uint8_t logical = (payloadSize >= 10) ? dataIn[0] : M5UNITML_CHANNELS;
+                if (logical < M5UNITML_CHANNELS && dataIn[1] <= M5UNITML_GROOVE_MAX_GRID && dataIn[2] <= 100 &&
+                    dataIn[3] >= 50 && dataIn[3] <= M5UNITML_GROOVE_MAX_SWING &&
+                    dataIn[4] <= M5UNITML_GROOVE_MAX_HUMANIZE && dataIn[5] <= M5UNITML_GROOVE_MAX_VELOCITY) {
+                    Groove& g = grooves[logical];
+                    g.gridTicks = dataIn[1];
+                    g.strength = dataIn[2];
+                    g.swing = dataIn[3];
+                    g.humanizeMs = dataIn[4];
+                    g.humanizeVelocity = dataIn[5];
+                    g.seed = readUInt32(&dataIn[6]);
+                    g.random = randomState(g.seed);
+                    if (g.gridTicks > 0 || g.humanizeMs > 0 || g.humanizeVelocity > 0) {
+                        groovedChannels |= (1ul << logical);
+                    } else {
+                        groovedChannels &= ~(1ul << logical);
+                    }
+                    responseData[0] = 1;
+                } else {
+                    responseData[0] = 0;
+                }
+                responseSize = 1;
+                break;
+            }
+
+            case CMD_SET_QUIET: {
+                // Declare that the host sends nothing for a while, so sleep mode may light-sleep
+                // without losing link bytes; the next command ends the window early
+                // dataIn[0-3] = window in ms (uint32_t, LSB first, up to M5UNITML_MAX_QUIET_MS)
+                uint32_t windowMs = (payloadSize >= 4) ? readUInt32(&dataIn[0]) : M5UNITML_MAX_QUIET_MS + 1;
+                if (windowMs <= M5UNITML_MAX_QUIET_MS) {
+                    quiet = windowMs > 0;
+                    quietUntilUs = lastCommandUs + windowMs * 1000u;
+                    quietWindows++;
                     responseData[0] = 1;
                 } else {
                     responseData[0] = 0;
@@ -405,11 +3516,38 @@ public:
                 // Unknown command
                 responseData[0] = 0;
                 responseSize = 1;
+                known = false;
                 break;
         }
 
-        // Send response back to MATLAB
-        sendResponseMsg(cmdID, responseData, responseSize);
+        if (traced) {
+            traceMidiWrites();
+            trace(TRACE_COMMAND_DONE, cmdID, responseData[0]);
+        }
+
+        // CMD_GET_PROFILE replies start with an opcode rather than a status byte
+        recordOutcome(cmdID, dataIn, payloadSize, known, responseData[0] != 0 || cmdID == CMD_GET_PROFILE);
+
+#if M5UNITML_PROFILE
+        recordOpcode(cmdID, m5unitmlCycles() - dispatchStart);
+#endif
+
+        // With piggybacking on, pending notifications ride on the ack, as many as fit.
+        // Replayed commands keep them, since their replies are dropped.
+        if (notifyPiggyback && !replayDispatch) {
+            uint8_t count = takeNotifications(&responseData[responseSize], M5UNITML_RESPONSE_SIZE - M5UNITML_ACK_TAIL - responseSize);
+            responseSize += count * M5UNITML_NOTIFY_BYTES;
+            responseData[responseSize++] = count;
+        }
+
+        // Every ack ends with the number of free event queue slots, so the host can keep
+        // the queue topped up without polling or overflowing it
+        responseData[responseSize++] = eventQueueFree();
+
+        // Send response back to MATLAB; replayed commands were already answered when received
+        if (!replayDispatch) {
+            sendResponseMsg(cmdID, responseData, responseSize);
+        }
     }
 };
 
@@ -0,0 +1,168 @@
+/**
+ * @file M5UnitMLLink.h
+ *
+ * Compact binary link to M5UnitML for hosts other than MATLAB, used by the standalone firmware
+ * (Firmware/M5UnitMLStandalone). Every command goes to the same M5UnitML::commandHandler as
+ * with the MATLAB server, and every reply carries the same bytes as the MATLAB ack.
+ *
+ * Frames are COBS encoded and end with a 0x00 delimiter, so a host can always resynchronise
+ * on the next zero. Decoded, a frame is
+ *
+ *     request: [seq, opcode, payload..., crc LSB, crc MSB]
+ *     reply:   [seq, opcode, ack bytes..., crc LSB, crc MSB]
+ *     error:   [seq, LINK_ERROR, code, crc LSB, crc MSB]
+ *
+ * where crc is CRC-16/CCITT-FALSE (polynomial 0x1021, initial 0xFFFF) over everything before
+ * it. A note-on costs 9 bytes on the wire. Requests with LINK_NO_REPLY set in seq are not
+ * answered, so streamed note traffic needs no round trips; errors are always reported.
+ */
+
+#ifndef M5UNITML_LINK_H
+#define M5UNITML_LINK_H
+
+#include "M5UnitML.h"
+
+#define M5UNITML_LINK_BAUD          921600      // stable through the Core2's USB-UART bridge
+#define M5UNITML_LINK_MAX_PAYLOAD   128         // larger than any command payload
+#define M5UNITML_LINK_OVERHEAD      4           // seq, opcode, CRC
+#define M5UNITML_LINK_MAX_PACKET    (M5UNITML_LINK_MAX_PAYLOAD + M5UNITML_LINK_OVERHEAD)
+#define M5UNITML_LINK_MAX_FRAME     (M5UNITML_LINK_MAX_PACKET + M5UNITML_LINK_MAX_PACKET / 254 + 2)
+#define LINK_NO_REPLY               0x80        // seq flag: do not answer this request
+#define LINK_ERROR                  0x00        // reply opcode of a rejected frame
+#define LINK_ERROR_CRC              1
+#define LINK_ERROR_SHORT            2           // fewer bytes than seq, opcode and CRC
+#define LINK_ERROR_LONG             3           // payload above M5UNITML_LINK_MAX_PAYLOAD
+#define LINK_ERROR_COBS             4
+
+static inline uint16_t m5unitmlCrc16(const uint8_t* data, size_t size) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// COBS encode size bytes into out (size + size / 254 + 1 bytes), without the delimiter.
+// Returns the encoded length.
+static inline size_t m5unitmlCobsEncode(const uint8_t* data, size_t size, uint8_t* out) {
+    size_t codeIndex = 0;
+    size_t length = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] != 0) {
+            out[length++] = data[i];
+            code++;
+        }
+        if (data[i] == 0 || code == 0xFF) {
+            out[codeIndex] = code;
+            codeIndex = length++;
+            code = 1;
+        }
+    }
+    out[codeIndex] = code;
+    return length;
+}
+
+// Decode in place; returns the decoded length, or -1 when the frame is not valid COBS
+static inline int m5unitmlCobsDecode(uint8_t* frame, size_t size) {
+    size_t in = 0;
+    size_t out = 0;
+    while (in < size) {
+        uint8_t code = frame[in++];
+        if (code == 0 || in + code - 1 > size) {
+            return -1;
+        }
+        for (uint8_t i = 1; i < code; i++) {
+            frame[out++] = frame[in++];
+        }
+        if (code != 0xFF && in < size) {
+            frame[out++] = 0;
+        }
+    }
+    return (int)out;
+}
+
+class M5UnitMLLink {
+public:
+    M5UnitMLLink(M5UnitML& d, HardwareSerial& p)
+        : framesReceived(0), framesRejected(0), device(d), port(p), frameLength(0), overflow(false) {}
+
+    // Take every byte waiting on the port, run complete frames, then service the device
+    void poll() {
+        while (port.available() > 0) {
+            uint8_t b = (uint8_t)port.read();
+            if (b != 0) {
+                if (frameLength < sizeof(frame)) {
+                    frame[frameLength++] = b;
+                } else {
+                    overflow = true;
+                }
+                continue;
+            }
+            if (frameLength > 0 || overflow) {
+                runFrame();
+            }
+            frameLength = 0;
+            overflow = false;
+        }
+        device.loop();
+    }
+
+    uint32_t framesReceived;
+    uint32_t framesRejected;
+
+private:
+    void runFrame() {
+        framesReceived++;
+        int size = overflow ? -1 : m5unitmlCobsDecode(frame, frameLength);
+        uint8_t seq = (size > 0) ? frame[0] : 0;
+        if (overflow) {
+            sendError(seq, LINK_ERROR_LONG);
+        } else if (size < 0) {
+            sendError(seq, LINK_ERROR_COBS);
+        } else if (size < M5UNITML_LINK_OVERHEAD) {
+            sendError(seq, LINK_ERROR_SHORT);
+        } else if (m5unitmlCrc16(frame, size - 2) != (uint16_t)(frame[size - 2] | (frame[size - 1] << 8))) {
+            sendError(seq, LINK_ERROR_CRC);
+        } else {
+            device.lastResponseSize = 0;
+            device.commandHandler(frame[1], &frame[2], (unsigned int)(size - M5UNITML_LINK_OVERHEAD));
+            if (!(seq & LINK_NO_REPLY)) {
+                sendPacket(seq, frame[1], device.lastResponse, device.lastResponseSize);
+            }
+        }
+    }
+
+    void sendError(uint8_t seq, uint8_t code) {
+        framesRejected++;
+        sendPacket(seq, LINK_ERROR, &code, 1);
+    }
+
+    void sendPacket(uint8_t seq, uint8_t opcode, const uint8_t* data, size_t size) {
+        uint8_t packet[M5UNITML_LINK_MAX_PACKET];
+        uint8_t encoded[M5UNITML_LINK_MAX_FRAME];
+        if (size > M5UNITML_LINK_MAX_PAYLOAD) {
+            size = M5UNITML_LINK_MAX_PAYLOAD;
+        }
+        packet[0] = seq;
+        packet[1] = opcode;
+        memcpy(&packet[2], data, size);
+        uint16_t crc = m5unitmlCrc16(packet, size + 2);
+        packet[size + 2] = crc & 0xFF;
+        packet[size + 3] = crc >> 8;
+        size_t length = m5unitmlCobsEncode(packet, size + M5UNITML_LINK_OVERHEAD, encoded);
+        encoded[length++] = 0;
+        port.write(encoded, length);
+    }
+
+    M5UnitML& device;
+    HardwareSerial& port;
+    uint8_t frame[M5UNITML_LINK_MAX_FRAME];     // encoded on arrival, decoded in place
+    size_t frameLength;
+    bool overflow;                              // frame too long: dropped up to its delimiter
+};
+
+#endif // M5UNITML_LINK_H
@@ -0,0 +1,43 @@
+/**
+ * @file M5UnitMLStandalone.h
+ *
+ * Stand-in for the MATLAB Arduino server's LibraryBase, used when M5UnitML.h is built into the
+ * standalone firmware (M5UNITML_STANDALONE defined). Commands arrive through M5UnitMLLink.h
+ * instead of the MATLAB server; sendResponseMsg() only keeps the reply for the link to frame.
+ */
+
+#ifndef M5UNITML_STANDALONE_H
+#define M5UNITML_STANDALONE_H
+
+#include <Arduino.h>
+
+class LibraryBase;
+
+class MWArduinoClass {
+public:
+    void registerLibrary(LibraryBase*) {}
+};
+
+class LibraryBase {
+public:
+    LibraryBase() : libName(""), lastCmdID(0), lastResponseSize(0) {}
+    virtual ~LibraryBase() {}
+
+    virtual void commandHandler(byte cmdID, byte* dataIn, unsigned int payloadSize) = 0;
+    virtual void setup() {}
+    virtual void loop() {}
+
+    void sendResponseMsg(byte cmdID, byte* data, unsigned int size) {
+        lastCmdID = cmdID;
+        lastResponseSize = size < sizeof(lastResponse) ? size : sizeof(lastResponse);
+        memcpy(lastResponse, data, lastResponseSize);
+    }
+    void debugPrint(const char*, ...) {}
+
+    const char* libName;
+    byte lastCmdID;
+    byte lastResponse[128];
+    unsigned int lastResponseSize;
+};
+
+#endif // M5UNITML_STANDALONE_H
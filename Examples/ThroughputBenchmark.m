@@ -0,0 +1,148 @@
+%% M5UnitSynth Throughput Benchmark
+% This example measures sustained calls/second and per-call latency for each public
+% M5UnitSynth method, sweeps the payload size of the batched methods (queueEvents,
+% setRoute, setChordTable) and writes the results to a CSV file. Run it once per firmware
+% build on the same hardware and compare the files.
+%
+% Every M5UnitSynth command waits for the device's ack, so there is no unacked variant; the
+% faster variants measured are the batched queue upload and the message methods with
+% argument validation turned off ('Validate' false).
+
+%% Hardware Setup:
+%   Connect M5Unit-Synth to M5Core2
+%   Baud=31250 (MIDI standard)
+%   Port C: RX=13, TX=14 (default)
+
+%% Benchmark settings
+firmwareLabel = 'baseline';     % Name of the firmware build under test, stored in every row
+callsPerCase = 200;             % Calls timed per method and variant
+warmupCalls = 10;               % Untimed calls before each case
+csvFile = sprintf('M5UnitSynthBenchmark_%s_%s.csv', firmwareLabel, datestr(now, 'yyyymmdd_HHMMSS'));
+
+%% Connect (reuses esp32/synth from ComprehensiveExample.m when they exist)
+if ~exist('esp32','var')
+    mySerialPorts = serialportlist;
+    M5SerialPort = mySerialPorts(1); % *Before Running, enter the array position of the port you want to connect to!
+    clear mySerialPorts
+    esp32 = arduino(M5SerialPort,'ESP32-WROOM-DevKitC','Libraries',{'M5Stack/M5UnitSynth'});
+    clear M5SerialPort
+end
+if ~exist('synth','var')
+    synth = addon(esp32,'M5Stack/M5UnitSynth','RXPin',13,'TXPin',14);
+end
+
+synth.setInstrument(0, 0, 0);
+synth.setMasterVolume(0);        % Keep the benchmark quiet
+validateSetting = synth.Validate;
+
+%% Fixed-size methods
+% Each row: method, variant, payload bytes, items per call, call
+% Methods that block for a duration (playNote, playChord, streamEvents, soakTest), write
+% flash (storePreset/recallPreset) or only run on the host (profiling) are not timed.
+messageCases = {
+    'setInstrument',      '', 3, 1, @() synth.setInstrument(0, 0, 0)
+    'setNoteOn',          '', 3, 1, @() synth.setNoteOn(0, 60, 1)
+    'setNoteOff',         '', 3, 1, @() synth.setNoteOff(0, 60, 0)
+    'setAllNotesOff',     '', 1, 1, @() synth.setAllNotesOff(0)
+    'setPitchBend',       '', 3, 1, @() synth.setPitchBend(0, 0)
+    'setPitchBendRange',  '', 2, 1, @() synth.setPitchBendRange(0, 2)
+    'setMasterVolume',    '', 1, 1, @() synth.setMasterVolume(0)
+    'setVolume',          '', 2, 1, @() synth.setVolume(0, 100)
+    'setExpression',      '', 2, 1, @() synth.setExpression(0, 127)
+    'setReverb',          '', 4, 1, @() synth.setReverb(0, 0, 0, 0)
+    'setChorus',          '', 5, 1, @() synth.setChorus(0, 0, 0, 0, 0)
+    'setPan',             '', 2, 1, @() synth.setPan(0, 64)
+    'setEqualizer',       '', 9, 1, @() synth.setEqualizer(0, 64, 64, 64, 64, 32, 48, 80, 96)
+    'setTuning',          '', 3, 1, @() synth.setTuning(0, 64, 64)
+    'setVibrate',         '', 4, 1, @() synth.setVibrate(0, 64, 64, 64)
+    'setTvf',             '', 3, 1, @() synth.setTvf(0, 64, 64)
+    'setEnvelope',        '', 4, 1, @() synth.setEnvelope(0, 64, 64, 64)
+    'setModWheel',        '', 8, 1, @() synth.setModWheel(0, 64, 64, 64, 64, 0, 0, 0)
+    'chordOn',            '', 6, 1, @() synth.chordOn(0, 60, 'major', 1)
+    'chordOff',           '', 1, 1, @() synth.chordOff(0)
+    'setBalance',         '', 2, 1, @() synth.setBalance(0, false)
+};
+otherCases = {
+    'setAllInstrumentDrums', '', 0, 1, @() synth.setAllInstrumentDrums()
+    'reset',              '', 0, 1, @() synth.reset()
+    'setTempo',           '', 8, 1, @() synth.setTempo(120)
+    'startClock',         '', 1, 1, @() synth.startClock(false)
+    'stopClock',          '', 0, 1, @() synth.stopClock()
+    'stopQueue',          '', 0, 1, @() synth.stopQueue()
+    'startQueue',         '', 4, 1, @() synth.startQueue()    % leaves the queue running for the sweeps
+    'pollEventQueue',     '', 1, 1, @() synth.pollEventQueue()
+    'getQueueStats',      '', 1, 1, @() synth.getQueueStats()
+    'getStats',           '', 2, 1, @() synth.getStats()
+    'getTrace',           '', 5, 1, @() synth.getTrace()
+    'getMemory',          '', 0, 1, @() synth.getMemory()
+};
+
+%% Payload sweeps
+% queueEvents sends up to 8 events per command; note offs at time 0 play (silently) as soon
+% as they arrive, so the queue never fills while the queue is running.
+sweepCases = cell(0, 5);
+for batch = [1 2 4 8]
+    events = [zeros(batch, 1), repmat(0x80, batch, 1), repmat(60, batch, 1), zeros(batch, 2)];
+    sweepCases(end + 1, :) = {'queueEvents', sprintf('%d events', batch), 1 + 8 * batch, batch, ...
+        @() synth.queueEvents(events)}; %#ok<SAGROW>
+end
+for count = unique(min([1 4 16 32], synth.NumChannels))
+    channels = 0:count - 1;
+    sweepCases(end + 1, :) = {'setRoute', sprintf('%d routes', count), 2 + count, count, ...
+        @() synth.setRoute(channels, floor(channels / 16), mod(channels, 16))}; %#ok<SAGROW>
+end
+for count = 1:6
+    intervals = 0:count - 1;
+    sweepCases(end + 1, :) = {'setChordTable', sprintf('%d intervals', count), 2 + count, 1, ...
+        @() synth.setChordTable(0, intervals)}; %#ok<SAGROW>
+end
+
+%% Run
+% Message methods run twice: with argument validation on and off
+variantCases = messageCases;
+variantCases(:, 2) = {'Validate off'};
+allCases = [messageCases; variantCases; otherCases; sweepCases];
+validateOff = [false(size(messageCases, 1), 1); true(size(variantCases, 1), 1); ...
+               false(size(otherCases, 1) + size(sweepCases, 1), 1)];
+
+synth.startQueue();
+rows = cell(size(allCases, 1), 12);
+for k = 1:size(allCases, 1)
+    [method, variant, payloadBytes, items, call] = allCases{k, :};
+    synth.Validate = validateSetting && ~validateOff(k);
+    for w = 1:warmupCalls
+        call();
+    end
+    latency = zeros(callsPerCase, 1);
+    started = tic;
+    for c = 1:callsPerCase
+        callStarted = tic;
+        call();
+        latency(c) = toc(callStarted);
+    end
+    elapsed = toc(started);
+    latency = sort(latency);
+    rows(k, :) = {firmwareLabel, datestr(now, 'yyyy-mm-dd HH:MM:SS'), method, variant, payloadBytes, callsPerCase, ...
+        callsPerCase / elapsed, items * callsPerCase / elapsed, mean(latency) * 1e3, ...
+        latency(ceil(0.5 * end)) * 1e3, latency(ceil(0.99 * end)) * 1e3, latency(end) * 1e3};
+    fprintf('%-22s %-14s %7.1f calls/s  p50 %6.2f ms  p99 %6.2f ms\n', method, variant, ...
+        rows{k, 7}, rows{k, 10}, rows{k, 11});
+end
+synth.Validate = validateSetting;
+synth.stopQueue();
+synth.setRoute(0:synth.NumChannels - 1, floor((0:synth.NumChannels - 1) / 16), mod(0:synth.NumChannels - 1, 16));
+synth.reset();
+synth.setMasterVolume(100);
+
+%% Save
+results = cell2table(rows, 'VariableNames', {'Firmware', 'Date', 'Method', 'Variant', 'PayloadBytes', 'Calls', ...
+    'CallsPerSecond', 'ItemsPerSecond', 'MeanMs', 'P50Ms', 'P99Ms', 'MaxMs'});
+writetable(results, csvFile);
+fprintf('\nWrote %d results to %s\n', height(results), csvFile);
+
+%% Compare two firmware builds
+% a = readtable('M5UnitSynthBenchmark_baseline_....csv');
+% b = readtable('M5UnitSynthBenchmark_candidate_....csv');
+% joined = innerjoin(a, b, 'Keys', {'Method', 'Variant'});
+% joined.Speedup = joined.CallsPerSecond_b ./ joined.CallsPerSecond_a;
+% disp(sortrows(joined(:, {'Method', 'Variant', 'CallsPerSecond_a', 'CallsPerSecond_b', 'Speedup'}), 'Speedup'));
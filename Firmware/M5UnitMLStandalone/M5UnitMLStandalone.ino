@@ -0,0 +1,32 @@
+/**
+ * @file M5UnitMLStandalone.ino
+ *
+ * Standalone firmware for playback boxes driven without MATLAB. The M5Stack runs the same
+ * M5UnitML command handlers as the MATLAB add-on, but takes its commands as COBS-framed,
+ * CRC-checked packets on the USB serial port (protocol in M5UnitMLLink.h). Opcodes, payloads
+ * and ack bytes are those of M5UnitML.h, so a host can send CMD_BEGIN and carry on exactly as
+ * M5UnitSynth.m does.
+ *
+ * Build with the M5Unit-Synth library installed and the add-on sources as a library:
+ *     arduino-cli compile --fqbn m5stack:esp32:m5stack_core2 \
+ *         --library "../../+arduinoioaddons/+M5Stack/src" .
+ */
+
+#define M5UNITML_STANDALONE 1
+
+#include "M5UnitMLLink.h"
+
+MWArduinoClass server;
+M5UnitML synth(server);
+M5UnitMLLink hostLink(synth, Serial);
+
+void setup() {
+    // Large enough for a burst of queued events arriving back to back at full speed
+    Serial.setRxBufferSize(1024);
+    Serial.begin(M5UNITML_LINK_BAUD);
+    synth.setup();
+}
+
+void loop() {
+    hostLink.poll();
+}
@@ -0,0 +1,112 @@
+/**
+ * @file Arduino.h
+ *
+ * Minimal host stand-in for the Arduino core used to compile M5UnitML.h on a desktop machine.
+ * Time is virtual: hostsim::advanceMicros() moves the clock seen by micros()/millis().
+ * Every byte written to a HardwareSerial is captured together with its timestamp, per UART
+ * number, so all HardwareSerial objects driving the same UART share one capture.
+ */
+
+#ifndef M5UNITML_HOSTSIM_ARDUINO_H
+#define M5UNITML_HOSTSIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+
+typedef uint8_t byte;
+
+#define SERIAL_8N1 0x800001c
+#define IRAM_ATTR
+
+namespace hostsim {
+    inline uint64_t& clockMicros() {
+        static uint64_t now = 0;
+        return now;
+    }
+    inline void advanceMicros(uint64_t us) { clockMicros() += us; }
+    inline void setMicros(uint64_t us) { clockMicros() = us; }
+
+    struct CapturedByte {
+        uint64_t timeUs;
+        uint8_t value;
+    };
+
+    inline std::vector<CapturedByte>& uartCapture(int uartNr) {
+        static std::vector<CapturedByte> captures[3];
+        return captures[uartNr];
+    }
+
+    inline std::vector<uint8_t>& uartReceive(int uartNr) {
+        static std::vector<uint8_t> queues[3];
+        return queues[uartNr];
+    }
+}
+
+inline uint32_t micros() { return (uint32_t)hostsim::clockMicros(); }
+inline uint32_t millis() { return (uint32_t)(hostsim::clockMicros() / 1000); }
+inline void delay(uint32_t ms) { hostsim::advanceMicros((uint64_t)ms * 1000); }
+inline void delayMicroseconds(uint32_t us) { hostsim::advanceMicros(us); }
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+class HardwareSerial {
+public:
+    explicit HardwareSerial(int uartNr)
+        : uart(uartNr), baudRate(0), rxPin(-1), txPin(-1), captured(hostsim::uartCapture(uartNr)),
+          rxQueue(hostsim::uartReceive(uartNr)) {}
+    virtual ~HardwareSerial() {}
+
+    void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rx = -1, int8_t tx = -1) {
+        (void)config;
+        baudRate = baud;
+        rxPin = rx;
+        txPin = tx;
+    }
+    void end() {}
+
+    virtual size_t write(uint8_t b) {
+        hostsim::CapturedByte c = { hostsim::clockMicros(), b };
+        captured.push_back(c);
+        return 1;
+    }
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            HardwareSerial::write(buffer[i]);
+        }
+        return size;
+    }
+
+    // Receive side: bytes queued with inject() on any object of the same UART are returned by read()
+    void inject(const uint8_t* buffer, size_t size) { rxQueue.insert(rxQueue.end(), buffer, buffer + size); }
+    int available() { return (int)rxQueue.size(); }
+    int read() {
+        if (rxQueue.empty()) {
+            return -1;
+        }
+        int b = rxQueue.front();
+        rxQueue.erase(rxQueue.begin());
+        return b;
+    }
+    int availableForWrite() { return 128; }
+    void flush() {}
+
+    int uart;
+    unsigned long baudRate;
+    int8_t rxPin;
+    int8_t txPin;
+    std::vector<hostsim::CapturedByte>& captured;
+    std::vector<uint8_t>& rxQueue;
+};
+
+inline HardwareSerial& hostsimSerial(int uartNr) {
+    static HardwareSerial ports[3] = { HardwareSerial(0), HardwareSerial(1), HardwareSerial(2) };
+    return ports[uartNr];
+}
+
+#define Serial  (hostsimSerial(0))
+#define Serial1 (hostsimSerial(1))
+#define Serial2 (hostsimSerial(2))
+
+#endif // M5UNITML_HOSTSIM_ARDUINO_H
@@ -0,0 +1,45 @@
+/**
+ * @file LibraryBase.h
+ *
+ * Host stand-in for the MATLAB Arduino server's LibraryBase. It only keeps what M5UnitML.h
+ * uses: library registration, the setup/loop hooks and sendResponseMsg(), whose last
+ * response is kept so host tools can inspect acks.
+ */
+
+#ifndef M5UNITML_HOSTSIM_LIBRARYBASE_H
+#define M5UNITML_HOSTSIM_LIBRARYBASE_H
+
+#include "Arduino.h"
+
+class LibraryBase;
+
+class MWArduinoClass {
+public:
+    MWArduinoClass() : library(nullptr) {}
+    void registerLibrary(LibraryBase* lib) { library = lib; }
+    LibraryBase* library;
+};
+
+class LibraryBase {
+public:
+    LibraryBase() : libName(""), lastCmdID(0), lastResponseSize(0) {}
+    virtual ~LibraryBase() {}
+
+    virtual void commandHandler(byte cmdID, byte* dataIn, unsigned int payloadSize) = 0;
+    virtual void setup() {}
+    virtual void loop() {}
+
+    void sendResponseMsg(byte cmdID, byte* data, unsigned int size) {
+        lastCmdID = cmdID;
+        lastResponseSize = size < sizeof(lastResponse) ? size : sizeof(lastResponse);
+        memcpy(lastResponse, data, lastResponseSize);
+    }
+    void debugPrint(const char*, ...) {}
+
+    const char* libName;
+    byte lastCmdID;
+    byte lastResponse[256];
+    unsigned int lastResponseSize;
+};
+
+#endif // M5UNITML_HOSTSIM_LIBRARYBASE_H
@@ -0,0 +1,328 @@
+/**
+ * @file M5UnitMLGolden.cpp
+ *
+ * Golden MIDI byte-stream regression suite. Each trace in Traces/ is a host-side translation
+ * of an example script: one command per line, replayed through M5UnitML::commandHandler at
+ * its virtual time with loop() serviced every millisecond in between. The bytes written to
+ * each Unit-Synth UART are compared, value and timestamp, against the capture of the same
+ * name in Golden/, and the byte count is reported against the golden one so encoding
+ * changes show their savings. A stream that leaves notes sounding at its end fails too.
+ *
+ * Build and run (from this folder):
+ *     g++ -std=c++11 -O2 -I. -I"../../+arduinoioaddons/+M5Stack/src" M5UnitMLGolden.cpp -o m5unitml_golden
+ *     ./m5unitml_golden Traces/BasicExample.trace Traces/ComprehensiveExample.trace
+ *
+ * Options: --verbose lists the bytes sent per command, --update rewrites the golden files
+ * and --golden <dir> reads them from another folder.
+ *
+ * Exits non-zero when any stream differs from its golden file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "MidiCapture.h"
+#include "M5UnitML.h"
+
+namespace {
+
+struct CommandName {
+    const char* name;
+    byte id;
+};
+
+const CommandName kCommands[] = {
+    { "BEGIN", CMD_BEGIN },
+    { "SET_INSTRUMENT", CMD_SET_INSTRUMENT },
+    { "SET_NOTE_ON", CMD_SET_NOTE_ON },
+    { "SET_NOTE_OFF", CMD_SET_NOTE_OFF },
+    { "SET_ALL_NOTE_OFF", CMD_SET_ALL_NOTE_OFF },
+    { "SET_PITCH_BEND", CMD_SET_PITCH_BEND },
+    { "SET_PITCH_BEND_RANGE", CMD_SET_PITCH_BEND_RANGE },
+    { "SET_MASTER_VOLUME", CMD_SET_MASTER_VOLUME },
+    { "SET_CHANNEL_VOLUME", CMD_SET_CHANNEL_VOLUME },
+    { "SET_EXPRESSION", CMD_SET_EXPRESSION },
+    { "SET_REVERB", CMD_SET_REVERB },
+    { "SET_CHORUS", CMD_SET_CHORUS },
+    { "SET_PAN", CMD_SET_PAN },
+    { "SET_EQUALIZER", CMD_SET_EQUALIZER },
+    { "SET_TUNING", CMD_SET_TUNING },
+    { "SET_VIBRATE", CMD_SET_VIBRATE },
+    { "SET_TVF", CMD_SET_TVF },
+    { "SET_ENVELOPE", CMD_SET_ENVELOPE },
+    { "SET_MOD_WHEEL", CMD_SET_MOD_WHEEL },
+    { "SET_ALL_DRUMS", CMD_SET_ALL_DRUMS },
+    { "RESET", CMD_RESET },
+    { "SET_TEMPO", CMD_SET_TEMPO },
+    { "START_CLOCK", CMD_START_CLOCK },
+    { "STOP_CLOCK", CMD_STOP_CLOCK },
+    { "PRESET_STORE", CMD_PRESET_STORE },
+    { "PRESET_RECALL", CMD_PRESET_RECALL },
+    { "CHORD_ON", CMD_CHORD_ON },
+    { "CHORD_OFF", CMD_CHORD_OFF },
+    { "SET_CHORD_TABLE", CMD_SET_CHORD_TABLE },
+    { "QUEUE_EVENTS", CMD_QUEUE_EVENTS },
+    { "QUEUE_START", CMD_QUEUE_START },
+    { "QUEUE_STOP", CMD_QUEUE_STOP },
+    { "GET_QUEUE_STATS", CMD_GET_QUEUE_STATS },
+    { "SET_ROUTE", CMD_SET_ROUTE },
+    { "SET_BALANCE", CMD_SET_BALANCE },
+};
+
+const uint32_t kTailMs = 1000;          // keep servicing loop() after the last command
+
+struct TraceCommand {
+    uint32_t timeMs;
+    std::string name;
+    byte id;
+    std::vector<byte> payload;
+};
+
+struct CommandBytes {
+    unsigned calls;
+    size_t bytes;
+};
+
+bool lookupCommand(const char* name, byte& id) {
+    for (size_t i = 0; i < sizeof(kCommands) / sizeof(kCommands[0]); i++) {
+        if (strcmp(kCommands[i].name, name) == 0) {
+            id = kCommands[i].id;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool loadTrace(const char* path, std::vector<TraceCommand>& commands) {
+    FILE* f = fopen(path, "r");
+    if (f == nullptr) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return false;
+    }
+    char line[1024];
+    unsigned lineNumber = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f) != nullptr) {
+        lineNumber++;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        TraceCommand c;
+        char name[64];
+        int consumed = 0;
+        if (sscanf(line, "%u %63s%n", &c.timeMs, name, &consumed) != 2 || !lookupCommand(name, c.id)) {
+            fprintf(stderr, "%s:%u: cannot parse command\n", path, lineNumber);
+            ok = false;
+            break;
+        }
+        c.name = name;
+        char* cursor = line + consumed;
+        for (;;) {
+            char* end;
+            unsigned long value = strtoul(cursor, &end, 10);
+            if (end == cursor) {
+                break;
+            }
+            c.payload.push_back((byte)value);
+            cursor = end;
+        }
+        commands.push_back(c);
+    }
+    fclose(f);
+    return ok;
+}
+
+size_t capturedBytes() {
+    return Serial1.captured.size() + Serial2.captured.size();
+}
+
+// Replay a trace on a fresh device with the clock at zero
+void replay(const std::vector<TraceCommand>& commands, std::map<std::string, CommandBytes>& perCommand) {
+    hostsim::setMicros(0);
+    Serial1.captured.clear();
+    Serial2.captured.clear();
+
+    MWArduinoClass arduino;
+    M5UnitML device(arduino);
+    uint32_t nowMs = 0;
+    for (size_t i = 0; i < commands.size(); i++) {
+        const TraceCommand& c = commands[i];
+        while (nowMs < c.timeMs) {
+            hostsim::advanceMicros(1000);
+            nowMs++;
+            device.loop();
+        }
+        std::vector<byte> payload(c.payload);
+        payload.resize(payload.size() + 1);       // never hand the handler a null buffer
+        size_t before = capturedBytes();
+        device.commandHandler(c.id, payload.data(), (unsigned int)c.payload.size());
+        CommandBytes& counts = perCommand[c.name];
+        counts.calls++;
+        counts.bytes += capturedBytes() - before;
+    }
+    for (uint32_t t = 0; t < kTailMs; t++) {
+        hostsim::advanceMicros(1000);
+        device.loop();
+    }
+}
+
+// Compare one UART against its golden file; returns true when identical
+bool compareStream(const char* label, const std::vector<hostsim::CapturedByte>& bytes, const std::string& goldenPath, bool update) {
+    std::vector<hostsim::CapturedByte> golden;
+    bool haveGolden = hostsim::loadCapture(goldenPath.c_str(), golden);
+
+    if (update) {
+        if (bytes.empty() && !haveGolden) {
+            return true;
+        }
+        if (!hostsim::saveCapture(bytes, goldenPath.c_str())) {
+            fprintf(stderr, "cannot write %s\n", goldenPath.c_str());
+            return false;
+        }
+        printf("  %-6s %6zu bytes -> %s\n", label, bytes.size(), goldenPath.c_str());
+        return true;
+    }
+    if (!haveGolden) {
+        if (bytes.empty()) {
+            return true;
+        }
+        printf("  %-6s %6zu bytes, no golden file %s\n", label, bytes.size(), goldenPath.c_str());
+        return false;
+    }
+
+    long delta = (long)bytes.size() - (long)golden.size();
+    printf("  %-6s %6zu bytes (golden %zu, %+ld, %+.1f%%)", label, bytes.size(), golden.size(), delta,
+           golden.empty() ? 0.0 : 100.0 * delta / golden.size());
+
+    size_t common = bytes.size() < golden.size() ? bytes.size() : golden.size();
+    for (size_t i = 0; i < common; i++) {
+        if (bytes[i].value != golden[i].value || bytes[i].timeUs != golden[i].timeUs) {
+            printf("  FAIL\n    first difference at byte %zu: %02X @ %llu us, golden %02X @ %llu us\n", i,
+                   bytes[i].value, (unsigned long long)bytes[i].timeUs,
+                   golden[i].value, (unsigned long long)golden[i].timeUs);
+            return false;
+        }
+    }
+    if (bytes.size() != golden.size()) {
+        printf("  FAIL\n    stream %s golden after byte %zu\n", bytes.size() > golden.size() ? "extends" : "stops short of", common);
+        return false;
+    }
+    printf("  ok\n");
+    return true;
+}
+
+// Notes a stream leaves sounding: note-ons not ended by a note-off, All Notes Off (CC 123),
+// All Sound Off (CC 120) or System Reset
+unsigned hangingNotes(const std::vector<hostsim::CapturedByte>& bytes) {
+    std::vector<bool> sounding(16 * 128, false);
+    uint8_t status = 0;
+    uint8_t data[2];
+    int count = 0;
+    for (size_t i = 0; i < bytes.size(); i++) {
+        uint8_t b = bytes[i].value;
+        if (b == 0xFF) {
+            sounding.assign(sounding.size(), false);
+            continue;
+        }
+        if (b >= 0xF8) {
+            continue;
+        }
+        if (b & 0x80) {
+            status = (b < 0xF0) ? b : 0;        // SysEx data is dropped with the status
+            count = 0;
+            continue;
+        }
+        if (status == 0) {
+            continue;
+        }
+        data[count++] = b;
+        uint8_t type = status & 0xF0;
+        if (count < ((type == 0xC0 || type == 0xD0) ? 1 : 2)) {
+            continue;
+        }
+        count = 0;
+        size_t channel = status & 0x0F;
+        if (type == 0x90 || type == 0x80) {
+            sounding[channel * 128 + data[0]] = (type == 0x90 && data[1] > 0);
+        } else if (type == 0xB0 && (data[0] == 120 || data[0] == 123)) {
+            std::fill(sounding.begin() + channel * 128, sounding.begin() + channel * 128 + 128, false);
+        }
+    }
+    return (unsigned)std::count(sounding.begin(), sounding.end(), true);
+}
+
+std::string goldenBase(const char* tracePath, const std::string& goldenDir) {
+    std::string name(tracePath);
+    size_t slash = name.find_last_of("/\\");
+    if (slash != std::string::npos) {
+        name = name.substr(slash + 1);
+    }
+    size_t dot = name.rfind('.');
+    if (dot != std::string::npos) {
+        name = name.substr(0, dot);
+    }
+    return goldenDir + "/" + name;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    bool update = false;
+    bool verbose = false;
+    std::string goldenDir = "Golden";
+    std::vector<const char*> traces;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--update") == 0) {
+            update = true;
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            verbose = true;
+        } else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc) {
+            goldenDir = argv[++i];
+        } else {
+            traces.push_back(argv[i]);
+        }
+    }
+    if (traces.empty()) {
+        fprintf(stderr, "usage: %s [--update] [--verbose] [--golden dir] trace...\n", argv[0]);
+        return 2;
+    }
+
+    int failures = 0;
+    for (size_t t = 0; t < traces.size(); t++) {
+        std::vector<TraceCommand> commands;
+        if (!loadTrace(traces[t], commands)) {
+            failures++;
+            continue;
+        }
+        std::map<std::string, CommandBytes> perCommand;
+        replay(commands, perCommand);
+
+        printf("%s: %zu commands\n", traces[t], commands.size());
+        std::string base = goldenBase(traces[t], goldenDir);
+        bool ok = compareStream("unit 0", Serial2.captured, base + ".txt", update);
+        ok = compareStream("unit 1", Serial1.captured, base + ".unit1.txt", update) && ok;
+        unsigned hanging = hangingNotes(Serial2.captured) + hangingNotes(Serial1.captured);
+        if (hanging > 0) {
+            printf("  FAIL   %u notes left sounding\n", hanging);
+            ok = false;
+        }
+        if (!ok) {
+            failures++;
+        }
+        if (verbose) {
+            for (std::map<std::string, CommandBytes>::const_iterator it = perCommand.begin(); it != perCommand.end(); ++it) {
+                printf("    %-22s %5u calls %7zu bytes\n", it->first.c_str(), it->second.calls, it->second.bytes);
+            }
+        }
+    }
+    if (failures > 0) {
+        printf("%d of %zu traces differ from their golden files\n", failures, traces.size());
+        return 1;
+    }
+    return 0;
+}
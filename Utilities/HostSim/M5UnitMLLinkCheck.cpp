@@ -0,0 +1,159 @@
+/**
+ * @file M5UnitMLLinkCheck.cpp
+ *
+ * Checks the standalone firmware's binary link (M5UnitMLLink.h) against the host build of
+ * M5UnitML: the CRC against its published check value, COBS round trips over awkward packets
+ * (zero runs, 254-byte blocks), replies that carry the same bytes as the MATLAB ack, requests
+ * sent without reply, and recovery from corrupted, truncated and overlong frames. It also
+ * prints the wire cost of a note-on, for comparison with the MATLAB server framing.
+ *
+ * Build and run (from this folder):
+ *     g++ -std=c++11 -O2 -I. -I"../../+arduinoioaddons/+M5Stack/src" M5UnitMLLinkCheck.cpp -o m5unitml_linkcheck
+ *     ./m5unitml_linkcheck
+ *
+ * Exits non-zero when any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#include "M5UnitMLLink.h"
+
+namespace {
+
+unsigned failures = 0;
+
+void check(bool ok, const char* what) {
+    printf("  %-48s %s\n", what, ok ? "ok" : "FAIL");
+    if (!ok) {
+        failures++;
+    }
+}
+
+std::vector<uint8_t> frameFor(uint8_t seq, uint8_t opcode, const std::vector<uint8_t>& payload) {
+    std::vector<uint8_t> packet;
+    packet.push_back(seq);
+    packet.push_back(opcode);
+    packet.insert(packet.end(), payload.begin(), payload.end());
+    uint16_t crc = m5unitmlCrc16(packet.data(), packet.size());
+    packet.push_back(crc & 0xFF);
+    packet.push_back(crc >> 8);
+    std::vector<uint8_t> frame(packet.size() + packet.size() / 254 + 2);
+    frame.resize(m5unitmlCobsEncode(packet.data(), packet.size(), frame.data()));
+    frame.push_back(0);
+    return frame;
+}
+
+// Frames the device wrote to the link since the last call, decoded and CRC-checked
+std::vector<std::vector<uint8_t> > takeReplies(bool& valid) {
+    std::vector<std::vector<uint8_t> > replies;
+    std::vector<uint8_t> pending;
+    valid = true;
+    for (size_t i = 0; i < Serial.captured.size(); i++) {
+        if (Serial.captured[i].value != 0) {
+            pending.push_back(Serial.captured[i].value);
+            continue;
+        }
+        int size = m5unitmlCobsDecode(pending.data(), pending.size());
+        if (size < M5UNITML_LINK_OVERHEAD ||
+            m5unitmlCrc16(pending.data(), size - 2) != (uint16_t)(pending[size - 2] | (pending[size - 1] << 8))) {
+            valid = false;
+        } else {
+            replies.push_back(std::vector<uint8_t>(pending.begin(), pending.begin() + size - 2));
+        }
+        pending.clear();
+    }
+    Serial.captured.clear();
+    return replies;
+}
+
+void send(M5UnitMLLink& link, const std::vector<uint8_t>& bytes) {
+    Serial.inject(bytes.data(), bytes.size());
+    link.poll();
+}
+
+}  // namespace
+
+int main() {
+    printf("framing:\n");
+    const uint8_t checkInput[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+    check(m5unitmlCrc16(checkInput, sizeof(checkInput)) == 0x29B1, "CRC-16/CCITT-FALSE check value 0x29B1");
+
+    bool roundTrips = true;
+    srand(1);
+    for (size_t size = 0; size <= 600 && roundTrips; size++) {
+        for (int pattern = 0; pattern < 3 && roundTrips; pattern++) {
+            std::vector<uint8_t> packet(size);
+            for (size_t i = 0; i < size; i++) {
+                packet[i] = (pattern == 0) ? 0 : (pattern == 1) ? (uint8_t)(1 + i % 255) : (uint8_t)(rand() % 3 == 0 ? 0 : rand());
+            }
+            std::vector<uint8_t> frame(size + size / 254 + 1);
+            size_t length = m5unitmlCobsEncode(packet.data(), size, frame.data());
+            bool noZero = true;
+            for (size_t i = 0; i < length; i++) {
+                noZero = noZero && frame[i] != 0;
+            }
+            int decoded = m5unitmlCobsDecode(frame.data(), length);
+            roundTrips = noZero && length <= frame.size() && decoded == (int)size &&
+                         std::equal(packet.begin(), packet.end(), frame.begin());
+        }
+    }
+    check(roundTrips, "COBS round trips, 0 to 600 bytes");
+
+    printf("link:\n");
+    hostsim::setMicros(0);
+    MWArduinoClass arduino;
+    M5UnitML device(arduino);
+    M5UnitMLLink link(device, Serial);
+    bool valid;
+
+    send(link, frameFor(1, CMD_BEGIN, { 13, 14, 0x12, 0x7A, 0x00 }));
+    std::vector<std::vector<uint8_t> > replies = takeReplies(valid);
+    check(valid && replies.size() == 1 && replies[0][0] == 1 && replies[0][1] == CMD_BEGIN && replies[0][2] == 1,
+          "CMD_BEGIN answered with seq, opcode and status");
+    check(replies.size() == 1 &&
+          std::equal(replies[0].begin() + 2, replies[0].end(), device.lastResponse) &&
+          replies[0].size() - 2 == device.lastResponseSize, "reply bytes are the MATLAB ack");
+
+    size_t before = Serial2.captured.size();
+    std::vector<uint8_t> noteOn = frameFor(2 | LINK_NO_REPLY, CMD_SET_NOTE_ON, { 0, 60, 100 });
+    send(link, noteOn);
+    replies = takeReplies(valid);
+    check(replies.empty() && Serial2.captured.size() == before + 3, "LINK_NO_REPLY note-on plays without reply");
+    printf("  note-on: %zu bytes on the wire\n", noteOn.size());
+
+    std::vector<uint8_t> corrupted = frameFor(3, CMD_SET_NOTE_OFF, { 0, 60, 0 });
+    corrupted[4] ^= 0x40;                       // the pitch byte
+    send(link, corrupted);
+    replies = takeReplies(valid);
+    check(valid && replies.size() == 1 && replies[0][1] == LINK_ERROR && replies[0][2] == LINK_ERROR_CRC,
+          "corrupted frame rejected with LINK_ERROR_CRC");
+
+    send(link, { 0x02, 0x05, 0x00 });
+    replies = takeReplies(valid);
+    check(valid && replies.size() == 1 && replies[0][1] == LINK_ERROR && replies[0][2] == LINK_ERROR_SHORT,
+          "truncated frame rejected with LINK_ERROR_SHORT");
+
+    send(link, std::vector<uint8_t>(M5UNITML_LINK_MAX_FRAME + 10, 0x11));
+    send(link, std::vector<uint8_t>(1, 0));
+    replies = takeReplies(valid);
+    check(valid && replies.size() == 1 && replies[0][1] == LINK_ERROR && replies[0][2] == LINK_ERROR_LONG,
+          "overlong frame rejected with LINK_ERROR_LONG");
+
+    // Line noise without a delimiter merges into the next frame, which is then lost; the
+    // one after it must get through
+    std::vector<uint8_t> noisy = { 0x33, 0x7F };
+    std::vector<uint8_t> lost = frameFor(4, CMD_SET_NOTE_OFF, { 0, 60, 0 });
+    std::vector<uint8_t> next = frameFor(5, CMD_SET_NOTE_OFF, { 0, 60, 0 });
+    noisy.insert(noisy.end(), lost.begin(), lost.end());
+    noisy.insert(noisy.end(), next.begin(), next.end());
+    send(link, noisy);
+    replies = takeReplies(valid);
+    check(valid && replies.size() == 2 && replies[0][1] == LINK_ERROR && replies[1][0] == 5 && replies[1][1] == CMD_SET_NOTE_OFF,
+          "resynchronises on the next delimiter");
+
+    printf("%u frames, %u rejected\n", link.framesReceived, link.framesRejected);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,603 @@
+/**
+ * @file M5UnitMLRender.cpp
+ *
+ * Reference renderer for MIDI captures from the host build (see MidiCapture.h). It plays the
+ * captured byte stream through a small General MIDI wavetable synth and writes a WAV file, so
+ * changes to device timing can be listened to and measured offline. It is not a model of the
+ * SAM2695 sound set; only the note timing is meant to be faithful.
+ *
+ * Build (from this folder):
+ *     g++ -std=c++11 -O2 -msse2 M5UnitMLRender.cpp -o m5unitml_render
+ *
+ * Usage:
+ *     m5unitml_render capture.txt out.wav             render at 44.1 kHz
+ *     m5unitml_render capture.txt --onsets            list note-on times as CSV
+ *     m5unitml_render capture.txt --compare ref.txt   onset deltas against a reference capture
+ *     m5unitml_render --self-test                     check the MIDI parser; non-zero on failure
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "MidiCapture.h"
+
+namespace {
+
+const int kSampleRate = 44100;
+const int kMaxVoices = 64;              // SAM2695 polyphony
+const int kBlockFrames = 64;            // envelopes are linear within a block
+const int kTableSize = 2048;
+const int kTableCount = 6;
+const float kMasterGain = 0.2f;
+const double kTwoPi = 6.283185307179586;
+
+// Wavetables: sine, triangle, saw, square, organ, mellow
+float gTables[kTableCount][kTableSize + 1];
+
+void buildTables() {
+    for (int i = 0; i <= kTableSize; i++) {
+        double x = kTwoPi * i / kTableSize;
+        double saw = 0, square = 0, triangle = 0;
+        for (int h = 1; h <= 24; h++) {
+            saw += sin(h * x) / h;
+            if (h & 1) {
+                square += sin(h * x) / h;
+                triangle += ((h / 2) & 1 ? -1.0 : 1.0) * sin(h * x) / (h * h);
+            }
+        }
+        gTables[0][i] = (float)sin(x);
+        gTables[1][i] = (float)(triangle * 8 / (kTwoPi * kTwoPi / 4));
+        gTables[2][i] = (float)(saw * 0.55);
+        gTables[3][i] = (float)(square * 0.7);
+        gTables[4][i] = (float)((sin(x) + 0.5 * sin(2 * x) + 0.3 * sin(3 * x) + 0.2 * sin(4 * x)) * 0.5);
+        gTables[5][i] = (float)((sin(x) + 0.25 * sin(2 * x)) * 0.8);
+    }
+}
+
+// Sound per GM family (program / 8): wavetable and envelope in seconds
+struct Patch {
+    int table;
+    float attack;
+    float decay;
+    float sustain;
+    float release;
+};
+
+const Patch kPatches[16] = {
+    { 5, 0.002f, 1.2f, 0.25f, 0.30f },  // piano
+    { 0, 0.001f, 0.6f, 0.00f, 0.40f },  // chromatic percussion
+    { 4, 0.010f, 0.1f, 0.90f, 0.08f },  // organ
+    { 1, 0.002f, 0.9f, 0.15f, 0.25f },  // guitar
+    { 1, 0.005f, 0.5f, 0.60f, 0.12f },  // bass
+    { 2, 0.080f, 0.3f, 0.85f, 0.40f },  // strings
+    { 2, 0.120f, 0.4f, 0.80f, 0.50f },  // ensemble
+    { 3, 0.030f, 0.2f, 0.85f, 0.15f },  // brass
+    { 3, 0.040f, 0.2f, 0.80f, 0.15f },  // reed
+    { 0, 0.050f, 0.2f, 0.85f, 0.15f },  // pipe
+    { 2, 0.010f, 0.3f, 0.70f, 0.20f },  // synth lead
+    { 5, 0.300f, 0.5f, 0.80f, 0.80f },  // synth pad
+    { 4, 0.050f, 0.8f, 0.50f, 0.60f },  // synth effects
+    { 1, 0.005f, 0.7f, 0.30f, 0.30f },  // ethnic
+    { 0, 0.001f, 0.2f, 0.00f, 0.10f },  // percussive
+    { 3, 0.010f, 0.5f, 0.40f, 0.40f },  // sound effects
+};
+
+struct Channel {
+    uint8_t program;
+    uint8_t volume;
+    uint8_t expression;
+    uint8_t pan;
+    uint8_t rpnMsb;
+    uint8_t rpnLsb;
+    float bendSemitones;
+    float bendRange;
+};
+
+enum Stage { STAGE_OFF, STAGE_ATTACK, STAGE_DECAY, STAGE_SUSTAIN, STAGE_RELEASE };
+
+struct Voice {
+    Stage stage;
+    uint8_t channel;
+    uint8_t note;
+    bool drum;
+    float velocityGain;
+    double phase;
+    float env;
+    uint64_t started;
+    uint32_t noise;
+};
+
+// Mix a mono voice buffer into the stereo bus with a linear envelope ramp
+void mixVoice(float* mixL, float* mixR, const float* src, float env, float envStep, float gainL, float gainR, int frames) {
+    int i = 0;
+#if defined(__SSE2__)
+    __m128 ramp = _mm_add_ps(_mm_set1_ps(env), _mm_mul_ps(_mm_set1_ps(envStep), _mm_set_ps(3, 2, 1, 0)));
+    __m128 rampStep = _mm_set1_ps(envStep * 4);
+    __m128 gl = _mm_set1_ps(gainL);
+    __m128 gr = _mm_set1_ps(gainR);
+    for (; i + 4 <= frames; i += 4) {
+        __m128 s = _mm_mul_ps(_mm_loadu_ps(src + i), ramp);
+        _mm_storeu_ps(mixL + i, _mm_add_ps(_mm_loadu_ps(mixL + i), _mm_mul_ps(s, gl)));
+        _mm_storeu_ps(mixR + i, _mm_add_ps(_mm_loadu_ps(mixR + i), _mm_mul_ps(s, gr)));
+        ramp = _mm_add_ps(ramp, rampStep);
+    }
+    env += envStep * i;
+#endif
+    for (; i < frames; i++) {
+        float s = src[i] * env;
+        mixL[i] += s * gainL;
+        mixR[i] += s * gainR;
+        env += envStep;
+    }
+}
+
+class Renderer {
+public:
+    Renderer() : frame(0), voiceCounter(0) {
+        reset();
+        memset(voices, 0, sizeof(voices));
+    }
+
+    void reset() {
+        for (int c = 0; c < 16; c++) {
+            Channel& ch = channels[c];
+            ch.program = 0;
+            ch.volume = 100;
+            ch.expression = 127;
+            ch.pan = 64;
+            ch.rpnMsb = 0x7F;
+            ch.rpnLsb = 0x7F;
+            ch.bendSemitones = 0;
+            ch.bendRange = 2;
+        }
+        for (int v = 0; v < kMaxVoices; v++) {
+            voices[v].stage = STAGE_OFF;
+        }
+    }
+
+    void message(const uint8_t* m, int length) {
+        uint8_t type = m[0] & 0xF0;
+        uint8_t c = m[0] & 0x0F;
+        Channel& ch = channels[c];
+        if (type == 0x90 && length == 3 && m[2] > 0) {
+            noteOn(c, m[1], m[2]);
+        } else if (type == 0x80 || type == 0x90) {
+            noteOff(c, m[1]);
+        } else if (type == 0xC0) {
+            ch.program = m[1];
+        } else if (type == 0xE0) {
+            int value = (m[1] | (m[2] << 7)) - 8192;
+            ch.bendSemitones = ch.bendRange * value / 8192.0f;
+        } else if (type == 0xB0) {
+            switch (m[1]) {
+                case 7:   ch.volume = m[2]; break;
+                case 10:  ch.pan = m[2]; break;
+                case 11:  ch.expression = m[2]; break;
+                case 101: ch.rpnMsb = m[2]; break;
+                case 100: ch.rpnLsb = m[2]; break;
+                case 6:
+                    if (ch.rpnMsb == 0 && ch.rpnLsb == 0) {
+                        ch.bendRange = m[2];
+                    }
+                    break;
+                case 120:
+                case 123:
+                    for (int v = 0; v < kMaxVoices; v++) {
+                        if (voices[v].stage != STAGE_OFF && voices[v].channel == c) {
+                            voices[v].stage = (m[1] == 120) ? STAGE_OFF : STAGE_RELEASE;
+                        }
+                    }
+                    break;
+                default: break;
+            }
+        }
+    }
+
+    // Render frames of audio into interleaved 16-bit stereo
+    void render(int frames, std::vector<int16_t>& out) {
+        while (frames > 0) {
+            int n = std::min(frames, kBlockFrames);
+            renderBlock(n, out);
+            frames -= n;
+        }
+    }
+
+    uint64_t frame;
+
+private:
+    Channel channels[16];
+    Voice voices[kMaxVoices];
+    uint64_t voiceCounter;
+
+    void noteOn(uint8_t c, uint8_t note, uint8_t velocity) {
+        int slot = -1;
+        for (int v = 0; v < kMaxVoices && slot < 0; v++) {
+            if (voices[v].stage == STAGE_OFF) {
+                slot = v;
+            }
+        }
+        if (slot < 0) {
+            // Steal the oldest voice, as the hardware does when polyphony runs out
+            slot = 0;
+            for (int v = 1; v < kMaxVoices; v++) {
+                if (voices[v].started < voices[slot].started) {
+                    slot = v;
+                }
+            }
+        }
+        Voice& voice = voices[slot];
+        voice.stage = STAGE_ATTACK;
+        voice.channel = c;
+        voice.note = note;
+        voice.drum = (c == 9);
+        voice.velocityGain = (velocity / 127.0f) * (velocity / 127.0f);
+        voice.phase = 0;
+        voice.env = 0;
+        voice.started = ++voiceCounter;
+        voice.noise = 0x12345u + note;
+    }
+
+    void noteOff(uint8_t c, uint8_t note) {
+        for (int v = 0; v < kMaxVoices; v++) {
+            Voice& voice = voices[v];
+            if (voice.stage != STAGE_OFF && voice.stage != STAGE_RELEASE && voice.channel == c && voice.note == note) {
+                voice.stage = STAGE_RELEASE;
+            }
+        }
+    }
+
+    // Envelope value after n frames, advancing the voice's stage
+    float advanceEnvelope(Voice& voice, const Patch& patch, int n) {
+        float t = (float)n / kSampleRate;
+        switch (voice.stage) {
+            case STAGE_ATTACK:
+                voice.env += t / patch.attack;
+                if (voice.env >= 1.0f) {
+                    voice.env = 1.0f;
+                    voice.stage = STAGE_DECAY;
+                }
+                break;
+            case STAGE_DECAY:
+                voice.env -= t / patch.decay;
+                if (voice.env <= patch.sustain) {
+                    voice.env = patch.sustain;
+                    voice.stage = (patch.sustain > 0) ? STAGE_SUSTAIN : STAGE_OFF;
+                }
+                break;
+            case STAGE_RELEASE:
+                voice.env -= t / patch.release;
+                if (voice.env <= 0) {
+                    voice.env = 0;
+                    voice.stage = STAGE_OFF;
+                }
+                break;
+            default:
+                break;
+        }
+        return voice.env;
+    }
+
+    void renderBlock(int n, std::vector<int16_t>& out) {
+        float mixL[kBlockFrames] = { 0 };
+        float mixR[kBlockFrames] = { 0 };
+        float voiceBuffer[kBlockFrames];
+        static const Patch kDrum = { 0, 0.001f, 0.15f, 0.0f, 0.05f };
+
+        for (int v = 0; v < kMaxVoices; v++) {
+            Voice& voice = voices[v];
+            if (voice.stage == STAGE_OFF) {
+                continue;
+            }
+            const Channel& ch = channels[voice.channel];
+            const Patch& patch = voice.drum ? kDrum : kPatches[ch.program >> 3];
+
+            if (voice.drum) {
+                for (int i = 0; i < n; i++) {
+                    voice.noise = voice.noise * 1664525u + 1013904223u;
+                    voiceBuffer[i] = ((int32_t)voice.noise >> 8) * (1.0f / 8388608.0f);
+                }
+            } else {
+                const float* table = gTables[patch.table];
+                double hz = 440.0 * pow(2.0, (voice.note + ch.bendSemitones - 69) / 12.0);
+                double step = hz * kTableSize / kSampleRate;
+                for (int i = 0; i < n; i++) {
+                    int index = (int)voice.phase;
+                    float frac = (float)(voice.phase - index);
+                    voiceBuffer[i] = table[index] + (table[index + 1] - table[index]) * frac;
+                    voice.phase += step;
+                    if (voice.phase >= kTableSize) {
+                        voice.phase -= kTableSize;
+                    }
+                }
+            }
+
+            float envStart = voice.env;
+            float envEnd = advanceEnvelope(voice, patch, n);
+            float level = voice.velocityGain * (ch.volume / 127.0f) * (ch.expression / 127.0f) * kMasterGain;
+            float pan = ch.pan / 127.0f;
+            mixVoice(mixL, mixR, voiceBuffer, envStart, (envEnd - envStart) / n,
+                     level * sqrtf(1.0f - pan), level * sqrtf(pan), n);
+        }
+
+        for (int i = 0; i < n; i++) {
+            out.push_back((int16_t)(std::max(-1.0f, std::min(1.0f, mixL[i])) * 32767));
+            out.push_back((int16_t)(std::max(-1.0f, std::min(1.0f, mixR[i])) * 32767));
+        }
+        frame += n;
+    }
+};
+
+// Incremental MIDI parser: running status, SysEx skipped, real-time bytes ignored
+class MidiParser {
+public:
+    MidiParser() : status(0), count(0), inSysEx(false) {}
+
+    // Returns the message length when b completes a channel message, 0xFF for System Reset
+    int feed(uint8_t b, uint8_t* message) {
+        if (b >= 0xF8) {
+            return (b == 0xFF) ? 0xFF : 0;
+        }
+        if (b & 0x80) {
+            // System messages cancel running status; SysEx data is dropped up to F7 or the
+            // next status byte
+            inSysEx = (b == 0xF0);
+            status = (b < 0xF0) ? b : 0;
+            count = 0;
+            return 0;
+        }
+        if (status == 0 || inSysEx) {
+            return 0;
+        }
+        data[count++] = b;
+        int needed = ((status & 0xF0) == 0xC0 || (status & 0xF0) == 0xD0) ? 1 : 2;
+        if (count < needed) {
+            return 0;
+        }
+        message[0] = status;
+        message[1] = data[0];
+        message[2] = (needed == 2) ? data[1] : 0;
+        count = 0;
+        return needed + 1;
+    }
+
+private:
+    uint8_t status;
+    uint8_t data[2];
+    int count;
+    bool inSysEx;
+};
+
+struct Onset {
+    uint64_t timeUs;
+    uint8_t channel;
+    uint8_t note;
+    uint8_t velocity;
+};
+
+std::vector<Onset> findOnsets(const std::vector<hostsim::CapturedByte>& bytes) {
+    std::vector<Onset> onsets;
+    MidiParser parser;
+    uint8_t m[3];
+    for (size_t i = 0; i < bytes.size(); i++) {
+        int length = parser.feed(bytes[i].value, m);
+        if (length == 3 && (m[0] & 0xF0) == 0x90 && m[2] > 0) {
+            Onset o = { bytes[i].timeUs, (uint8_t)(m[0] & 0x0F), m[1], m[2] };
+            onsets.push_back(o);
+        }
+    }
+    return onsets;
+}
+
+bool writeWav(const char* path, const std::vector<int16_t>& samples) {
+    FILE* f = fopen(path, "wb");
+    if (f == nullptr) {
+        return false;
+    }
+    uint32_t dataBytes = (uint32_t)(samples.size() * sizeof(int16_t));
+    uint32_t riffSize = 36 + dataBytes;
+    uint32_t fmtSize = 16, byteRate = kSampleRate * 4, rate = kSampleRate;
+    uint16_t format = 1, channels = 2, blockAlign = 4, bits = 16;
+    fwrite("RIFF", 1, 4, f);
+    fwrite(&riffSize, 4, 1, f);
+    fwrite("WAVEfmt ", 1, 8, f);
+    fwrite(&fmtSize, 4, 1, f);
+    fwrite(&format, 2, 1, f);
+    fwrite(&channels, 2, 1, f);
+    fwrite(&rate, 4, 1, f);
+    fwrite(&byteRate, 4, 1, f);
+    fwrite(&blockAlign, 2, 1, f);
+    fwrite(&bits, 2, 1, f);
+    fwrite("data", 1, 4, f);
+    fwrite(&dataBytes, 4, 1, f);
+    fwrite(samples.data(), sizeof(int16_t), samples.size(), f);
+    return fclose(f) == 0;
+}
+
+// Render a capture, with two seconds after its last byte for releases; returns the frames
+uint64_t renderCapture(const std::vector<hostsim::CapturedByte>& bytes, std::vector<int16_t>& samples) {
+    buildTables();
+    Renderer renderer;
+    MidiParser parser;
+    uint8_t m[3];
+    for (size_t i = 0; i < bytes.size(); i++) {
+        // Render up to the sample the byte arrived at, so onsets are sample accurate
+        uint64_t target = bytes[i].timeUs * kSampleRate / 1000000;
+        if (target > renderer.frame) {
+            renderer.render((int)(target - renderer.frame), samples);
+        }
+        int length = parser.feed(bytes[i].value, m);
+        if (length == 0xFF) {
+            renderer.reset();
+        } else if (length > 0) {
+            renderer.message(m, length);
+        }
+    }
+    renderer.render(2 * kSampleRate, samples);     // let releases ring out
+    return renderer.frame;
+}
+
+int renderToWav(const std::vector<hostsim::CapturedByte>& bytes, const char* path) {
+    std::vector<int16_t> samples;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    uint64_t frames = renderCapture(bytes, samples);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (!writeWav(path, samples)) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return 1;
+    }
+    double seconds = (double)frames / kSampleRate;
+    printf("rendered %.2f s of audio in %.3f s (%.0fx real time)\n", seconds, elapsed,
+           elapsed > 0 ? seconds / elapsed : 0.0);
+    return 0;
+}
+
+int printOnsets(const std::vector<hostsim::CapturedByte>& bytes) {
+    std::vector<Onset> onsets = findOnsets(bytes);
+    printf("time_s,channel,note,velocity\n");
+    for (size_t i = 0; i < onsets.size(); i++) {
+        printf("%.6f,%u,%u,%u\n", onsets[i].timeUs * 1e-6, onsets[i].channel, onsets[i].note, onsets[i].velocity);
+    }
+    return 0;
+}
+
+// Match the k-th onset of each (channel, note) in both captures and report timing deltas
+int compareOnsets(const std::vector<hostsim::CapturedByte>& bytes, const std::vector<hostsim::CapturedByte>& reference) {
+    std::vector<Onset> a = findOnsets(bytes);
+    std::vector<Onset> b = findOnsets(reference);
+    std::vector<size_t> nextInB(16 * 128, 0);
+    std::vector<double> deltas;
+    size_t unmatched = 0;
+
+    for (size_t i = 0; i < a.size(); i++) {
+        size_t key = a[i].channel * 128 + a[i].note;
+        size_t j = nextInB[key];
+        while (j < b.size() && (b[j].channel != a[i].channel || b[j].note != a[i].note)) {
+            j++;
+        }
+        if (j == b.size()) {
+            unmatched++;
+            nextInB[key] = j;
+            continue;
+        }
+        deltas.push_back(((double)a[i].timeUs - (double)b[j].timeUs) * 1e-3);
+        nextInB[key] = j + 1;
+    }
+
+    printf("onsets: %zu vs %zu reference, %zu matched, %zu unmatched\n", a.size(), b.size(), deltas.size(), unmatched);
+    if (deltas.empty()) {
+        return unmatched > 0 ? 1 : 0;
+    }
+    std::vector<double> magnitudes(deltas.size());
+    double sum = 0;
+    for (size_t i = 0; i < deltas.size(); i++) {
+        sum += deltas[i];
+        magnitudes[i] = fabs(deltas[i]);
+    }
+    std::sort(magnitudes.begin(), magnitudes.end());
+    printf("delta ms: mean %+.3f, |p50| %.3f, |p99| %.3f, |max| %.3f\n", sum / deltas.size(),
+           magnitudes[magnitudes.size() / 2], magnitudes[(magnitudes.size() * 99) / 100], magnitudes.back());
+    return 0;
+}
+
+std::vector<hostsim::CapturedByte> captureOf(const uint8_t* values, size_t size) {
+    std::vector<hostsim::CapturedByte> bytes;
+    for (size_t i = 0; i < size; i++) {
+        hostsim::CapturedByte b = { 0, values[i] };
+        bytes.push_back(b);
+    }
+    return bytes;
+}
+
+std::vector<uint8_t> parseAll(const uint8_t* values, size_t size) {
+    MidiParser parser;
+    std::vector<uint8_t> messages;
+    uint8_t m[3];
+    for (size_t i = 0; i < size; i++) {
+        int length = parser.feed(values[i], m);
+        if (length > 0 && length <= 3) {
+            messages.insert(messages.end(), m, m + length);
+        }
+    }
+    return messages;
+}
+
+// SysEx from the device (setReverb, setMasterVolume) between channel messages: its data must
+// not be played under the running status in front of it
+int selfTest() {
+    int failures = 0;
+    const uint8_t reverb[] = { 0xB0, 0x07, 0x64, 0xF0, 0x41, 0x00, 0x42, 0x12, 0x40, 0x01, 0x35, 0x07, 0x00, 0xF7, 0x90, 0x3C, 0x64 };
+    const uint8_t plain[] = { 0xB0, 0x07, 0x64, 0x90, 0x3C, 0x64 };
+    std::vector<int16_t> withSysEx, without;
+    renderCapture(captureOf(reverb, sizeof(reverb)), withSysEx);
+    renderCapture(captureOf(plain, sizeof(plain)), without);
+    int peak = 0;
+    for (size_t i = 0; i < without.size(); i++) {
+        peak = std::max(peak, abs((int)without[i]));
+    }
+    bool same = peak > 0 && withSysEx == without;
+    printf("  %-48s %s\n", "reverb SysEx leaves CC7 and the note alone", same ? "ok" : "FAIL");
+    failures += same ? 0 : 1;
+
+    struct Case {
+        const char* what;
+        std::vector<uint8_t> bytes;
+        std::vector<uint8_t> expected;
+    };
+    const Case cases[] = {
+        { "master volume SysEx after a program change",
+          { 0xC0, 0x00, 0xF0, 0x7F, 0x7F, 0x04, 0x01, 0x00, 0x64, 0xF7, 0x3C },
+          { 0xC0, 0x00 } },
+        { "real-time byte inside SysEx",
+          { 0xF0, 0x41, 0xF8, 0x10, 0x42, 0xF7, 0x90, 0x3C, 0x64 },
+          { 0x90, 0x3C, 0x64 } },
+        { "SysEx cut short by a status byte",
+          { 0xF0, 0x41, 0x10, 0x90, 0x3C, 0x64, 0x3E, 0x64 },
+          { 0x90, 0x3C, 0x64, 0x90, 0x3E, 0x64 } },
+    };
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        bool ok = parseAll(cases[c].bytes.data(), cases[c].bytes.size()) == cases[c].expected;
+        printf("  %-48s %s\n", cases[c].what, ok ? "ok" : "FAIL");
+        failures += ok ? 0 : 1;
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc == 2 && strcmp(argv[1], "--self-test") == 0) {
+        return selfTest();
+    }
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s capture.txt out.wav | --onsets | --compare reference.txt, or %s --self-test\n", argv[0], argv[0]);
+        return 2;
+    }
+    std::vector<hostsim::CapturedByte> bytes;
+    if (!hostsim::loadCapture(argv[1], bytes)) {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+    if (strcmp(argv[2], "--onsets") == 0) {
+        return printOnsets(bytes);
+    }
+    if (strcmp(argv[2], "--compare") == 0 && argc >= 4) {
+        std::vector<hostsim::CapturedByte> reference;
+        if (!hostsim::loadCapture(argv[3], reference)) {
+            fprintf(stderr, "cannot read %s\n", argv[3]);
+            return 1;
+        }
+        return compareOnsets(bytes, reference);
+    }
+    return renderToWav(bytes, argv[2]);
+}
@@ -0,0 +1,236 @@
+/**
+ * @file M5UnitMLReplay.cpp
+ *
+ * Deterministic replay of a command journal recorded on the device (M5UnitSynth.startJournal,
+ * saved with M5UnitSynth.saveJournal). Every entry is fed to M5UnitML::commandHandler at its
+ * original receive time, to the microsecond, relative to the first entry, with loop() serviced
+ * every tick in between, so a timing glitch seen on hardware can be stepped through on the
+ * desktop. The bytes written to each Unit-Synth UART can be saved as captures for
+ * M5UnitMLRender or the golden suite.
+ *
+ * Journal format, one received command per line (decimal, '#' starts a comment):
+ *     # m5unitml journal v1: receive time in us, opcode, payload bytes
+ *     18734012 3 0 60 100
+ *
+ * Build and run (from this folder):
+ *     g++ -std=c++11 -O2 -I. -I"../../+arduinoioaddons/+M5Stack/src" M5UnitMLReplay.cpp -o m5unitml_replay
+ *     ./m5unitml_replay glitch.journal --out glitch
+ *
+ * Options (defaults in brackets):
+ *     --out prefix      write <prefix>_unit0.txt and <prefix>_unit1.txt captures
+ *     --tick us         loop() interval [100]
+ *     --check           also record the replay in the device journal, run the device's own
+ *                       replay mode (CMD_REPLAY_JOURNAL) and compare its MIDI output with the
+ *                       host replay: same bytes, each within one tick, since the device
+ *                       dispatches replayed commands from loop()
+ *
+ * Exits non-zero when the journal cannot be read or --check finds a difference.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "MidiCapture.h"
+#include "M5UnitML.h"
+
+namespace {
+
+const uint32_t kTailUs = 1000000;       // keep servicing loop() after the last command
+
+struct JournalCommand {
+    uint32_t timeUs;
+    byte id;
+    std::vector<byte> payload;
+};
+
+struct Options {
+    const char* journalPath;
+    const char* outPrefix;
+    uint32_t tickUs;
+    bool check;
+};
+
+bool loadJournal(const char* path, std::vector<JournalCommand>& commands) {
+    FILE* f = fopen(path, "r");
+    if (f == nullptr) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return false;
+    }
+    char line[1024];
+    unsigned lineNumber = 0;
+    bool ok = true;
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        lineNumber++;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        JournalCommand c;
+        unsigned long timeUs;
+        unsigned id;
+        int consumed = 0;
+        if (sscanf(line, "%lu %u%n", &timeUs, &id, &consumed) != 2 || id > 0xFF) {
+            fprintf(stderr, "%s:%u: cannot parse command\n", path, lineNumber);
+            ok = false;
+            break;
+        }
+        c.timeUs = (uint32_t)timeUs;
+        c.id = (byte)id;
+        char* cursor = line + consumed;
+        for (;;) {
+            char* end;
+            unsigned long value = strtoul(cursor, &end, 10);
+            if (end == cursor) {
+                break;
+            }
+            c.payload.push_back((byte)value);
+            cursor = end;
+        }
+        commands.push_back(c);
+    }
+    fclose(f);
+    return ok;
+}
+
+bool parseOptions(int argc, char** argv, Options& o) {
+    o.journalPath = nullptr;
+    o.outPrefix = nullptr;
+    o.tickUs = 100;
+    o.check = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            o.outPrefix = argv[++i];
+        } else if (strcmp(argv[i], "--tick") == 0 && i + 1 < argc) {
+            o.tickUs = (uint32_t)strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(argv[i], "--check") == 0) {
+            o.check = true;
+        } else if (argv[i][0] != '-' && o.journalPath == nullptr) {
+            o.journalPath = argv[i];
+        } else {
+            return false;
+        }
+    }
+    return o.journalPath != nullptr && o.tickUs > 0;
+}
+
+// Service loop() every tick until the virtual clock reaches timeUs
+void runUntil(M5UnitML& device, uint64_t timeUs, uint32_t tickUs) {
+    while (hostsim::clockMicros() < timeUs) {
+        uint64_t step = timeUs - hostsim::clockMicros();
+        hostsim::advanceMicros(step < tickUs ? step : tickUs);
+        device.loop();
+    }
+}
+
+void send(M5UnitML& device, byte id, const std::vector<byte>& payload) {
+    std::vector<byte> data(payload);
+    data.resize(payload.size() + 1);            // never hand the handler a null buffer
+    device.commandHandler(id, data.data(), (unsigned int)payload.size());
+}
+
+// Both UART captures from index start on, with times relative to originUs
+std::vector<hostsim::CapturedByte> streamSince(const std::vector<hostsim::CapturedByte>& captured, size_t start, uint64_t originUs) {
+    std::vector<hostsim::CapturedByte> bytes(captured.begin() + start, captured.end());
+    for (size_t i = 0; i < bytes.size(); i++) {
+        bytes[i].timeUs -= originUs;
+    }
+    return bytes;
+}
+
+// Compare one unit's host and device replay; returns true when the bytes match and none is
+// more than one tick apart
+bool compareReplays(uint8_t unit, const std::vector<hostsim::CapturedByte>& host, const std::vector<hostsim::CapturedByte>& device, uint32_t tickUs) {
+    size_t common = host.size() < device.size() ? host.size() : device.size();
+    uint64_t worstUs = 0;
+    for (size_t i = 0; i < common; i++) {
+        uint64_t skewUs = (host[i].timeUs > device[i].timeUs) ? host[i].timeUs - device[i].timeUs : device[i].timeUs - host[i].timeUs;
+        if (skewUs > worstUs) {
+            worstUs = skewUs;
+        }
+        if (host[i].value != device[i].value || skewUs > tickUs) {
+            printf("  unit %u  FAIL at byte %zu: device %02X @ %llu us, host %02X @ %llu us\n", unit, i,
+                   device[i].value, (unsigned long long)device[i].timeUs, host[i].value, (unsigned long long)host[i].timeUs);
+            return false;
+        }
+    }
+    if (host.size() != device.size()) {
+        printf("  unit %u  FAIL: device replay wrote %zu bytes, host replay %zu\n", unit, device.size(), host.size());
+        return false;
+    }
+    printf("  unit %u  %zu bytes, largest skew %llu us  ok\n", unit, host.size(), (unsigned long long)worstUs);
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options o;
+    if (!parseOptions(argc, argv, o)) {
+        fprintf(stderr, "usage: %s journal [--out prefix] [--tick us] [--check]\n", argv[0]);
+        return 2;
+    }
+    std::vector<JournalCommand> commands;
+    if (!loadJournal(o.journalPath, commands)) {
+        return 1;
+    }
+    if (commands.empty()) {
+        fprintf(stderr, "%s holds no commands\n", o.journalPath);
+        return 1;
+    }
+
+    hostsim::setMicros(0);
+    Serial1.captured.clear();
+    Serial2.captured.clear();
+    MWArduinoClass arduino;
+    M5UnitML device(arduino);
+    if (o.check) {
+        send(device, CMD_SET_JOURNAL, std::vector<byte>(1, 1));
+    }
+
+    // Journal times are the device's micros(), which wraps every 71.6 minutes
+    uint32_t firstUs = commands[0].timeUs;
+    unsigned rejected = 0;
+    for (size_t i = 0; i < commands.size(); i++) {
+        runUntil(device, (uint32_t)(commands[i].timeUs - firstUs), o.tickUs);
+        send(device, commands[i].id, commands[i].payload);
+        if (device.lastResponse[0] == 0) {
+            rejected++;
+        }
+    }
+    runUntil(device, hostsim::clockMicros() + kTailUs, o.tickUs);
+    std::vector<hostsim::CapturedByte> host[M5UNITML_MAX_UNITS] = { Serial2.captured, Serial1.captured };
+
+    printf("%s: %zu commands over %.3f s, %u rejected\n", o.journalPath, commands.size(),
+           (uint32_t)(commands.back().timeUs - firstUs) * 1e-6, rejected);
+    for (uint8_t u = 0; u < M5UNITML_MAX_UNITS; u++) {
+        printf("  unit %u  %zu bytes\n", u, host[u].size());
+        if (o.outPrefix != nullptr && !host[u].empty()) {
+            std::string path = std::string(o.outPrefix) + "_unit" + (char)('0' + u) + ".txt";
+            if (!hostsim::saveCapture(host[u], path.c_str())) {
+                fprintf(stderr, "cannot write %s\n", path.c_str());
+                return 1;
+            }
+        }
+    }
+    if (!o.check) {
+        return 0;
+    }
+
+    // The device replays its own copy of the journal; its output must match the host replay.
+    // The device state it starts from is the one the host replay left behind.
+    if (commands.size() > M5UNITML_JOURNAL_SIZE) {
+        printf("check skipped: %zu commands do not fit the %u entry device journal\n", commands.size(), M5UNITML_JOURNAL_SIZE);
+        return 0;
+    }
+    size_t start[M5UNITML_MAX_UNITS] = { Serial2.captured.size(), Serial1.captured.size() };
+    uint64_t originUs = hostsim::clockMicros();
+    send(device, CMD_REPLAY_JOURNAL, std::vector<byte>(1, 1));
+    runUntil(device, originUs + (uint32_t)(commands.back().timeUs - firstUs) + kTailUs, o.tickUs);
+
+    printf("device replay:\n");
+    bool same = compareReplays(0, host[0], streamSince(Serial2.captured, start[0], originUs), o.tickUs) &
+                compareReplays(1, host[1], streamSince(Serial1.captured, start[1], originUs), o.tickUs);
+    return same ? 0 : 1;
+}
@@ -0,0 +1,421 @@
+/**
+ * @file M5UnitMLSoak.cpp
+ *
+ * Soak and load generator for the host build. Random note and control-change traffic at
+ * configurable densities is sent through M5UnitML::commandHandler for a set (virtual) duration,
+ * either as direct per-message commands or streamed through the event queue the way
+ * M5UnitSynth.streamEvents does. Each host command costs one link round trip.
+ *
+ * The captured UART output is replayed through a 31250 baud wire model and matched back to the
+ * generated messages, which gives the delivered throughput against the link budget, messages
+ * that never reached a unit, and the lateness of each message at the end of its wire time
+ * (its own transmission time excluded) as percentiles. The model queues bytes without limit
+ * where the firmware's UART write would block, so past 100% of the link the backlog grows. The device queue high-water mark, the
+ * deepest UART backlog and the device object footprint stand in for memory high-water marks;
+ * M5UnitSynth.soakTest runs the same load against real hardware and reads heap and stack.
+ *
+ * Build and run (from this folder):
+ *     g++ -std=c++11 -O2 -I. -I"../../+arduinoioaddons/+M5Stack/src" M5UnitMLSoak.cpp -o m5unitml_soak
+ *     ./m5unitml_soak --duration 600 --notes 40 --cc 20 --units 2
+ *
+ * Options (defaults in brackets):
+ *     --duration s      virtual run time [60]
+ *     --notes n         note-ons per second over all channels [20]
+ *     --cc n            expression changes per second over all channels [10]
+ *     --note-length ms  note duration [100]
+ *     --units n         Unit-Synth modules, 1 or 2 [1]
+ *     --channels n      logical channels used, up to 16 per unit [16 per unit]
+ *     --mode m          queue or direct [queue]
+ *     --rtt us          host link round trip per command [2000]
+ *     --lead ms         queue start delay after the first fill [100]
+ *     --tick us         loop() interval [100]
+ *     --seed n          traffic seed [1]
+ *
+ * Exits non-zero when any generated message was not delivered.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "M5UnitML.h"
+
+namespace {
+
+const uint32_t kWireUsPerByte = 320;    // 10 bits per byte at 31250 baud
+const uint32_t kPollIntervalUs = 20000; // M5UnitSynth.STREAM_POLL_INTERVAL
+const uint32_t kTailUs = 1000000;       // keep servicing loop() after the last message
+const uint8_t kEventBatch = 8;          // M5UnitSynth.EVENT_BATCH
+const uint8_t kExpression = 0x0B;
+
+struct Options {
+    double durationS;
+    double noteRate;
+    double ccRate;
+    uint32_t noteLengthMs;
+    uint8_t units;
+    uint8_t channels;
+    bool queue;
+    uint32_t rttUs;
+    uint32_t leadMs;
+    uint32_t tickUs;
+    uint32_t seed;
+};
+
+// One generated channel message, due at timeUs after the start of the run
+struct Message {
+    uint64_t timeUs;
+    uint8_t status;                     // type only; the channel is in logical
+    uint8_t data1;
+    uint8_t data2;
+    uint8_t logical;
+};
+
+// Wire replay of one unit's UART
+struct UnitWire {
+    size_t bytes;
+    size_t peakBacklog;                 // bytes written but not yet on the wire, at worst
+    size_t delivered;                   // generated messages matched on this unit
+    size_t other;                       // messages not generated by the soak (begin, resets)
+};
+
+// Generated messages per (unit, type, channel, data1), oldest first
+typedef std::map<uint32_t, std::deque<uint64_t> > Pending;
+
+class Random {
+public:
+    explicit Random(uint32_t seed) : state(seed != 0 ? seed : 1) {}
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    double uniform() { return (next() + 0.5) / 4294967296.0; }
+    uint8_t range(uint8_t low, uint8_t high) { return (uint8_t)(low + next() % (high - low + 1u)); }
+    double exponential(double rate) { return -log(uniform()) / rate; }
+
+private:
+    uint32_t state;
+};
+
+bool messageBefore(const Message& a, const Message& b) {
+    return a.timeUs < b.timeUs;
+}
+
+// Poisson note and expression traffic on a 1 ms grid (the queue's resolution), sorted by time
+std::vector<Message> generate(const Options& o) {
+    Random random(o.seed);
+    std::vector<Message> messages;
+    uint64_t endUs = (uint64_t)(o.durationS * 1e6);
+    if (o.noteRate > 0) {
+        for (double t = random.exponential(o.noteRate); t * 1e6 < endUs; t += random.exponential(o.noteRate)) {
+            Message on = { (uint64_t)(t * 1e3) * 1000u, 0x90, random.range(36, 95), random.range(40, 127),
+                           random.range(0, o.channels - 1) };
+            Message off = on;
+            off.timeUs += o.noteLengthMs * 1000u;
+            off.status = 0x80;
+            off.data2 = 0;
+            messages.push_back(on);
+            messages.push_back(off);
+        }
+    }
+    if (o.ccRate > 0) {
+        for (double t = random.exponential(o.ccRate); t * 1e6 < endUs; t += random.exponential(o.ccRate)) {
+            Message cc = { (uint64_t)(t * 1e3) * 1000u, 0xB0, kExpression, random.range(0, 127),
+                           random.range(0, o.channels - 1) };
+            messages.push_back(cc);
+        }
+    }
+    // Stable, so a note off generated before a note on at the same time keeps its place
+    std::stable_sort(messages.begin(), messages.end(), messageBefore);
+    return messages;
+}
+
+class Harness {
+public:
+    Harness(const Options& options) : o(options), device(arduino), commands(0), rejected(0) {}
+
+    // Advance virtual time to t, running loop() every tick on the way
+    void runUntil(uint64_t t) {
+        while (hostsim::clockMicros() + o.tickUs <= t) {
+            hostsim::advanceMicros(o.tickUs);
+            device.loop();
+        }
+        if (hostsim::clockMicros() < t) {
+            hostsim::setMicros(t);
+            device.loop();
+        }
+    }
+
+    // One host command: half a round trip to reach the device, half for the ack
+    void send(byte id, std::vector<byte> payload) {
+        runUntil(hostsim::clockMicros() + o.rttUs / 2);
+        unsigned int size = (unsigned int)payload.size();
+        payload.resize(size + 1);
+        device.commandHandler(id, payload.data(), size);
+        commands++;
+        if (device.lastResponse[0] == 0) {
+            rejected++;
+        }
+        runUntil(hostsim::clockMicros() + o.rttUs - o.rttUs / 2);
+    }
+
+    uint8_t freeSlots() const { return device.lastResponse[device.lastResponseSize - 1]; }
+
+    const Options& o;
+    MWArduinoClass arduino;
+    M5UnitML device;
+    unsigned commands;
+    unsigned rejected;
+};
+
+void beginUnits(Harness& h) {
+    static const byte pins[2][2] = { { 13, 14 }, { 33, 32 } };
+    for (uint8_t u = 0; u < h.o.units; u++) {
+        byte payload[] = { pins[u][0], pins[u][1], 0x12, 0x7A, u };
+        h.send(CMD_BEGIN, std::vector<byte>(payload, payload + sizeof(payload)));
+    }
+}
+
+// Each message as its own command, sent when due or as soon as the link is free
+void runDirect(Harness& h, const std::vector<Message>& messages, uint64_t& originUs) {
+    originUs = hostsim::clockMicros() + h.o.leadMs * 1000u;
+    for (size_t i = 0; i < messages.size(); i++) {
+        const Message& m = messages[i];
+        h.runUntil(originUs + m.timeUs);
+        if (m.status == 0xB0) {
+            byte payload[] = { m.logical, m.data2 };
+            h.send(CMD_SET_EXPRESSION, std::vector<byte>(payload, payload + sizeof(payload)));
+        } else {
+            byte payload[] = { m.logical, m.data1, m.data2 };
+            h.send(m.status == 0x90 ? CMD_SET_NOTE_ON : CMD_SET_NOTE_OFF, std::vector<byte>(payload, payload + sizeof(payload)));
+        }
+    }
+}
+
+void sendBatch(Harness& h, const std::vector<Message>& messages, size_t& sent) {
+    uint8_t count = (uint8_t)std::min<size_t>(std::min(kEventBatch, h.freeSlots()), messages.size() - sent);
+    std::vector<byte> payload(1, count);
+    for (uint8_t k = 0; k < count; k++) {
+        const Message& m = messages[sent + k];
+        uint32_t timeMs = (uint32_t)(m.timeUs / 1000);
+        byte event[M5UNITML_EVENT_BYTES] = { (byte)timeMs, (byte)(timeMs >> 8), (byte)(timeMs >> 16), (byte)(timeMs >> 24),
+                                             (byte)(m.status | (m.logical & 0x0F)), m.data1, m.data2, (byte)(m.logical >> 4) };
+        payload.insert(payload.end(), event, event + sizeof(event));
+    }
+    h.send(CMD_QUEUE_EVENTS, payload);
+    sent += h.device.lastResponse[1];
+}
+
+// Fill the queue, start it, then top it up from the credit in every ack (streamEvents)
+void runQueue(Harness& h, const std::vector<Message>& messages, uint64_t& originUs) {
+    size_t sent = 0;
+    while (sent < messages.size() && h.freeSlots() > 0) {
+        sendBatch(h, messages, sent);
+    }
+    originUs = hostsim::clockMicros() + h.o.rttUs / 2 + h.o.leadMs * 1000u;
+    uint32_t leadMs = h.o.leadMs;
+    byte start[] = { (byte)leadMs, (byte)(leadMs >> 8), (byte)(leadMs >> 16), (byte)(leadMs >> 24) };
+    h.send(CMD_QUEUE_START, std::vector<byte>(start, start + sizeof(start)));
+    while (sent < messages.size()) {
+        if (h.freeSlots() == 0) {
+            h.runUntil(hostsim::clockMicros() + kPollIntervalUs);
+            h.send(CMD_QUEUE_EVENTS, std::vector<byte>(1, 0));
+            continue;
+        }
+        sendBatch(h, messages, sent);
+    }
+}
+
+uint32_t messageKey(uint8_t unit, uint8_t status, uint8_t data1, uint8_t data2) {
+    uint8_t type = status & 0xF0;
+    if (type == 0x90 && data2 == 0) {
+        type = 0x80;
+    }
+    return ((uint32_t)unit << 24) | ((uint32_t)type << 16) | ((uint32_t)(status & 0x0F) << 8) | data1;
+}
+
+// Replay a capture at 31250 baud, parse it (running status, SysEx and real-time bytes included)
+// and match each channel message to the oldest pending generated message of the same key
+UnitWire replayWire(uint8_t unit, const std::vector<hostsim::CapturedByte>& bytes, Pending& pending,
+                    std::vector<double>& latenessUs) {
+    UnitWire wire = { bytes.size(), 0, 0, 0 };
+    uint64_t wireEnd = 0;
+    uint8_t running = 0;
+    uint8_t data[2] = { 0, 0 };
+    uint8_t count = 0;
+    bool sysex = false;
+    for (size_t i = 0; i < bytes.size(); i++) {
+        const hostsim::CapturedByte& b = bytes[i];
+        size_t backlog = (wireEnd > b.timeUs) ? (size_t)((wireEnd - b.timeUs + kWireUsPerByte - 1) / kWireUsPerByte) : 0;
+        wire.peakBacklog = std::max(wire.peakBacklog, backlog);
+        wireEnd = std::max(wireEnd, b.timeUs) + kWireUsPerByte;
+
+        if (b.value >= 0xF8) {
+            continue;
+        }
+        if (b.value >= 0x80) {
+            sysex = (b.value == 0xF0);
+            running = (b.value < 0xF0) ? b.value : 0;
+            count = 0;
+            continue;
+        }
+        if (sysex || running == 0) {
+            continue;
+        }
+        data[count++] = b.value;
+        uint8_t length = ((running & 0xF0) == 0xC0 || (running & 0xF0) == 0xD0) ? 1 : 2;
+        if (count < length) {
+            continue;
+        }
+        count = 0;
+        Pending::iterator it = pending.find(messageKey(unit, running, data[0], data[1]));
+        if (it == pending.end() || it->second.empty()) {
+            wire.other++;
+            continue;
+        }
+        // Lateness at the end of the message, less its own transmission time
+        latenessUs.push_back((double)wireEnd - (double)it->second.front() - (1 + length) * kWireUsPerByte);
+        it->second.pop_front();
+        wire.delivered++;
+    }
+    return wire;
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = (size_t)ceil(p / 100 * sorted.size());
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+uint32_t responseUInt32(const M5UnitML& device, unsigned offset) {
+    return device.lastResponse[offset] | (device.lastResponse[offset + 1] << 8) |
+           (device.lastResponse[offset + 2] << 16) | ((uint32_t)device.lastResponse[offset + 3] << 24);
+}
+
+bool parseOptions(int argc, char** argv, Options& o) {
+    o.durationS = 60;
+    o.noteRate = 20;
+    o.ccRate = 10;
+    o.noteLengthMs = 100;
+    o.units = 1;
+    o.channels = 0;
+    o.queue = true;
+    o.rttUs = 2000;
+    o.leadMs = 100;
+    o.tickUs = 100;
+    o.seed = 1;
+    for (int i = 1; i < argc; i++) {
+        const char* value = (i + 1 < argc) ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        }
+        if (strcmp(argv[i], "--duration") == 0) {
+            o.durationS = atof(value);
+        } else if (strcmp(argv[i], "--notes") == 0) {
+            o.noteRate = atof(value);
+        } else if (strcmp(argv[i], "--cc") == 0) {
+            o.ccRate = atof(value);
+        } else if (strcmp(argv[i], "--note-length") == 0) {
+            o.noteLengthMs = (uint32_t)strtoul(value, nullptr, 10);
+        } else if (strcmp(argv[i], "--units") == 0) {
+            o.units = (uint8_t)strtoul(value, nullptr, 10);
+        } else if (strcmp(argv[i], "--channels") == 0) {
+            o.channels = (uint8_t)strtoul(value, nullptr, 10);
+        } else if (strcmp(argv[i], "--mode") == 0) {
+            if (strcmp(value, "queue") != 0 && strcmp(value, "direct") != 0) {
+                return false;
+            }
+            o.queue = (strcmp(value, "queue") == 0);
+        } else if (strcmp(argv[i], "--rtt") == 0) {
+            o.rttUs = (uint32_t)strtoul(value, nullptr, 10);
+        } else if (strcmp(argv[i], "--lead") == 0) {
+            o.leadMs = (uint32_t)strtoul(value, nullptr, 10);
+        } else if (strcmp(argv[i], "--tick") == 0) {
+            o.tickUs = (uint32_t)strtoul(value, nullptr, 10);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            o.seed = (uint32_t)strtoul(value, nullptr, 10);
+        } else {
+            return false;
+        }
+        i++;
+    }
+    if (o.channels == 0) {
+        o.channels = (uint8_t)(16 * o.units);
+    }
+    return o.durationS > 0 && o.noteRate >= 0 && o.ccRate >= 0 && o.units >= 1 && o.units <= M5UNITML_MAX_UNITS &&
+           o.channels >= 1 && o.channels <= 16 * o.units && o.tickUs > 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options o;
+    if (!parseOptions(argc, argv, o)) {
+        fprintf(stderr, "usage: %s [--duration s] [--notes n] [--cc n] [--note-length ms] [--units n] [--channels n]\n"
+                        "       [--mode queue|direct] [--rtt us] [--lead ms] [--tick us] [--seed n]\n", argv[0]);
+        return 2;
+    }
+    std::vector<Message> messages = generate(o);
+
+    hostsim::setMicros(0);
+    Serial1.captured.clear();
+    Serial2.captured.clear();
+    Harness h(o);
+    beginUnits(h);
+    uint64_t originUs = 0;
+    if (o.queue) {
+        runQueue(h, messages, originUs);
+    } else {
+        runDirect(h, messages, originUs);
+    }
+    unsigned commands = h.commands;
+    unsigned rejected = h.rejected;
+    uint64_t lastUs = originUs + (messages.empty() ? 0 : messages.back().timeUs);
+    h.runUntil(std::max<uint64_t>(hostsim::clockMicros(), lastUs) + kTailUs);
+    double spanS = (hostsim::clockMicros() - originUs) * 1e-6;
+
+    Pending pending;
+    for (size_t i = 0; i < messages.size(); i++) {
+        const Message& m = messages[i];
+        pending[messageKey(m.logical / 16, m.status | (m.logical % 16), m.data1, m.data2)].push_back(originUs + m.timeUs);
+    }
+    std::vector<double> latenessUs;
+    UnitWire wires[M5UNITML_MAX_UNITS];
+    size_t delivered = 0;
+    for (uint8_t u = 0; u < o.units; u++) {
+        wires[u] = replayWire(u, (u == 0) ? Serial2.captured : Serial1.captured, pending, latenessUs);
+        delivered += wires[u].delivered;
+    }
+    size_t lost = messages.size() - delivered;
+    std::sort(latenessUs.begin(), latenessUs.end());
+
+    h.send(CMD_GET_QUEUE_STATS, std::vector<byte>());
+    unsigned highWater = h.device.lastResponse[1] | (h.device.lastResponse[2] << 8);
+
+    printf("%s mode, %.1f s, %u unit(s), %u channels, %.1f notes/s, %.1f cc/s, seed %u\n",
+           o.queue ? "queue" : "direct", o.durationS, o.units, o.channels, o.noteRate, o.ccRate, o.seed);
+    printf("  generated  %zu messages\n", messages.size());
+    printf("  commands   %u sent (%.1f/s), %u rejected\n", commands, commands / spanS, rejected);
+    printf("  delivered  %zu messages (%.1f/s), %zu lost\n", delivered, delivered / spanS, lost);
+    for (uint8_t u = 0; u < o.units; u++) {
+        printf("  unit %u     %zu bytes (%.1f B/s, %.1f%% of the link), peak UART backlog %zu bytes, %zu other messages\n",
+               u, wires[u].bytes, wires[u].bytes / spanS, 100.0 * wires[u].bytes * kWireUsPerByte * 1e-6 / spanS,
+               wires[u].peakBacklog, wires[u].other);
+    }
+    printf("  lateness   p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+           percentile(latenessUs, 50) * 1e-3, percentile(latenessUs, 90) * 1e-3,
+           percentile(latenessUs, 99) * 1e-3, percentile(latenessUs, 100) * 1e-3);
+    printf("  queue      high water %u/%u, underruns %u, overflows %u, drains %u\n", highWater, M5UNITML_EVENT_QUEUE_SIZE,
+           responseUInt32(h.device, 9), responseUInt32(h.device, 13), responseUInt32(h.device, 17));
+    printf("  memory     device object %zu bytes (heap and stack: M5UnitSynth.getMemory on hardware)\n", sizeof(M5UnitML));
+    return lost > 0 ? 1 : 0;
+}
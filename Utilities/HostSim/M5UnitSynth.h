@@ -0,0 +1,152 @@
+/**
+ * @file M5UnitSynth.h
+ *
+ * Host stand-in for the M5Unit-Synth library (https://github.com/m5stack/M5Unit-Synth).
+ * Each call writes the same kind of MIDI message sequence the library sends to the SAM2695
+ * (channel messages, RPN/NRPN chains and GS SysEx), so byte counts and ordering captured on
+ * the stubbed Serial2 are representative. Re-check against the installed library when the
+ * golden traces are regenerated.
+ */
+
+#ifndef M5UNITML_HOSTSIM_M5UNITSYNTH_H
+#define M5UNITML_HOSTSIM_M5UNITSYNTH_H
+
+#include "Arduino.h"
+
+#define UNIT_SYNTH_BAUD 31250
+
+class M5UnitSynth {
+private:
+    HardwareSerial* _serial;
+
+    void cc(uint8_t channel, uint8_t control, uint8_t value) {
+        uint8_t cmd[] = { (uint8_t)(0xB0 | (channel & 0x0F)), control, (uint8_t)(value & 0x7F) };
+        sendCMD(cmd, sizeof(cmd));
+    }
+    void nrpn(uint8_t channel, uint8_t msb, uint8_t lsb, uint8_t value) {
+        cc(channel, 0x63, msb);
+        cc(channel, 0x62, lsb);
+        cc(channel, 0x06, value);
+    }
+    void gsParam(uint8_t addr1, uint8_t addr2, uint8_t value) {
+        uint8_t sum = (uint8_t)(0x40 + addr1 + addr2 + value);
+        uint8_t cmd[] = { 0xF0, 0x41, 0x00, 0x42, 0x12, 0x40, addr1, addr2, (uint8_t)(value & 0x7F),
+                          (uint8_t)((128 - (sum & 0x7F)) & 0x7F), 0xF7 };
+        sendCMD(cmd, sizeof(cmd));
+    }
+
+public:
+    M5UnitSynth() : _serial(nullptr) {}
+
+    void begin(HardwareSerial* serial = &Serial2, int baud = UNIT_SYNTH_BAUD, uint8_t RX = 16, uint8_t TX = 17) {
+        _serial = serial;
+        _serial->begin(baud, SERIAL_8N1, RX, TX);
+    }
+
+    void sendCMD(uint8_t* cmd, int len) {
+        if (_serial != nullptr) {
+            _serial->write(cmd, len);
+        }
+    }
+
+    void setInstrument(uint8_t bank, uint8_t channel, uint8_t value) {
+        cc(channel, 0x00, bank);
+        uint8_t cmd[] = { (uint8_t)(0xC0 | (channel & 0x0F)), (uint8_t)(value & 0x7F) };
+        sendCMD(cmd, sizeof(cmd));
+    }
+    void setNoteOn(uint8_t channel, uint8_t pitch, uint8_t velocity) {
+        uint8_t cmd[] = { (uint8_t)(0x90 | (channel & 0x0F)), (uint8_t)(pitch & 0x7F), (uint8_t)(velocity & 0x7F) };
+        sendCMD(cmd, sizeof(cmd));
+    }
+    void setNoteOff(uint8_t channel, uint8_t pitch, uint8_t velocity) {
+        (void)velocity;
+        uint8_t cmd[] = { (uint8_t)(0x80 | (channel & 0x0F)), (uint8_t)(pitch & 0x7F), 0x00 };
+        sendCMD(cmd, sizeof(cmd));
+    }
+    void setAllNotesOff(uint8_t channel) { cc(channel, 0x7B, 0x00); }
+    void setPitchBend(uint8_t channel, int value) {
+        int v = value + 8192;
+        if (v < 0) v = 0;
+        if (v > 0x3FFF) v = 0x3FFF;
+        uint8_t cmd[] = { (uint8_t)(0xE0 | (channel & 0x0F)), (uint8_t)(v & 0x7F), (uint8_t)((v >> 7) & 0x7F) };
+        sendCMD(cmd, sizeof(cmd));
+    }
+    void setPitchBendRange(uint8_t channel, uint8_t value) {
+        cc(channel, 0x65, 0x00);
+        cc(channel, 0x64, 0x00);
+        cc(channel, 0x06, value);
+    }
+    void setMasterVolume(uint8_t level) {
+        uint8_t cmd[] = { 0xF0, 0x7F, 0x7F, 0x04, 0x01, 0x00, (uint8_t)(level & 0x7F), 0xF7 };
+        sendCMD(cmd, sizeof(cmd));
+    }
+    void setVolume(uint8_t channel, uint8_t level) { cc(channel, 0x07, level); }
+    void setExpression(uint8_t channel, uint8_t expression) { cc(channel, 0x0B, expression); }
+    void setReverb(uint8_t channel, uint8_t program, uint8_t level, uint8_t delayfeedback) {
+        cc(channel, 0x50, program);
+        cc(channel, 0x5B, level);
+        gsParam(0x01, 0x35, delayfeedback);
+    }
+    void setChorus(uint8_t channel, uint8_t program, uint8_t level, uint8_t feedback, uint8_t chorusdelay) {
+        cc(channel, 0x51, program);
+        cc(channel, 0x5D, level);
+        gsParam(0x01, 0x3B, feedback);
+        gsParam(0x01, 0x3C, chorusdelay);
+    }
+    void setPan(uint8_t channel, uint8_t value) { cc(channel, 0x0A, value); }
+    void setEqualizer(uint8_t channel, uint8_t lowband, uint8_t medlowband, uint8_t medhighband, uint8_t highband,
+                      uint8_t lowfreq, uint8_t medlowfreq, uint8_t medhighfreq, uint8_t highfreq) {
+        nrpn(channel, 0x37, 0x00, lowband);
+        nrpn(channel, 0x37, 0x01, medlowband);
+        nrpn(channel, 0x37, 0x02, medhighband);
+        nrpn(channel, 0x37, 0x03, highband);
+        nrpn(channel, 0x37, 0x08, lowfreq);
+        nrpn(channel, 0x37, 0x09, medlowfreq);
+        nrpn(channel, 0x37, 0x0A, medhighfreq);
+        nrpn(channel, 0x37, 0x0B, highfreq);
+    }
+    void setTuning(uint8_t channel, uint8_t fine, uint8_t coarse) {
+        cc(channel, 0x65, 0x00);
+        cc(channel, 0x64, 0x01);
+        cc(channel, 0x06, fine);
+        cc(channel, 0x65, 0x00);
+        cc(channel, 0x64, 0x02);
+        cc(channel, 0x06, coarse);
+    }
+    void setVibrate(uint8_t channel, uint8_t rate, uint8_t depth, uint8_t delay) {
+        nrpn(channel, 0x01, 0x08, rate);
+        nrpn(channel, 0x01, 0x09, depth);
+        nrpn(channel, 0x01, 0x0A, delay);
+    }
+    void setTvf(uint8_t channel, uint8_t cutoff, uint8_t resonance) {
+        nrpn(channel, 0x01, 0x20, cutoff);
+        nrpn(channel, 0x01, 0x21, resonance);
+    }
+    void setEnvelope(uint8_t channel, uint8_t attack, uint8_t decay, uint8_t release) {
+        nrpn(channel, 0x01, 0x63, attack);
+        nrpn(channel, 0x01, 0x64, decay);
+        nrpn(channel, 0x01, 0x66, release);
+    }
+    void setModWheel(uint8_t channel, uint8_t pitch, uint8_t tvtcutoff, uint8_t amplitude, uint8_t rate,
+                     uint8_t pitchdepth, uint8_t tvfdepth, uint8_t tvadepth) {
+        uint8_t part = (uint8_t)(0x10 | (channel & 0x0F));
+        gsParam(part, 0x00, pitch);
+        gsParam(part, 0x01, tvtcutoff);
+        gsParam(part, 0x02, amplitude);
+        gsParam(part, 0x03, rate);
+        gsParam(part, 0x04, pitchdepth);
+        gsParam(part, 0x05, tvfdepth);
+        gsParam(part, 0x06, tvadepth);
+    }
+    void setAllInstrumentDrums() {
+        for (uint8_t ch = 0; ch < 16; ch++) {
+            gsParam((uint8_t)(0x10 | ch), 0x15, 0x01);
+        }
+    }
+    void reset() {
+        uint8_t cmd[] = { 0xFF };
+        sendCMD(cmd, sizeof(cmd));
+    }
+};
+
+#endif // M5UNITML_HOSTSIM_M5UNITSYNTH_H
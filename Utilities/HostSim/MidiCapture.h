@@ -0,0 +1,77 @@
+/**
+ * @file MidiCapture.h
+ *
+ * Text format for MIDI byte streams captured from the stubbed UARTs of the host build.
+ * One line per write burst: the timestamp in microseconds followed by the bytes in hex,
+ *
+ *     # m5unitml capture v1
+ *     1000 90 3C 64
+ *     500000 80 3C 00
+ *
+ * Lines starting with '#' are comments. The format is diff-friendly so captures can be
+ * checked in as golden files.
+ */
+
+#ifndef M5UNITML_HOSTSIM_MIDICAPTURE_H
+#define M5UNITML_HOSTSIM_MIDICAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+
+namespace hostsim {
+
+    inline bool saveCapture(const std::vector<CapturedByte>& bytes, const char* path) {
+        FILE* f = fopen(path, "w");
+        if (f == nullptr) {
+            return false;
+        }
+        fprintf(f, "# m5unitml capture v1\n");
+        for (size_t i = 0; i < bytes.size(); i++) {
+            if (i == 0 || bytes[i].timeUs != bytes[i - 1].timeUs) {
+                if (i > 0) {
+                    fprintf(f, "\n");
+                }
+                fprintf(f, "%llu", (unsigned long long)bytes[i].timeUs);
+            }
+            fprintf(f, " %02X", bytes[i].value);
+        }
+        if (!bytes.empty()) {
+            fprintf(f, "\n");
+        }
+        return fclose(f) == 0;
+    }
+
+    inline bool loadCapture(const char* path, std::vector<CapturedByte>& bytes) {
+        FILE* f = fopen(path, "r");
+        if (f == nullptr) {
+            return false;
+        }
+        char line[4096];
+        while (fgets(line, sizeof(line), f) != nullptr) {
+            if (line[0] == '#' || line[0] == '\n') {
+                continue;
+            }
+            char* cursor = line;
+            unsigned long long timeUs = strtoull(cursor, &cursor, 10);
+            for (;;) {
+                char* end;
+                unsigned long value = strtoul(cursor, &end, 16);
+                if (end == cursor) {
+                    break;
+                }
+                CapturedByte b = { (uint64_t)timeUs, (uint8_t)value };
+                bytes.push_back(b);
+                cursor = end;
+            }
+        }
+        fclose(f);
+        return true;
+    }
+}
+
+#endif // M5UNITML_HOSTSIM_MIDICAPTURE_H
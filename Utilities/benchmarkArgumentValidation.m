@@ -0,0 +1,33 @@
+%% benchmarkArgumentValidation.m
+% ==================================================================================================
+% Times the MATLAB-side argument checks of M5UnitSynth with timeit: one validateattributes call per
+% argument (the previous behaviour) against the single vectorized range check now used by the
+% per-message methods. If a connected 'synth' add-on exists in the workspace, whole setEqualizer
+% calls are also timed with 'Validate' on and off.
+% ==================================================================================================
+disp('Running: benchmarkArgumentValidation.m')
+
+names = {'channel', 'lowband', 'medlowband', 'medhighband', 'highband', 'lowfreq', 'medlowfreq', 'medhighfreq', 'highfreq'};
+args = {0, 64, 64, 64, 64, 32, 48, 80, 96};
+upper = [15, repmat(127, 1, 8)];
+
+tPerArgument = timeit(@() validateEach(names, upper, args));
+tVectorized = timeit(@() arduinoioaddons.M5Stack.M5UnitSynth.bytesInRange(upper, args{:}));
+fprintf('setEqualizer arguments: %.2f us per-argument, %.2f us vectorized (%.0fx)\n', ...
+    tPerArgument * 1e6, tVectorized * 1e6, tPerArgument / tVectorized);
+
+if exist('synth', 'var')
+    validate = synth.Validate;
+    synth.Validate = true;
+    tOn = timeit(@() synth.setEqualizer(args{:}));
+    synth.Validate = false;
+    tOff = timeit(@() synth.setEqualizer(args{:}));
+    synth.Validate = validate;
+    fprintf('setEqualizer round trip: %.3f ms validated, %.3f ms with Validate off\n', tOn * 1e3, tOff * 1e3);
+end
+
+function validateEach(names, upper, args)
+    for k = 1:numel(args)
+        validateattributes(args{k}, {'numeric'}, {'scalar', '>=', 0, '<=', upper(k)}, 'setEqualizer', names{k});
+    end
+end
@@ -0,0 +1,114 @@
+%% readScalaTuning.m
+% ==================================================================================================
+% Reads a Scala scale (.scl) and, optionally, a Scala keyboard mapping (.kbm) and returns the pitch
+% of every MIDI key as a fractional MIDI note number, ready for M5UnitSynth.setTuningTable. Scale
+% degrees given with a '.' are in cents, all others are ratios ("3/2" or "2"); the last degree is
+% the period of the scale. Without a mapping, key 60 plays degree 0 at middle C (261.63 Hz) and
+% each key up plays the next degree.
+%
+%   pitches = readScalaTuning('partch_43.scl', 'partch_43.kbm');
+%   synth.setTuningTable(0, pitches);
+%
+% Keys the mapping leaves out, marked 'x' or outside its first/last key, are NaN.
+% ==================================================================================================
+function [pitches, description] = readScalaTuning(sclFile, kbmFile)
+    [degrees, description] = readScale(sclFile);
+    n = numel(degrees);
+    if nargin < 2 || isempty(kbmFile)
+        map = struct('first', 0, 'last', 127, 'middle', 60, 'referenceKey', 60, ...
+                     'referenceHz', 440 * 2^(-9/12), 'octaveDegree', n, 'degrees', []);
+    else
+        map = readMapping(kbmFile);
+        if map.octaveDegree == 0
+            map.octaveDegree = n;
+        end
+    end
+
+    % Cents of any degree, including ones beyond the period
+    withinPeriod = [0, degrees(1:end - 1)];
+    scaleCents = @(d) floor(d / n) * degrees(end) + withinPeriod(mod(d, n) + 1);
+    keyCents = arrayfun(@(key) mappedCents(key, map, scaleCents), 0:127);
+    referenceCents = mappedCents(map.referenceKey, map, scaleCents);
+    if isnan(referenceCents)
+        error('readScalaTuning:UnmappedReference', 'The reference key %d is not mapped.', map.referenceKey);
+    end
+    pitches = 69 + 12 * log2(map.referenceHz / 440) + (keyCents - referenceCents) / 100;
+end
+
+function cents = mappedCents(key, map, scaleCents)
+    cents = NaN;
+    if key < map.first || key > map.last
+        return;
+    end
+    offset = key - map.middle;
+    if isempty(map.degrees)
+        cents = scaleCents(offset);                     % linear mapping
+        return;
+    end
+    mapSize = numel(map.degrees);
+    degree = map.degrees(mod(offset, mapSize) + 1);
+    if ~isnan(degree)
+        cents = floor(offset / mapSize) * scaleCents(map.octaveDegree) + scaleCents(degree);
+    end
+end
+
+function [degrees, description] = readScale(file)
+    lines = dataLines(file, false);
+    if numel(lines) < 2
+        error('readScalaTuning:BadScale', '%s is not a Scala scale file.', file);
+    end
+    description = strtrim(lines{1});
+    count = str2double(strtok(lines{2}));
+    values = lines(3:end);
+    values = values(~cellfun(@isempty, strtrim(values)));
+    if isnan(count) || count < 1 || numel(values) < count
+        error('readScalaTuning:BadScale', '%s should list %d degrees.', file, count);
+    end
+    degrees = zeros(1, count);
+    for k = 1:count
+        token = strtok(values{k});
+        if any(token == '.')
+            degrees(k) = str2double(token);
+        else
+            parts = str2double(strsplit(token, '/'));
+            if numel(parts) == 1
+                parts(2) = 1;
+            end
+            degrees(k) = 1200 * log2(parts(1) / parts(2));
+        end
+        if ~isfinite(degrees(k))
+            error('readScalaTuning:BadScale', '%s: cannot read degree "%s".', file, token);
+        end
+    end
+end
+
+function map = readMapping(file)
+    lines = dataLines(file, true);
+    if numel(lines) < 7
+        error('readScalaTuning:BadMapping', '%s is not a Scala keyboard mapping file.', file);
+    end
+    header = str2double(cellfun(@strtok, lines(1:7), 'UniformOutput', false));
+    map = struct('first', header(2), 'last', header(3), 'middle', header(4), 'referenceKey', header(5), ...
+                 'referenceHz', header(6), 'octaveDegree', header(7), 'degrees', []);
+    mapSize = header(1);
+    entries = lines(8:end);
+    if any(isnan(header)) || numel(entries) < mapSize
+        error('readScalaTuning:BadMapping', '%s should map %d keys.', file, mapSize);
+    end
+    % 'x' leaves a key silent; str2double turns it into NaN
+    map.degrees = str2double(cellfun(@strtok, entries(1:mapSize), 'UniformOutput', false));
+    if mapSize > 0 && all(isnan(map.degrees))
+        error('readScalaTuning:BadMapping', '%s maps no keys.', file);
+    end
+end
+
+% Lines of a Scala file without '!' comments (and without blank lines when asked: the scale
+% description may itself be blank)
+function lines = dataLines(file, dropBlank)
+    text = fileread(file);
+    lines = regexp(text, '\r?\n', 'split');
+    lines = lines(~strncmp(strtrim(lines), '!', 1));
+    if dropBlank
+        lines = lines(~cellfun(@isempty, strtrim(lines)));
+    end
+end
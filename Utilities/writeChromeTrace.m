@@ -0,0 +1,89 @@
+%% writeChromeTrace.m
+% ==================================================================================================
+% Converts a trace read with M5UnitSynth.getTrace into Chrome trace event JSON, viewable in
+% chrome://tracing or https://ui.perfetto.dev. Commands become slices on a "Commands" track (args:
+% payload size and status), MIDI writes become slices on one track per unit lasting their wire time
+% at 31250 baud, queued/emitted events, overflows and MIDI input messages become instants, and the
+% queue depth a counter.
+%
+%   trace = synth.getTrace();
+%   writeChromeTrace(trace, 'synth.json');
+% ==================================================================================================
+function writeChromeTrace(trace, filename)
+    usPerByte = 320;                    % 10 bits per MIDI byte at 31250 baud
+    pid = 1;
+    tidCommands = 1;
+    tidQueue = 2;
+    tidInput = 3;
+    tidUnit = 10;                       % + unit number
+
+    events = {metadata('process_name', 0, 'M5UnitML'), ...
+              metadata('thread_name', tidCommands, 'Commands'), ...
+              metadata('thread_name', tidQueue, 'Event queue'), ...
+              metadata('thread_name', tidInput, 'MIDI input'), ...
+              metadata('thread_name', tidUnit, 'MIDI unit 0'), ...
+              metadata('thread_name', tidUnit + 1, 'MIDI unit 1')};
+    if height(trace) > 0
+        t0 = trace.TimeUs(1);
+    end
+    openRow = 0;                        % pending Command row waiting for its CommandDone
+    queueDepth = 0;
+    for k = 1:height(trace)
+        ts = trace.TimeUs(k) - t0;
+        arg0 = trace.Arg0(k);
+        arg1 = trace.Arg1(k);
+        switch char(trace.Type(k))
+            case 'Command'
+                openRow = k;
+            case 'CommandDone'
+                % Commands run to completion one at a time, so a done closes the last command
+                if openRow > 0 && trace.Arg0(openRow) == arg0
+                    start = trace.TimeUs(openRow) - t0;
+                    events{end + 1} = struct('name', char(trace.Command(k)), 'cat', 'command', 'ph', 'X', ...
+                        'ts', start, 'dur', ts - start, 'pid', pid, 'tid', tidCommands, ...
+                        'args', struct('opcode', arg0, 'payload', trace.Arg1(openRow), 'status', arg1)); %#ok<AGROW>
+                end
+                openRow = 0;
+            case 'MidiWrite'
+                events{end + 1} = struct('name', 'MIDI', 'cat', 'uart', 'ph', 'X', 'ts', ts, ...
+                    'dur', arg1 * usPerByte, 'pid', pid, 'tid', tidUnit + arg0, 'args', struct('bytes', arg1)); %#ok<AGROW>
+            case 'EventQueued'
+                events{end + 1} = instant('queued', ts, pid, tidQueue, struct('status', arg0)); %#ok<AGROW>
+                queueDepth = arg1;
+                events{end + 1} = depth(ts, pid, tidQueue, queueDepth); %#ok<AGROW>
+            case 'EventEmitted'
+                events{end + 1} = instant('emitted', ts, pid, tidQueue, struct('status', arg0, 'latenessUs', arg1)); %#ok<AGROW>
+                queueDepth = max(queueDepth - 1, 0);
+                events{end + 1} = depth(ts, pid, tidQueue, queueDepth); %#ok<AGROW>
+            case 'QueueOverflow'
+                event = instant('overflow', ts, pid, tidQueue, struct('depth', arg1));
+                event.s = 'g';
+                events{end + 1} = event; %#ok<AGROW>
+            case 'QueueDrained'
+                queueDepth = 0;
+            case 'MidiInput'
+                events{end + 1} = instant('input', ts, pid, tidInput, ...
+                    struct('status', arg0, 'data1', floor(arg1 / 256), 'data2', mod(arg1, 256))); %#ok<AGROW>
+        end
+    end
+
+    fid = fopen(filename, 'w');
+    if fid < 0
+        error('writeChromeTrace:OpenFailed', 'Cannot open %s for writing.', filename);
+    end
+    cleanup = onCleanup(@() fclose(fid));
+    fprintf(fid, '%s', jsonencode(struct('traceEvents', {events}, 'displayTimeUnit', 'ms')));
+    fprintf('Wrote %d trace events to %s\n', numel(events), filename);
+end
+
+function event = metadata(name, tid, value)
+    event = struct('name', name, 'ph', 'M', 'pid', 1, 'tid', tid, 'args', struct('name', value));
+end
+
+function event = instant(name, ts, pid, tid, args)
+    event = struct('name', name, 'cat', 'queue', 'ph', 'i', 's', 't', 'ts', ts, 'pid', pid, 'tid', tid, 'args', args);
+end
+
+function event = depth(ts, pid, tid, value)
+    event = struct('name', 'Queue depth', 'ph', 'C', 'ts', ts, 'pid', pid, 'tid', tid, 'args', struct('depth', value));
+end